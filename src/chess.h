@@ -7,6 +7,7 @@
 #endif
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -87,6 +88,53 @@ struct NetworkMove {
 };
 #pragma pack(pop)
 
+// Compact move used by the engine and the wire protocol
+// Bits 0-5 are the source index, 6-11 the destination index, 12-14 the promotion PieceType
+using EncodedMove = uint16_t;
+
+inline EncodedMove encodeMove(int src, int dst, PieceType promoteType = NONE) {
+    return static_cast<EncodedMove>(src | (dst << 6) | (promoteType << 12));
+}
+
+inline int encodedMoveSrc(EncodedMove move) { return move & 0x3F; }
+inline int encodedMoveDst(EncodedMove move) { return (move >> 6) & 0x3F; }
+inline PieceType encodedMovePromoteType(EncodedMove move) { return static_cast<PieceType>((move >> 12) & 0x7); }
+
+// Online messages the client reads or writes as well, chess-server.h has when each is sent
+#pragma pack(push, 1)
+// The client's is the newest version it speaks and the flags it wants, the server's answer the ones it
+// will use. A client that gets its color before an answer is talking to a server that only speaks 1
+struct Hello {
+    uint8_t version;
+    uint8_t flags;
+};
+
+// A whole move in version 2, optionally followed by the uint64_t ChessGame::positionHash of the position
+// it is played from. Clients send it if they like, the server does if the recipient asked for
+// PROTOCOL_FLAG_HASHES, and whoever gets one checks it before applying the move
+struct CompactMove {
+    uint32_t gameId;
+    EncodedMove move;
+};
+
+// Kept by the client for as long as the game lasts, the token is all it takes to resume the seat
+struct SessionToken {
+    uint64_t token;
+    uint32_t gameId;
+};
+
+// Followed by numMoves EncodedMoves. A client that kept its game replays the ones after its own
+// and checks the hash, one that did not replays them all
+struct ResyncHeader {
+    uint32_t gameId;
+    uint8_t color;
+    int32_t remainingMs[2]; // Indexed by PieceColor, as of the last move
+    uint64_t positionHash;  // ChessGame::positionHash after every move
+    uint16_t totalMoves;
+    uint16_t numMoves;
+};
+#pragma pack(pop)
+
 struct Action {
     std::shared_ptr<Piece> piece;
     struct Move move;
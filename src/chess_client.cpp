@@ -9,14 +9,17 @@ ChessClient::ChessClient()
 }
 
 ChessClient::~ChessClient() {
+    m_Closing = true;
     cleanWsa();
     if (m_ListenerThread.joinable()) {
         m_ListenerThread.join();
     }
 }
 
-void ChessClient::initClient(GameHandler handler) {
+void ChessClient::initClient(GameHandler handler, CompactMoveHandler compactHandler, ResyncHandler resyncHandler) {
     m_GameHandler = handler;
+    m_CompactMoveHandler = compactHandler;
+    m_ResyncHandler = resyncHandler;
     std::string userInput;
     std::cout << "Enter server address: ";
     while (std::getline(std::cin, userInput)) {
@@ -38,13 +41,44 @@ void ChessClient::initClient(GameHandler handler) {
     }
     m_WsaStarted = true;
 
-    m_ClientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (m_ClientSocket == INVALID_SOCKET) {
-        LOG_COUT("Socket creation failed: " << WSAGetLastError());
+    if (!connectToServer()) {
         WSACleanup();
+        m_WsaStarted = false;
         return;
     }
 
+    std::cout << "Connected to server!" << std::endl;
+    std::cout << "Waiting for an opponent.." << std::endl;
+    // Receive match setup information from server, the color is its only one byte message
+    bool paired = false;
+    while (receiveMessage(m_InBuffer)) {
+        if (m_InBuffer.size() == 1) {
+            m_AssignedColor = static_cast<PieceColor>(m_InBuffer[0]);
+            paired = true;
+            break;
+        }
+        if (static_cast<unsigned char>(m_InBuffer[0]) == MESSAGE_HELLO && m_InBuffer.size() >= 1 + sizeof(Hello)) {
+            Hello answer;
+            std::memcpy(&answer, &m_InBuffer[1], sizeof(Hello));
+            m_Version = answer.version;
+        }
+    }
+    if (!paired) {
+        LOG_COUT("Connection closed by server or recv failed");
+        closesocket(m_ClientSocket);
+        WSACleanup();
+    }
+
+    m_ListenerThread = std::thread(&ChessClient::listenLoop, this);
+}
+
+bool ChessClient::connectToServer() {
+    SOCKET clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (clientSocket == INVALID_SOCKET) {
+        LOG_COUT("Socket creation failed: " << WSAGetLastError());
+        return false;
+    }
+
     // Setup server address
     sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
@@ -52,45 +86,109 @@ void ChessClient::initClient(GameHandler handler) {
     inet_pton(AF_INET, m_ServerIp.c_str(), &serverAddr.sin_addr);
 
     // Connect to server
-    result = connect(m_ClientSocket, (sockaddr *)&serverAddr, sizeof(serverAddr));
-    if (result == SOCKET_ERROR) {
+    if (connect(clientSocket, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
         LOG_COUT("Connection failed: " << WSAGetLastError());
-        closesocket(m_ClientSocket);
-        WSACleanup();
-        return;
+        closesocket(clientSocket);
+        return false;
+    }
+    {
+        std::scoped_lock lock(m_SendMutex);
+        m_ClientSocket = clientSocket;
     }
 
-    std::cout << "Connected to server!" << std::endl;
+    // A server that only speaks version 1 never answers, the color comes first then
+    const Hello hello{PROTOCOL_VERSION, PROTOCOL_FLAG_HASHES};
+    std::vector<char> helloMessage(sizeof(unsigned char) + sizeof(Hello));
+    helloMessage[0] = static_cast<char>(MESSAGE_HELLO);
+    std::memcpy(&helloMessage[1], &hello, sizeof(Hello));
+    sendFrame(helloMessage);
+    return true;
+}
 
-    std::cout << "Waiting for an opponent.." << std::endl;
-    // Receive match setup information from server
-    char buffer[256] = {0};
-    int bytesReceived = recv(m_ClientSocket, buffer, 256, 0);
-    if (bytesReceived <= 0) {
-        LOG_COUT("Connection closed by server or recv failed");
+// The server keeps the seat for a while after the connection drops, and answers the token with the
+// whole game, which the resync handler replays. Moves sent in between are lost and played again
+bool ChessClient::reconnect() {
+    {
+        std::scoped_lock lock(m_SendMutex);
         closesocket(m_ClientSocket);
-        WSACleanup();
-    } else {
-        m_AssignedColor = static_cast<PieceColor>(buffer[0]);
+        m_ClientSocket = INVALID_SOCKET;
     }
-
-    m_ListenerThread = std::thread(&ChessClient::listenLoop, this);
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS && !m_Closing; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY_MS));
+        if (m_Closing || !connectToServer()) {
+            continue;
+        }
+        std::vector<char> resumeMessage(sizeof(unsigned char) + sizeof(m_SessionToken));
+        resumeMessage[0] = static_cast<char>(MESSAGE_RESUME);
+        std::memcpy(&resumeMessage[1], &m_SessionToken, sizeof(m_SessionToken));
+        sendFrame(resumeMessage);
+        std::cout << "Reconnected, resuming the game" << std::endl;
+        return true;
+    }
+    return false;
 }
 
 void ChessClient::listenLoop() {
     while (true) {
-        int bytesReceived = recv(m_ClientSocket, m_InBuffer.data(), 4096, 0);
-        if (bytesReceived <= 0) {
+        if (!receiveMessage(m_InBuffer)) {
+            if (m_SessionToken != 0 && !m_Closing && reconnect()) {
+                continue;
+            }
             std::cout << "Connection closed by server, or recv failed" << std::endl;
             break;
         }
+        int bytesReceived = static_cast<int>(m_InBuffer.size());
+        if (m_InBuffer.empty()) {
+            continue;
+        }
+        const unsigned char type = static_cast<unsigned char>(m_InBuffer[0]);
+
+        if (type == MESSAGE_SESSION && m_InBuffer.size() >= 1 + sizeof(SessionToken)) {
+            SessionToken session;
+            std::memcpy(&session, &m_InBuffer[1], sizeof(SessionToken));
+            m_GameId = session.gameId;
+            m_SessionToken = session.token;
+            continue;
+        }
+
+        // Including the answer to a resume that came too late, either way there is no seat left to take back
+        if (type == MESSAGE_GAME_OVER) {
+            std::cout << "Game over" << std::endl;
+            m_SessionToken = 0;
+            continue;
+        }
+
+        // The game id, the move and the hash of the position it is played from, as asked for in the HELLO
+        if (type == MESSAGE_MOVE_V2 && m_InBuffer.size() >= 1 + sizeof(CompactMove) + sizeof(uint64_t)) {
+            CompactMove compact;
+            uint64_t hash;
+            std::memcpy(&compact, &m_InBuffer[1], sizeof(CompactMove));
+            std::memcpy(&hash, &m_InBuffer[1 + sizeof(CompactMove)], sizeof(hash));
+            if (compact.gameId == m_GameId) {
+                m_CompactMoveHandler(compact.move, hash);
+            }
+            continue;
+        }
+
+        if (type == MESSAGE_RESYNC && m_InBuffer.size() >= 1 + sizeof(ResyncHeader)) {
+            ResyncHeader header;
+            std::memcpy(&header, &m_InBuffer[1], sizeof(ResyncHeader));
+            if (m_InBuffer.size() < 1 + sizeof(ResyncHeader) + header.numMoves * sizeof(EncodedMove)) {
+                std::cerr << "Didn't receive the whole game\n";
+                continue;
+            }
+            std::vector<EncodedMove> moves(header.numMoves);
+            std::memcpy(moves.data(), &m_InBuffer[1 + sizeof(ResyncHeader)], header.numMoves * sizeof(EncodedMove));
+            m_ResyncHandler(header, moves);
+            continue;
+        }
 
         // Server will send the 0x55 command, piece key, NetworkMove, serializedBoard, and the turn color
         if (bytesReceived >= 2 + sizeof(NetworkMove) + NUM_SQUARES + 1) {
             std::cout << "Received " << bytesReceived << " bytes:" << std::endl;
             int i = 0;
             unsigned char *data = reinterpret_cast<unsigned char *>(m_InBuffer.data());
-            if (data[i] == 0x55) {
+            if (data[i] == MESSAGE_MOVE) {
                 i++;
 
                 // Get piece
@@ -119,6 +217,49 @@ void ChessClient::listenLoop() {
     }
 }
 
+bool ChessClient::receiveAll(char *buffer, int len) {
+    while (len > 0) {
+        int bytesReceived = recv(m_ClientSocket, buffer, len, 0);
+        if (bytesReceived <= 0) {
+            return false;
+        }
+        buffer += bytesReceived;
+        len -= bytesReceived;
+    }
+    return true;
+}
+
+// A message can arrive split over several reads, or together with the next one
+bool ChessClient::receiveFrame(std::vector<char> &frame) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (!receiveAll(reinterpret_cast<char *>(header), FRAME_HEADER_SIZE)) {
+        return false;
+    }
+    frame.resize(header[0] << 8 | header[1]);
+    return frame.empty() || receiveAll(frame.data(), static_cast<int>(frame.size()));
+}
+
+// Skips over pings, answering each, the server closes connections that stay silent
+bool ChessClient::receiveMessage(std::vector<char> &frame) {
+    while (receiveFrame(frame)) {
+        if (frame.size() != 1 || static_cast<unsigned char>(frame[0]) != FRAME_PING) {
+            return true;
+        }
+        sendFrame({static_cast<char>(FRAME_PONG)});
+    }
+    return false;
+}
+
+void ChessClient::sendFrame(const std::vector<char> &payload) {
+    std::vector<char> frame;
+    frame.reserve(FRAME_HEADER_SIZE + payload.size());
+    frame.push_back(static_cast<char>(payload.size() >> 8));
+    frame.push_back(static_cast<char>(payload.size() & 0xFF));
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    std::scoped_lock lock(m_SendMutex);
+    send(m_ClientSocket, frame.data(), static_cast<int>(frame.size()), 0);
+}
+
 void ChessClient::writeMove(const std::shared_ptr<Piece> &piece, const Move &move) {
     NetworkMove networkMove;
     networkMove.src = move.src;
@@ -141,13 +282,30 @@ void ChessClient::sendMove(
     const Move &move) {
     // Send move to server and validate
     m_OutBuffer.clear();
-    m_OutBuffer.push_back(0x55);
+    m_OutBuffer.push_back(MESSAGE_MOVE);
     m_OutBuffer.insert(m_OutBuffer.end(), board.begin(), board.end());
     writeMove(piece, move);
-    send(m_ClientSocket, reinterpret_cast<const char *>(m_OutBuffer.data()), static_cast<int>(m_OutBuffer.size()), 0);
+    sendFrame(m_OutBuffer);
+    m_OutBuffer.clear();
+}
+
+// The server checks the hash against its own instead of being sent the board
+void ChessClient::sendCompactMove(uint64_t positionHash, const Move &move) {
+    const CompactMove compact{m_GameId, encodeMove(posToIndex(move.src), posToIndex(move.dst), move.promoteType)};
+    m_OutBuffer.clear();
+    m_OutBuffer.push_back(static_cast<char>(MESSAGE_MOVE_V2));
+    const char *compactBytes = reinterpret_cast<const char *>(&compact);
+    m_OutBuffer.insert(m_OutBuffer.end(), compactBytes, compactBytes + sizeof(CompactMove));
+    const char *hashBytes = reinterpret_cast<const char *>(&positionHash);
+    m_OutBuffer.insert(m_OutBuffer.end(), hashBytes, hashBytes + sizeof(positionHash));
+    sendFrame(m_OutBuffer);
     m_OutBuffer.clear();
 }
 
+void ChessClient::requestResync() {
+    sendFrame({static_cast<char>(MESSAGE_RESYNC)});
+}
+
 void ChessClient::cleanWsa() {
     if (m_ClientSocket != INVALID_SOCKET) {
         closesocket(m_ClientSocket);
@@ -2,10 +2,29 @@
 #pragma once
 #include "chess.h"
 #include "piece.h"
+#include <atomic>
+#include <cstring>
+
+#define FRAME_HEADER_SIZE 2 // Every message is preceded by its length as a big endian uint16
+#define FRAME_PING 0x50     // One byte frames the server sends while it hears nothing, answered with a pong
+#define FRAME_PONG 0x51
+#define PROTOCOL_VERSION 2        // Offered in a HELLO right after connecting
+#define PROTOCOL_FLAG_HASHES 0x01 // Moves come with the hash of the position they are played from
+#define MESSAGE_MOVE 0x55
+#define MESSAGE_HELLO 0x48
+#define MESSAGE_MOVE_V2 0x4D
+#define MESSAGE_SESSION 0x54
+#define MESSAGE_RESYNC 0x59 // Sent alone when the hashes stop matching, answered with the whole game
+#define MESSAGE_RESUME 0x52 // Followed by the session token on a new connection, also answered with the whole game
+#define MESSAGE_GAME_OVER 0x47
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_DELAY_MS 2000 // The attempts span most of the time the server keeps the seat
 
 namespace chess_online {
 using GameHandler = std::function<void(
     unsigned char, NetworkMove, std::array<unsigned char, NUM_SQUARES>, PieceColor)>;
+using CompactMoveHandler = std::function<void(EncodedMove, uint64_t)>;
+using ResyncHandler = std::function<void(const ResyncHeader &, const std::vector<EncodedMove> &)>;
 
 class ChessClient {
 private:
@@ -16,19 +35,35 @@ private:
     std::thread m_ListenerThread;
     std::vector<char> m_OutBuffer;
     std::vector<char> m_InBuffer;
+    std::mutex m_SendMutex; // Pongs are sent from the listener thread, moves from the game's
     PieceColor m_AssignedColor = WHITE;
-    GameHandler m_GameHandler;
+    uint8_t m_Version = 1;               // Agreed on before the color arrives, never changes after
+    std::atomic<uint32_t> m_GameId{0};   // From the SESSION message that follows the color
+    uint64_t m_SessionToken = 0;         // From the same message, 0 once the game is over
+    std::atomic<bool> m_Closing{false};  // Stops a dropped connection from being resumed
+    GameHandler m_GameHandler;           // Version 1 moves
+    CompactMoveHandler m_CompactMoveHandler;
+    ResyncHandler m_ResyncHandler;
 
+    bool connectToServer(); // Connects and says HELLO
+    bool reconnect();       // Takes the seat back on a new connection
     void listenLoop();
+    bool receiveAll(char *buffer, int len);
+    bool receiveFrame(std::vector<char> &frame);
+    bool receiveMessage(std::vector<char> &frame);
+    void sendFrame(const std::vector<char> &payload);
     void cleanWsa();
 
 public:
     ChessClient();
     ~ChessClient();
-    void initClient(GameHandler handler);
+    void initClient(GameHandler handler, CompactMoveHandler compactHandler, ResyncHandler resyncHandler);
     void writeMove(const std::shared_ptr<Piece> &piece, const Move &move);
     void sendMove(std::array<unsigned char, NUM_SQUARES> board, const std::shared_ptr<Piece> &piece, const Move &move);
+    void sendCompactMove(uint64_t positionHash, const Move &move);
+    void requestResync();
     PieceColor getAssignedColor() { return m_AssignedColor; };
+    uint8_t getVersion() { return m_Version; };
 };
 } // namespace chess_online
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "chess_game.h"
 #include "sdl_audio_handler.h"
 #include "sdl_render_handler.h"
+#include "zobrist.h"
 #include <iostream>
 #include <thread>
 
@@ -70,6 +71,7 @@ void ChessGame::setupInitialPieces(std::array<Square, NUM_SQUARES> &board) {
         m_Board[index].occupyingPiece = piece;
         m_Pieces.emplace(piece->getPieceKey(), piece);
     }
+    m_PieceHash = hashPieces();
 }
 #ifdef CHESS_CLIENT_BUILD
 void ChessGame::gameSetup() {
@@ -120,13 +122,20 @@ void ChessGame::gameLoop() {
 void ChessGame::run() {
     gameSetup();
     if (m_IsOnline) {
-        m_ChessClient.initClient([this](
-                                     unsigned char pieceKey,
-                                     NetworkMove networkMove,
-                                     std::array<unsigned char, NUM_SQUARES> serializedBoard,
-                                     PieceColor color) {
-            clientMoveHandler(pieceKey, networkMove, serializedBoard, color);
-        });
+        m_ChessClient.initClient(
+            [this](
+                unsigned char pieceKey,
+                NetworkMove networkMove,
+                std::array<unsigned char, NUM_SQUARES> serializedBoard,
+                PieceColor color) {
+                clientMoveHandler(pieceKey, networkMove, serializedBoard, color);
+            },
+            [this](EncodedMove encoded, uint64_t hash) {
+                clientCompactMoveHandler(encoded, hash);
+            },
+            [this](const ResyncHeader &header, const std::vector<EncodedMove> &moves) {
+                clientResyncHandler(header, moves);
+            });
 
         m_PlayerColor = m_ChessClient.getAssignedColor();
         if (m_PlayerColor == BLACK) {
@@ -220,7 +229,9 @@ void ChessGame::selectDestination(int x, int y) {
     // If move results in promotion, prompt for choice
     choosePawnPromotion(piece, move);
 
-    if (m_IsOnline) {
+    if (m_IsOnline && m_ChessClient.getVersion() >= 2) {
+        m_ChessClient.sendCompactMove(positionHash(), move);
+    } else if (m_IsOnline) {
         m_ChessClient.sendMove(serializeBoard(), piece, move);
     } else {
         processMove(piece, move);
@@ -280,6 +291,47 @@ void ChessGame::clientMoveHandler(
     m_CurrentTurnColor = turnColor;
 }
 
+// The hash is of the position the move is played from, which has to be ours
+void ChessGame::clientCompactMoveHandler(EncodedMove encoded, uint64_t hash) {
+    if (m_Resyncing) {
+        return;
+    }
+    Action action;
+    if (hash != positionHash() || !findMove(encoded, action)) {
+        LOG_COUT("Lost track of the game, asking the server for all of it");
+        m_Resyncing = true;
+        m_ChessClient.requestResync();
+        return;
+    }
+    processMove(action.piece, action.move);
+    m_CurrentTurnColor = m_CurrentTurnColor == BLACK ? WHITE : BLACK;
+}
+
+// Starts over and replays the server's moves, then the hashes have to agree
+void ChessGame::clientResyncHandler(const ResyncHeader &header, const std::vector<EncodedMove> &moves) {
+    m_Resyncing = false;
+    if (header.numMoves != header.totalMoves) {
+        LOG_COUT("Game is too long to resync");
+        m_Running = false;
+        return;
+    }
+    const PieceColor playerColor = m_PlayerColor;
+    resetGame();
+    m_PlayerColor = playerColor;
+    for (EncodedMove encoded : moves) {
+        Action action;
+        if (!findMove(encoded, action)) {
+            m_Running = false;
+            return;
+        }
+        processMove(action.piece, action.move);
+        m_CurrentTurnColor = m_CurrentTurnColor == BLACK ? WHITE : BLACK;
+    }
+    if (positionHash() != header.positionHash) {
+        m_Running = false;
+    }
+}
+
 void ChessGame::unselectAllSquares() {
     for (Square &square : m_Board) {
         square.isHighlighted = false;
@@ -303,6 +355,7 @@ void ChessGame::undoMove() {
     Square *srcSquare = piece->getSquare();
     Square *dstSquare = getSquareAtPosition(m_Board, move.dst);
 
+    togglePiece(piece, srcSquare->pos);
     piece->performMove(m_Board, move);
     dstSquare->occupyingPiece = std::move(srcSquare->occupyingPiece);
 
@@ -317,6 +370,7 @@ void ChessGame::undoMove() {
         // the square that it was captured from
         Square *capturedSquare = move.capturedPiece->getSquare();
         capturedSquare->occupyingPiece = move.capturedPiece;
+        togglePiece(move.capturedPiece, capturedSquare->pos);
 
         move.capturedPiece->setIsAlive(true);
         m_RenderHandler.undoCapture(move.capturedPiece->getColor());
@@ -327,8 +381,10 @@ void ChessGame::undoMove() {
         Square *rookSrcSquare = move.castlingRook->getSquare();
         Square *rookDstSquare = getSquareAtPosition(m_Board, move.castlingRookDst);
 
+        togglePiece(move.castlingRook, rookSrcSquare->pos);
         move.castlingRook->performMove(m_Board, move);
         rookDstSquare->occupyingPiece = std::move(rookSrcSquare->occupyingPiece);
+        togglePiece(move.castlingRook, rookDstSquare->pos);
     }
 
     // Undo promote
@@ -338,6 +394,7 @@ void ChessGame::undoMove() {
             pawn->undoPromote();
         }
     }
+    togglePiece(piece, dstSquare->pos);
 
     // Switch turn
     m_CurrentTurnColor = m_CurrentTurnColor == BLACK ? WHITE : BLACK;
@@ -365,6 +422,7 @@ void ChessGame::resetGame() {
     }
     unselectAllSquares();
     m_ActionHistory.clear();
+    m_PieceHash = hashPieces();
     m_InProgress = true;
     m_CurrentTurnColor = WHITE;
     // Temporary until online functionality added
@@ -384,6 +442,7 @@ void ChessGame::processMove(const std::shared_ptr<Piece> &piece, const Move &mov
         // Captured piece is not always the destination square in moves like en passante
         Square *capturedSquare = move.capturedPiece->getSquare();
         capturedSquare->occupyingPiece = nullptr;
+        togglePiece(move.capturedPiece, capturedSquare->pos);
 
         move.capturedPiece->setIsAlive(false);
 #ifdef CHESS_CLIENT_BUILD
@@ -391,16 +450,21 @@ void ChessGame::processMove(const std::shared_ptr<Piece> &piece, const Move &mov
 #endif
     }
 
+    // Taken off before and put back after the move, which may have promoted it
+    togglePiece(piece, srcSquare->pos);
     piece->performMove(m_Board, move);
     dstSquare->occupyingPiece = std::move(srcSquare->occupyingPiece);
+    togglePiece(piece, dstSquare->pos);
 
     // Castling
     if (move.castlingRook && isValidPosition(move.castlingRookDst)) {
         Square *rookSrcSquare = move.castlingRook->getSquare();
         Square *rookDstSquare = getSquareAtPosition(m_Board, move.castlingRookDst);
 
+        togglePiece(move.castlingRook, rookSrcSquare->pos);
         move.castlingRook->performMove(m_Board, move);
         rookDstSquare->occupyingPiece = std::move(rookSrcSquare->occupyingPiece);
+        togglePiece(move.castlingRook, rookDstSquare->pos);
     }
 
     // Push performed action to stack
@@ -554,6 +618,59 @@ Move ChessGame::decodeMove(NetworkMove networkMove) {
     return move;
 }
 
+NetworkMove ChessGame::encodeNetworkMove(const Move &move) {
+    NetworkMove networkMove;
+    networkMove.src = move.src;
+    networkMove.dst = move.dst;
+    networkMove.capturedPiece = move.capturedPiece ? move.capturedPiece->getPieceKey() : 0;
+    networkMove.castlingRookSrc = move.castlingRookSrc;
+    networkMove.castlingRookDst = move.castlingRookDst;
+    networkMove.castlingRook = move.castlingRook ? move.castlingRook->getPieceKey() : 0;
+    networkMove.promoteType = move.promoteType;
+    networkMove.firstMove = move.firstMove;
+    return networkMove;
+}
+
+std::vector<Action> ChessGame::getValidMoves() {
+    std::vector<Action> validMoves;
+    for (const std::shared_ptr<Piece> &piece : m_CurrentTurnColor == BLACK ? m_BlackPieces : m_WhitePieces) {
+        if (!piece->isAlive()) {
+            continue;
+        }
+        for (Move &move : piece->getPossibleMoves(m_Board, m_ActionHistory)) {
+            if (isValidMove(piece, move)) {
+                move.firstMove = !piece->hasMoved(); // Otherwise kings and rooks never lose their castling rights
+                validMoves.push_back({piece, move});
+            }
+        }
+    }
+    return validMoves;
+}
+
+bool ChessGame::findMove(EncodedMove encoded, Action &action) {
+    const std::shared_ptr<Piece> piece = m_Board[encodedMoveSrc(encoded)].occupyingPiece;
+    if (!piece || piece->getColor() != m_CurrentTurnColor) {
+        return false;
+    }
+    for (Move &move : piece->getPossibleMoves(m_Board, m_ActionHistory)) {
+        if (posToIndex(move.dst) != encodedMoveDst(encoded) || !isValidMove(piece, move)) {
+            continue;
+        }
+        // A pawn reaching the last rank has to say what it becomes, nothing else may
+        const PieceType promoteType = encodedMovePromoteType(encoded);
+        auto pawn = std::dynamic_pointer_cast<Pawn>(piece);
+        const bool promotes = pawn && !pawn->isPromoted() && pawn->canPromote(move);
+        if (promotes != (promoteType != NONE) || promoteType == PAWN || promoteType == KING) {
+            return false;
+        }
+        move.promoteType = promoteType;
+        move.firstMove = !piece->hasMoved();
+        action = {piece, move};
+        return true;
+    }
+    return false;
+}
+
 std::shared_ptr<Piece> ChessGame::getPiece(unsigned char pieceKey) {
     if (m_Pieces.find(pieceKey) != m_Pieces.end()) {
         return m_Pieces[pieceKey];
@@ -582,4 +699,37 @@ std::array<unsigned char, NUM_SQUARES> ChessGame::serializeBoard() {
     }
     return serializedBoard;
 }
+
+// Castling rights and en passant are left out, the server and the client both derive the hash from the
+// same pieces, so it tells whether they agree on the position
+uint64_t ChessGame::positionHash() {
+    return m_CurrentTurnColor == BLACK ? m_PieceHash ^ ZOBRIST.side : m_PieceHash;
+}
+
+// From scratch, moves keep it up to date from then on
+uint64_t ChessGame::hashPieces() {
+    uint64_t hash = 0;
+    for (int i = 0; i < NUM_SQUARES; i++) {
+        const std::shared_ptr<Piece> &piece = m_Board[i].occupyingPiece;
+        if (piece) {
+            hash ^= ZOBRIST.pieces[piece->getColor()][piece->getType()][i];
+        }
+    }
+    return hash;
+}
+
+// Puts the piece on the square in the hash, or takes it off if it was there
+void ChessGame::togglePiece(const std::shared_ptr<Piece> &piece, const Position &pos) {
+    m_PieceHash ^= ZOBRIST.pieces[piece->getColor()][piece->getType()][posToIndex(pos)];
+}
+
+std::vector<EncodedMove> ChessGame::getMoveHistory() {
+    std::vector<EncodedMove> moves;
+    moves.reserve(m_ActionHistory.size());
+    for (const Action &action : m_ActionHistory) {
+        const Move &move = action.move;
+        moves.push_back(encodeMove(posToIndex(move.src), posToIndex(move.dst), move.promoteType));
+    }
+    return moves;
+}
 } // namespace chess_online
\ No newline at end of file
@@ -25,10 +25,8 @@ private:
     AudioHandler m_AudioHandler;
     ChessClient m_ChessClient;
     bool m_IsOnline = false;
+    bool m_Resyncing = false; // Moves are ignored until the RESYNC asked for arrives, it has them all
     std::vector<Move> m_MovesForSelected;
-#endif
-#ifdef CHESS_SERVER_BUILD
-    std::mutex m_Mutex;
 #endif
     std::set<std::shared_ptr<Piece>> m_WhitePieces;
     std::set<std::shared_ptr<Piece>> m_BlackPieces;
@@ -39,11 +37,14 @@ private:
     PieceColor m_CurrentTurnColor = WHITE;
     Square *m_SelectedSquare = nullptr;
     std::vector<Action> m_ActionHistory;
+    uint64_t m_PieceHash = 0; // Zobrist hash of the pieces where they stand, updated by every move
 
 #ifdef CHESS_SERVER_BUILD
     void generateInitialBoard(std::array<Square, 64> &board);
 #endif
     void setupInitialPieces(std::array<Square, NUM_SQUARES> &board);
+    uint64_t hashPieces();
+    void togglePiece(const std::shared_ptr<Piece> &piece, const Position &pos);
 
 #ifdef CHESS_CLIENT_BUILD
     void gameSetup();
@@ -54,6 +55,8 @@ private:
         NetworkMove networkMove,
         std::array<unsigned char, NUM_SQUARES> serializedBoard,
         PieceColor turnColor);
+    void clientCompactMoveHandler(EncodedMove encoded, uint64_t hash);
+    void clientResyncHandler(const ResyncHeader &header, const std::vector<EncodedMove> &moves);
     void selectSource(int x, int y);
     void selectDestination(int x, int y);
     void choosePawnPromotion(const std::shared_ptr<Piece> &piece, Move &move);
@@ -65,9 +68,6 @@ public:
     ChessGame();
 #ifdef CHESS_CLIENT_BUILD
     void run();
-#endif
-#ifdef CHESS_SERVER_BUILD
-    std::mutex &getMutex() { return m_Mutex; };
 #endif
     bool isValidMove(const std::shared_ptr<Piece> &piece, const Move &move);
     bool isKingInCheck(std::array<Square, NUM_SQUARES> &board, PieceColor Color);
@@ -75,10 +75,15 @@ public:
     bool isCurrentPlayersTurn();
     void processMove(const std::shared_ptr<Piece> &piece, const Move &move);
     bool isCheckmate();
+    std::vector<Action> getValidMoves(); // Every legal move of the side to move
+    bool findMove(EncodedMove encoded, Action &action); // False unless it is one of getValidMoves
     std::shared_ptr<Piece> getPiece(unsigned char pieceKey);
     PieceColor getTurn();
     std::array<unsigned char, NUM_SQUARES> serializeBoard();
     Move decodeMove(NetworkMove data);
+    static NetworkMove encodeNetworkMove(const Move &move);
+    std::vector<EncodedMove> getMoveHistory();
+    uint64_t positionHash(); // Zobrist hash of the pieces and the side to move, kept up to date as moves are made
 };
 
 } // namespace chess_online
\ No newline at end of file
@@ -61,11 +61,11 @@ std::vector<Move> Pawn::getPossibleMoves(const std::array<Square, NUM_SQUARES> &
             isOpposingPiece(board[posToIndex(leftDiagonal)].occupyingPiece)) {
             moves.push_back({getSquare()->pos, leftDiagonal, board[posToIndex(leftDiagonal)].occupyingPiece});
         }
-        // En passante
-        if (m_RowsAdvanced == 3 && positionIsOccupied(board, {x - 1, y})) {
+        // En passante, only right after the pawn next to it came up two squares past this one
+        if (m_RowsAdvanced == 3 && !positionIsOccupied(board, leftDiagonal) && positionIsOccupied(board, {x - 1, y})) {
             const std::shared_ptr<Piece> &occupyingPiece = board[posToIndex({x - 1, y})].occupyingPiece;
-            if (isOpposingPiece(occupyingPiece) &&
-                actionHistory.back().piece == occupyingPiece) {
+            if (isOpposingPiece(occupyingPiece) && actionHistory.back().piece == occupyingPiece &&
+                std::abs(actionHistory.back().move.dst.y - actionHistory.back().move.src.y) == 2) {
                 moves.push_back({getSquare()->pos, leftDiagonal, occupyingPiece});
             }
         }
@@ -78,11 +78,11 @@ std::vector<Move> Pawn::getPossibleMoves(const std::array<Square, NUM_SQUARES> &
             isOpposingPiece(board[posToIndex(rightDiagonal)].occupyingPiece)) {
             moves.push_back({getSquare()->pos, rightDiagonal, board[posToIndex(rightDiagonal)].occupyingPiece});
         }
-        // En passante
-        if (m_RowsAdvanced == 3 && positionIsOccupied(board, {x + 1, y})) {
+        // En passante, only right after the pawn next to it came up two squares past this one
+        if (m_RowsAdvanced == 3 && !positionIsOccupied(board, rightDiagonal) && positionIsOccupied(board, {x + 1, y})) {
             const std::shared_ptr<Piece> &occupyingPiece = board[posToIndex({x + 1, y})].occupyingPiece;
-            if (isOpposingPiece(occupyingPiece) &&
-                actionHistory.back().piece == occupyingPiece) {
+            if (isOpposingPiece(occupyingPiece) && actionHistory.back().piece == occupyingPiece &&
+                std::abs(actionHistory.back().move.dst.y - actionHistory.back().move.src.y) == 2) {
                 moves.push_back({getSquare()->pos, rightDiagonal, occupyingPiece});
             }
         }
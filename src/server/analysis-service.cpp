@@ -0,0 +1,118 @@
+#ifdef CHESS_SERVER_BUILD
+#include "analysis-service.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace chess_online {
+
+namespace {
+// A result answers a request if it went deep enough, or found a mate that deeper search cannot change
+bool answers(const SearchResult &result, int depth) {
+    return result.depth >= depth || std::abs(result.score) > MATE_BOUND;
+}
+} // namespace
+
+AnalysisService::AnalysisService(SearchScheduler &scheduler, AnalysisDelivery delivery)
+    : m_Scheduler(scheduler), m_Delivery(std::move(delivery)) {
+}
+
+bool AnalysisService::parsePosition(const std::string &position, bool isFen, EngineBoard &board) {
+    if (isFen) {
+        if (!EngineBoard::fromFen(position, board)) {
+            return false;
+        }
+    } else {
+        board = EngineBoard();
+        std::istringstream moves(position);
+        std::string uci;
+        while (moves >> uci) {
+            EncodedMove move = board.parseMove(uci);
+            if (!move) {
+                return false;
+            }
+            board.makeMove(move);
+        }
+    }
+    // A FEN can leave the side that is not to move in check, which no game can reach
+    return !board.leftKingInCheck();
+}
+
+bool AnalysisService::analyse(const Recipient &client, uint32_t requestId, const EngineBoard &board, int depth,
+                              int timeMs, SearchResult &cached) {
+    depth = depth > 0 ? std::min(depth, ANALYSIS_MAX_DEPTH) : ANALYSIS_MAX_DEPTH;
+    timeMs = timeMs > 0 ? std::min(timeMs, ANALYSIS_MAX_TIME_MS) : ANALYSIS_MAX_TIME_MS;
+    const uint64_t hash = board.hash();
+    const SearchClock::time_point deadline = SearchClock::now() + std::chrono::milliseconds(timeMs);
+    SearchKey key;
+    {
+        std::scoped_lock lock(m_Mutex);
+        auto cacheIt = m_Cache.find(hash);
+        if (cacheIt != m_Cache.end() && answers(cacheIt->second, depth)) {
+            cached = cacheIt->second;
+            return true;
+        }
+
+        // Join the shallowest search of this position that is at least as deep as asked for and will not
+        // be stopped sooner than this request allows, a shorter deadline would cut the answer short
+        for (auto inFlightIt = m_InFlight.lower_bound({hash, depth, 0});
+             inFlightIt != m_InFlight.end() && std::get<0>(inFlightIt->first) == hash; ++inFlightIt) {
+            if (inFlightIt->second.deadline >= deadline) {
+                inFlightIt->second.waiters.push_back({client, requestId});
+                return false;
+            }
+        }
+        key = {hash, depth, m_NextSearch++};
+        m_InFlight[key] = {deadline, {{client, requestId}}};
+    }
+
+    SearchLimits limits;
+    limits.maxDepth = depth;
+    limits.deadline = deadline;
+    limits.useBook = false; // A book move comes without a score, which is useless for review
+    m_Scheduler.submit(board, limits, [this, key](const SearchResult &result) {
+        complete(key, result);
+    });
+    return false;
+}
+
+void AnalysisService::cancelClient(const Recipient &client) {
+    std::scoped_lock lock(m_Mutex);
+    for (auto &[key, search] : m_InFlight) {
+        std::vector<Waiter> &waiters = search.waiters;
+        waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                     [&client](const Waiter &waiter) {
+                                         return waiter.client.fd == client.fd &&
+                                                waiter.client.generation == client.generation;
+                                     }),
+                      waiters.end());
+    }
+}
+
+void AnalysisService::complete(const SearchKey &key, const SearchResult &result) {
+    const uint64_t hash = std::get<0>(key);
+    std::scoped_lock lock(m_Mutex);
+    auto cacheIt = m_Cache.find(hash);
+    if (cacheIt == m_Cache.end()) {
+        m_Cache.emplace(hash, result);
+        m_CacheOrder.push_back(hash);
+        if (m_CacheOrder.size() > ANALYSIS_CACHE_ENTRIES) {
+            m_Cache.erase(m_CacheOrder.front());
+            m_CacheOrder.pop_front();
+        }
+    } else if (result.depth >= cacheIt->second.depth) {
+        cacheIt->second = result;
+    }
+
+    // Delivering under the lock means a client that cancelled can never be answered afterwards
+    auto inFlightIt = m_InFlight.find(key);
+    if (inFlightIt == m_InFlight.end()) {
+        return;
+    }
+    for (const Waiter &waiter : inFlightIt->second.waiters) {
+        m_Delivery(waiter.client, waiter.requestId, result);
+    }
+    m_InFlight.erase(inFlightIt);
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
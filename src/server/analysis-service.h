@@ -0,0 +1,67 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "engine-board.h"
+#include "search-scheduler.h"
+#include "server.h"
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#define ANALYSIS_MAX_DEPTH 24
+#define ANALYSIS_MAX_TIME_MS 10000
+#define ANALYSIS_CACHE_ENTRIES 65536U
+
+namespace chess_online {
+
+using AnalysisDelivery = std::function<void(const Recipient &client, uint32_t requestId, const SearchResult &result)>;
+
+// Runs "analyse this position" requests on the shared search pool. Finished results are cached
+// by position hash and the depth they reached, and requests for a position that is already being
+// searched at least as deep, with at least as much time left, are batched onto that search instead
+// of starting another one
+class AnalysisService {
+public:
+    // The delivery callback runs on a search thread and never for a client after cancelClient returns
+    AnalysisService(SearchScheduler &scheduler, AnalysisDelivery delivery);
+    AnalysisService(const AnalysisService &) = delete;
+    AnalysisService &operator=(const AnalysisService &) = delete;
+
+    // Accepts a FEN or a space separated list of UCI moves from the starting position
+    static bool parsePosition(const std::string &position, bool isFen, EngineBoard &board);
+
+    // Returns true with the result filled in when the cache already answers the request
+    bool analyse(const Recipient &client, uint32_t requestId, const EngineBoard &board, int depth, int timeMs,
+                 SearchResult &cached);
+    void cancelClient(const Recipient &client); // Only that connection, not a later one given the same fd
+
+private:
+    struct Waiter {
+        Recipient client;
+        uint32_t requestId;
+    };
+
+    using SearchKey = std::tuple<uint64_t, int, uint64_t>; // Position hash, requested depth, search number
+
+    struct InFlightSearch {
+        SearchClock::time_point deadline;
+        std::vector<Waiter> waiters;
+    };
+
+    SearchScheduler &m_Scheduler;
+    AnalysisDelivery m_Delivery;
+    std::mutex m_Mutex;
+    std::unordered_map<uint64_t, SearchResult> m_Cache; // Deepest result seen for each position
+    std::deque<uint64_t> m_CacheOrder;                  // Insertion order, oldest evicted first
+    std::map<SearchKey, InFlightSearch> m_InFlight;
+    uint64_t m_NextSearch = 1;
+
+    void complete(const SearchKey &key, const SearchResult &result);
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifdef CHESS_SERVER_BUILD
+#include "opening-book.h"
+#include <cstdlib>
+#include <iostream>
+
+// Builds the binary opening book the server maps at startup
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <opening lines> <output book> [max ply]" << std::endl;
+        return 1;
+    }
+    int maxPly = argc > 3 ? std::atoi(argv[3]) : BOOK_MAX_PLY;
+    return chess_online::OpeningBook::writeBook(argv[1], argv[2], maxPly) ? 0 : 1;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifdef CHESS_SERVER_BUILD
+#include "../chess_game.h"
+#include <iostream>
+
+using namespace chess_online;
+
+static int failures = 0;
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+// Squares by name, white starts on the bottom two rows, which are y 6 and 7
+static int square(const char *name) {
+    return posToIndex({name[0] - 'a', '8' - name[1]});
+}
+
+// Plays the moves in order, each as a source and destination square, false at the first illegal one
+static bool play(ChessGame &game, std::initializer_list<const char *> moves) {
+    for (const char *move : moves) {
+        Action action;
+        if (!game.findMove(encodeMove(square(move), square(move + 2)), action)) {
+            std::cerr << "Illegal move " << move << std::endl;
+            return false;
+        }
+        game.processMove(action.piece, action.move);
+    }
+    return true;
+}
+
+static int movesBetween(ChessGame &game, const char *src, const char *dst) {
+    int count = 0;
+    for (const Action &action : game.getValidMoves()) {
+        count += posToIndex(action.move.src) == square(src) && posToIndex(action.move.dst) == square(dst);
+    }
+    return count;
+}
+
+static void afterDoublePush() {
+    ChessGame game;
+    check(play(game, {"e2e4", "a7a6", "e4e5", "d7d5"}), "the opening is legal");
+    check(movesBetween(game, "e5", "d6") == 1, "en passant is allowed right after a double push");
+    check(play(game, {"e5d6"}) && game.serializeBoard()[square("d5")] == 0, "en passant takes the pawn that was passed");
+}
+
+static void afterSinglePush() {
+    ChessGame game;
+    check(play(game, {"e2e4", "d7d6", "e4e5", "a7a6", "a2a3", "d6d5"}), "the opening is legal");
+    check(movesBetween(game, "e5", "d6") == 0, "en passant is not allowed after a pawn came up one square");
+}
+
+// The pawn next to ours got there by capturing, and the square behind it is taken, so the only move
+// there is the plain capture. Two moves with the same squares cannot be told apart in an EncodedMove
+static void targetOccupied() {
+    ChessGame game;
+    check(play(game, {"e2e4", "e7e6", "e4e5", "f8d6", "b1c3", "c7c6", "c3d5", "c6d5"}), "the opening is legal");
+    check(movesBetween(game, "e5", "d6") == 1, "a capture onto a square behind a pawn is not doubled by en passant");
+    check(play(game, {"e5d6"}) && game.serializeBoard()[square("d5")] != 0, "the plain capture leaves the pawn beside it");
+}
+
+// Checks the pawn rules that findMove depends on, exits with the number of failed checks
+int main() {
+    afterDoublePush();
+    afterSinglePush();
+    targetOccupied();
+    if (failures == 0) {
+        std::cout << "chess game: all checks passed" << std::endl;
+    }
+    return failures;
+}
+#endif
\ No newline at end of file
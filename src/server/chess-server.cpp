@@ -1,175 +1,945 @@
 #ifdef CHESS_SERVER_BUILD
 #include "chess-server.h"
-#include "helpers.h"
+#include "logger.h"
 #include "server.h"
 
 namespace chess_online {
-ChessServer::ChessServer() : m_Server(Server(12312)) {
+ChessServer::ChessServer(IoBackend backend, HeartbeatConfig heartbeat)
+    : m_Server(Server(12312, backend, heartbeat)), m_Analysis(m_SearchScheduler, [this](const Recipient &client, uint32_t requestId, const SearchResult &result) {
+          const std::vector<char> message = analysisMessage(requestId, ANALYSIS_SEARCHED, result);
+          m_Server.sendFrame(client, Server::makeFrame(message.data(), message.size()));
+      }),
+      m_FairPlay(m_SearchScheduler, &m_OpeningBook) {
     m_Server.registerDataHandler([this](int client, Data &inData, Data &outData) {
         responseHandler(client, inData, outData);
     });
     m_Server.registerAcceptHandler([this](int client) {
         acceptHandler(client);
     });
-    m_Server.registerDisconnectHandler([this](int client) {
-        disconnectHandler(client);
+    m_Server.registerDisconnectHandler([this](int client, uint32_t generation) {
+        disconnectHandler(client, generation);
     });
+    m_Server.registerResyncHandler([this](int client) {
+        resyncHandler(client);
+    });
+    m_Tablebases.loadDirectory(TABLEBASE_DIRECTORY);
+    m_SearchScheduler.setTablebases(&m_Tablebases);
+    m_OpeningBook.open(OPENING_BOOK_PATH);
+    m_SearchScheduler.setOpeningBook(&m_OpeningBook);
 }
 
 void ChessServer::responseHandler(int client, Data &inData, Data &outData) {
-    std::shared_ptr<ChessGame> game = m_ClientGames[client];
-    if (!game) {
-        PRINT_MSG("No game exists");
-        return;
-    }
-    if (inData.len < sizeof(unsigned char) + NUM_SQUARES + sizeof(unsigned char) + sizeof(NetworkMove)) {
-        PRINT_MSG("Did not receive entire command");
-    }
-    std::mutex &gameMutex = game->getMutex();
-    if (gameMutex.try_lock()) {
-        PRINT_MSG("In the lock block");
-        int i = 0;
-        std::array<unsigned char, MAX_BUFFER_SIZE> response;
-        std::copy(inData.buffer.begin(), inData.buffer.begin() + inData.len, response.begin());
-        if (response[i] == 0x55) {
-            PRINT_MSG("Received proper command");
-            i++;
-
-            // Check if we got the entire board, validate entire board
-            std::array<unsigned char, NUM_SQUARES> boardData;
-            std::copy(response.begin() + i, response.begin() + i + NUM_SQUARES, boardData.begin());
-            if (!game->validateBoard(boardData)) {
-                PRINT_MSG("Board received was invalid");
-                gameMutex.unlock();
-                return;
-            }
-            i += NUM_SQUARES;
-
-            // Check for the piece
-            unsigned char pieceKey = response[i];
-            std::shared_ptr<Piece> piece = game->getPiece(static_cast<unsigned char>(response[i]));
-            if (!piece) {
-                PRINT_MSG("Couldn't get piece");
-                gameMutex.unlock();
-                return;
+    if (inData.len > 0 && static_cast<unsigned char>(inData.buffer[0]) == ANALYSE) {
+        analysisHandler(client, inData, outData);
+        return;
+    }
+    if (inData.len > 0 && static_cast<unsigned char>(inData.buffer[0]) == SEEK) {
+        seekHandler(client, inData);
+        return;
+    }
+    if (inData.len > 0 && static_cast<unsigned char>(inData.buffer[0]) == SPECTATE) {
+        spectateHandler(client, inData);
+        return;
+    }
+    if (inData.len > 0 && static_cast<unsigned char>(inData.buffer[0]) == RESUME) {
+        resumeHandler(client, inData);
+        return;
+    }
+    if (inData.len > 0 && static_cast<unsigned char>(inData.buffer[0]) == HELLO) {
+        helloHandler(client, inData, outData);
+        return;
+    }
+    const uint32_t generation = m_Server.connectionGeneration(client);
+    std::shared_ptr<GameSession> session = playingSession(client, generation);
+    if (!session) {
+        LOG_WARN("No game exists");
+        return;
+    }
+    if (static_cast<unsigned char>(inData.buffer[0]) == RESYNC) {
+        // Asked for by a player whose position stopped matching the hashes it is sent
+        session->post([this, client, generation](GameSession &session) {
+            if (!session.finished() && session.isPlaying(client, generation)) {
+                m_Server.sendFrame(client, resyncFrame(session, session.colorOf(client)));
             }
-            i++;
-
-            // Check for the move
-            NetworkMove networkMove;
-            std::memcpy(&networkMove, &response[i], sizeof(NetworkMove));
-            Move move = game->decodeMove(networkMove);
-
-            // Process the game
-            game->processMove(piece, move);
-
-            PRINT_MSG("Processed the game!");
-
-            std::array<char, 2 + sizeof(NetworkMove) + 64 + 1> message;
-            message[0] = 0x55;
-            message[1] = pieceKey;
-            std::memcpy(&message[2], &networkMove, sizeof(NetworkMove));
-            std::memcpy(&message[2 + sizeof(NetworkMove)], game->serializeBoard().data(), 64);
-            message[2 + sizeof(NetworkMove) + 64] = game->getTurn();
-
-            // Copy data to out buffer of client, which server will send out
-            PRINT_MSG("Copying to out buffer of client");
-            std::copy(message.begin(), message.end(), outData.buffer.begin());
-            outData.len = message.size();
-            outData.pos = 0;
-
-            // Relay message to opponent
-            int opponent = m_ClientPairings[client];
-            PRINT_MSG("Sending to opponent");
-            if (m_ConnectedClients.find(opponent) != m_ConnectedClients.end()) {
-                m_Server.sendMessage(opponent, std::vector(message.begin(), message.end()));
+        });
+        return;
+    }
+    const size_t commandLen = static_cast<unsigned char>(inData.buffer[0]) == MOVE_V2
+                                  ? sizeof(unsigned char) + sizeof(CompactMove)
+                                  : sizeof(unsigned char) + NUM_SQUARES + sizeof(unsigned char) + sizeof(NetworkMove);
+    if (inData.len < commandLen) {
+        LOG_WARN("Did not receive entire command");
+        return;
+    }
+    // Applied in order on the game's own queue, whichever thread gets to drain it
+    std::vector<unsigned char> command(inData.buffer.begin(), inData.buffer.begin() + inData.len);
+    session->post([this, client, generation, command = std::move(command), received = std::chrono::steady_clock::now()](GameSession &session) {
+        applyMove(session, client, generation, command, received);
+    });
+}
+
+void ChessServer::applyMove(GameSession &session, int client, uint32_t generation, const std::vector<unsigned char> &response,
+                            std::chrono::steady_clock::time_point received) {
+    if (session.finished() || !session.isPlaying(client, generation)) {
+        return; // Sent just before its seat was taken over by a resumed connection
+    }
+    if (response[0] != MOVE && response[0] != MOVE_V2) {
+        return;
+    }
+    LOG_DEBUG("Received proper command");
+    ChessGame &game = session.game();
+    const auto validationStart = std::chrono::steady_clock::now();
+    if (session.colorOf(client) != game.getTurn()) {
+        LOG_WARN("Client {} moved out of turn", client);
+        Metrics::add(METRIC_MOVES_REJECTED);
+        return;
+    }
+    Action action;
+    if (!(response[0] == MOVE ? readMove(game, response, action) : readCompactMove(session, client, response, action))) {
+        Metrics::add(METRIC_MOVES_REJECTED);
+        return;
+    }
+
+    // The mover's clock is charged before the move counts, one arriving after the flag fell is lost
+    GameClock &clock = session.clock();
+    const PieceColor mover = game.getTurn();
+    const auto now = std::chrono::steady_clock::now();
+    const int64_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - clock.turnStarted).count();
+    if (clock.remainingMs[mover] <= elapsedMs) {
+        checkFlag(session, clock.moves);
+        return;
+    }
+    clock.remainingMs[mover] += GAME_CLOCK_INCREMENT_MS - elapsedMs;
+    clock.turnStarted = now;
+    clock.moves++;
+
+    // Process the game
+    const uint64_t hash = game.positionHash();
+    game.processMove(action.piece, action.move);
+    Metrics::record(HISTOGRAM_VALIDATION, std::chrono::steady_clock::now() - validationStart);
+    Metrics::add(METRIC_MOVES_VALIDATED);
+    armFlagTimer(session);
+
+    LOG_DEBUG("Processed the game!");
+
+    // Each format is built once, the first time someone is sent it, and shared by everyone sent it
+    SharedFrame frames[NUM_FRAME_FORMATS];
+    const auto frameFor = [&](FrameFormat format) -> const SharedFrame & {
+        if (!frames[format]) {
+            frames[format] = moveFrame(session, action, format, hash);
+        }
+        return frames[format];
+    };
+    m_Server.sendFrame(client, frameFor(session.format(mover)));
+
+    // Relay message to opponent, a disconnected one is simply not found
+    LOG_DEBUG("Sending to opponent");
+    const PieceColor opponent = mover == WHITE ? BLACK : WHITE;
+    if (session.player(opponent) >= 0) {
+        m_Server.sendFrame(session.player(opponent), frameFor(session.format(opponent)));
+    }
+    Metrics::record(HISTOGRAM_RECV_TO_RELAY, std::chrono::steady_clock::now() - received);
+
+    // Spectators get the frames the players did where they can, after the players
+    for (int format = 0; format < NUM_FRAME_FORMATS; format++) {
+        const std::vector<Recipient> &spectators = session.spectators(static_cast<FrameFormat>(format));
+        if (!spectators.empty()) {
+            m_Server.broadcastFrame(spectators, frameFor(static_cast<FrameFormat>(format)));
+        }
+    }
+
+    // Mate is checked first, a mated side has no moves left for the tablebase to look at
+    SharedFrame gameOver = game.isCheckmate() ? gameOverFrame(GAME_OVER_CHECKMATE, mover) : adjudicateEndgame(game);
+    if (gameOver) {
+        for (const PieceColor color : {WHITE, BLACK}) {
+            if (session.player(color) >= 0) {
+                m_Server.sendFrame(session.player(color), gameOver);
             }
+        }
+        endGame(session, std::move(gameOver));
+    }
+}
+
+// The client's whole board, which has to be ours, the key of the piece it moves and the NetworkMove
+bool ChessServer::readMove(ChessGame &game, const std::vector<unsigned char> &command, Action &action) {
+    size_t i = 1;
+    std::array<unsigned char, NUM_SQUARES> boardData;
+    std::copy(command.begin() + i, command.begin() + i + NUM_SQUARES, boardData.begin());
+    if (!game.validateBoard(boardData)) {
+        LOG_WARN("Board received was invalid");
+        return false;
+    }
+    i += NUM_SQUARES;
+
+    action.piece = game.getPiece(command[i]);
+    if (!action.piece) {
+        LOG_WARN("Couldn't get piece");
+        return false;
+    }
+    i++;
 
-            if (game->isCheckmate()) {
-                eraseClientAndOpponent(client);
+    NetworkMove networkMove;
+    std::memcpy(&networkMove, &command[i], sizeof(NetworkMove));
+    action.move = game.decodeMove(networkMove);
+    return true;
+}
+
+// Only the squares come with it, so it is looked up among the legal moves instead of being trusted. A
+// client whose hash is not ours has lost track of the game and is sent all of it
+bool ChessServer::readCompactMove(GameSession &session, int client, const std::vector<unsigned char> &command, Action &action) {
+    ChessGame &game = session.game();
+    CompactMove compact;
+    std::memcpy(&compact, &command[1], sizeof(CompactMove));
+    if (compact.gameId != session.id()) {
+        LOG_WARN("Move for game {} sent while playing game {}", compact.gameId, session.id());
+        return false;
+    }
+    if (command.size() >= sizeof(unsigned char) + sizeof(CompactMove) + sizeof(uint64_t)) {
+        uint64_t hash;
+        std::memcpy(&hash, &command[1 + sizeof(CompactMove)], sizeof(hash));
+        if (hash != game.positionHash()) {
+            LOG_WARN("Position hash received was invalid, resyncing client {}", client);
+            m_Server.sendFrame(client, resyncFrame(session, session.colorOf(client)));
+            return false;
+        }
+    }
+    if (!game.findMove(compact.move, action)) {
+        LOG_WARN("Move {} is not legal", compact.move);
+        return false;
+    }
+    return true;
+}
+
+// Called after the move was processed, with the hash of the position before it
+SharedFrame ChessServer::moveFrame(GameSession &session, const Action &action, FrameFormat format, uint64_t hash) {
+    ChessGame &game = session.game();
+    if (format == FRAME_FORMAT_V1) {
+        const NetworkMove networkMove = ChessGame::encodeNetworkMove(action.move);
+        std::array<char, 2 + sizeof(NetworkMove) + 64 + 1> message;
+        message[0] = MOVE;
+        message[1] = action.piece->getPieceKey();
+        std::memcpy(&message[2], &networkMove, sizeof(NetworkMove));
+        std::memcpy(&message[2 + sizeof(NetworkMove)], game.serializeBoard().data(), 64);
+        message[2 + sizeof(NetworkMove) + 64] = game.getTurn();
+        return Server::makeFrame(message.data(), message.size());
+    }
+
+    const Move &move = action.move;
+    const CompactMove compact{session.id(), encodeMove(posToIndex(move.src), posToIndex(move.dst), move.promoteType)};
+    std::array<char, 1 + sizeof(CompactMove) + sizeof(uint64_t)> message;
+    message[0] = MOVE_V2;
+    std::memcpy(&message[1], &compact, sizeof(CompactMove));
+    std::memcpy(&message[1 + sizeof(CompactMove)], &hash, sizeof(hash));
+    return Server::makeFrame(message.data(), message.size() - (format == FRAME_FORMAT_V2_HASHED ? 0 : sizeof(hash)));
+}
+
+void ChessServer::acceptHandler(int client) {
+    LOG_DEBUG("Connection received in accept handler from: {}", client);
+    // Older clients say nothing before they are paired, so anyone who has not asked for something else
+    // by the end of the window is offered a game, rated like everyone else until it says otherwise
+    const MatchTicket ticket{client, m_Server.connectionGeneration(client)};
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        m_Arriving[client] = ticket.generation;
+    }
+    m_Server.armTimer(MATCH_INTENT_WINDOW_MS, [this, ticket] {
+        if (claimArriving(ticket) && m_Server.connectionGeneration(ticket.fd) == ticket.generation) {
+            offerTicket(ticket);
+        }
+    });
+}
+
+bool ChessServer::claimArriving(const MatchTicket &ticket) {
+    std::scoped_lock lock(m_MatchingMutex);
+    auto arrivingIt = m_Arriving.find(ticket.fd);
+    if (arrivingIt == m_Arriving.end() || arrivingIt->second != ticket.generation) {
+        return false;
+    }
+    m_Arriving.erase(arrivingIt);
+    return true;
+}
+
+void ChessServer::offerTicket(const MatchTicket &ticket) {
+    std::vector<MatchPair> pairs;
+    m_Matchmaker.offer(ticket, MatchClock::now(), pairs);
+    const bool paired = std::any_of(pairs.begin(), pairs.end(), [&ticket](const MatchPair &pair) {
+        return pair.white.fd == ticket.fd || pair.black.fd == ticket.fd;
+    });
+    if (!paired) {
+        // Counted from this offer, one made earlier for the same fd with another rating or by an earlier
+        // connection no longer applies
+        uint64_t wait = 0;
+        {
+            std::scoped_lock lock(m_MatchingMutex);
+            wait = m_NextWait++;
+        }
+        const TimerHandle timeout = m_Server.armTimer(MATCH_WAIT_TIMEOUT_MS, [this, ticket, wait] {
+            expireTicket(ticket, wait);
+        });
+        TimerHandle replaced;
+        {
+            std::scoped_lock lock(m_MatchingMutex);
+            Waiting &waiting = m_Waiting[ticket.fd];
+            replaced = waiting.timeout;
+            waiting = {wait, timeout};
+        }
+        m_Server.cancelTimer(replaced);
+    }
+    startGames(pairs);
+    scheduleRematch();
+}
+
+// Windows wide enough for anyone by now, so nobody else is waiting. The client decides again what it
+// is here for, as in its intent window, and a SEEK puts it back in the queue
+void ChessServer::expireTicket(const MatchTicket &ticket, uint64_t wait) {
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        auto waitingIt = m_Waiting.find(ticket.fd);
+        if (waitingIt == m_Waiting.end() || waitingIt->second.wait != wait) {
+            return; // Replaced, its timer fired before the cancel reached it
+        }
+        m_Waiting.erase(waitingIt);
+    }
+    if (!m_Matchmaker.cancel(ticket)) {
+        return; // Paired meanwhile
+    }
+    if (m_Server.connectionGeneration(ticket.fd) != ticket.generation) {
+        return; // Left while waiting, it is only dropped from the queue
+    }
+    LOG_INFO("Client {} found no opponent within {} ms", ticket.fd, MATCH_WAIT_TIMEOUT_MS);
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        m_Arriving[ticket.fd] = ticket.generation;
+    }
+    m_Server.sendFrame(Recipient{ticket.fd, ticket.generation}, gameEndedFrame(GAME_OVER_NO_OPPONENT));
+}
+
+void ChessServer::seekHandler(int client, Data &inData) {
+    SeekRequest request;
+    if (inData.len < sizeof(unsigned char) + sizeof(SeekRequest)) {
+        LOG_WARN("Did not receive entire seek request");
+        return;
+    }
+    std::memcpy(&request, &inData.buffer[1], sizeof(SeekRequest));
+    const MatchTicket ticket{client, m_Server.connectionGeneration(client), request.rating};
+    // Only a client still waiting can change its rating, one that was just paired keeps its game
+    if (!claimArriving(ticket) && !m_Matchmaker.cancel(ticket)) {
+        return;
+    }
+    offerTicket(ticket);
+}
+
+void ChessServer::helloHandler(int client, Data &inData, Data &outData) {
+    outData.len = 0;
+    outData.pos = 0;
+    Hello request;
+    if (inData.len < sizeof(unsigned char) + sizeof(Hello)) {
+        LOG_WARN("Did not receive entire hello");
+        return;
+    }
+    std::memcpy(&request, &inData.buffer[1], sizeof(Hello));
+    Hello answer;
+    answer.version = std::clamp<uint8_t>(request.version, 1, PROTOCOL_VERSION);
+    answer.flags = answer.version >= 2 ? request.flags & PROTOCOL_FLAG_HASHES : 0;
+    const FrameFormat format = answer.version < 2                        ? FRAME_FORMAT_V1
+                               : (answer.flags & PROTOCOL_FLAG_HASHES) ? FRAME_FORMAT_V2_HASHED
+                                                                       : FRAME_FORMAT_V2;
+
+    // Usually said before the client is paired, a game it is already in switches from its next move on
+    const uint32_t generation = m_Server.connectionGeneration(client);
+    std::shared_ptr<GameSession> session;
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        m_Protocols[client] = {generation, format};
+        if (Playing *playing = findPlaying(client, generation)) {
+            session = playing->session;
+        }
+    }
+    if (session) {
+        session->post([client, generation, format](GameSession &session) {
+            if (session.isPlaying(client, generation)) {
+                session.setFormat(session.colorOf(client), format);
             }
+        });
+    }
+    LOG_DEBUG("Client {} speaks version {} with flags {}", client, answer.version, answer.flags);
+
+    outData.buffer[0] = static_cast<char>(HELLO);
+    std::memcpy(&outData.buffer[1], &answer, sizeof(Hello));
+    outData.len = sizeof(unsigned char) + sizeof(Hello);
+}
+
+FrameFormat ChessServer::formatOf(int client, uint32_t generation) {
+    auto protocolIt = m_Protocols.find(client);
+    if (protocolIt == m_Protocols.end() || protocolIt->second.generation != generation) {
+        return FRAME_FORMAT_V1;
+    }
+    return protocolIt->second.format;
+}
+
+void ChessServer::spectateHandler(int client, Data &inData) {
+    SpectateRequest request;
+    if (inData.len < sizeof(unsigned char) + sizeof(SpectateRequest)) {
+        LOG_WARN("Did not receive entire spectate request");
+        return;
+    }
+    std::memcpy(&request, &inData.buffer[1], sizeof(SpectateRequest));
+    const Recipient spectator{client, m_Server.connectionGeneration(client)};
+    if (!claimArriving({client, spectator.generation})) {
+        m_Matchmaker.cancel({client, spectator.generation});
+    }
+    stopSpectating(client);
 
-            gameMutex.unlock();
+    std::shared_ptr<GameSession> session;
+    FrameFormat format = FRAME_FORMAT_V1;
+    {
+        // Registered under the same lock endGame takes, so a game found here has its end reach this spectator
+        std::scoped_lock lock(m_MatchingMutex);
+        if (findPlaying(client, spectator.generation)) {
+            LOG_WARN("Client {} is playing and cannot spectate", client);
             return;
         }
-    } else {
+        format = formatOf(client, spectator.generation);
+        auto gameIt = m_Games.find(request.gameId);
+        if (request.gameId == 0 && !m_Games.empty()) {
+            gameIt = std::max_element(m_Games.begin(), m_Games.end(), [](const auto &a, const auto &b) {
+                return a.first < b.first;
+            });
+        }
+        if (gameIt != m_Games.end()) {
+            session = gameIt->second;
+            m_Spectators[client] = {session, spectator.generation};
+        }
+    }
+    if (!session) {
+        m_Server.sendFrame(client, gameEndedFrame());
         return;
     }
+    LOG_DEBUG("Client {} is spectating game {}", client, session->id());
+    session->post([this, spectator, format](GameSession &session) {
+        if (session.finished()) {
+            // Ended before this ran, so endGame did not know of it yet
+            {
+                std::scoped_lock lock(m_MatchingMutex);
+                auto spectatingIt = m_Spectators.find(spectator.fd);
+                if (spectatingIt != m_Spectators.end() && spectatingIt->second.generation == spectator.generation) {
+                    m_Spectators.erase(spectatingIt);
+                }
+            }
+            m_Server.broadcastFrame({spectator}, gameEndedFrame(), true);
+            return;
+        }
+        session.addSpectator(spectator, format);
+        // Through the same per worker queue as the moves, so none is sent before the snapshot or twice
+        m_Server.broadcastFrame({spectator}, snapshotFrame(session), true);
+    });
 }
 
-void ChessServer::acceptHandler(int client) {
-    PRINT_MSG("Connection received in accept handler from: " << client);
-    m_ConnectedClients.insert(client);
+void ChessServer::resyncHandler(int client) {
+    std::shared_ptr<GameSession> session;
+    Recipient spectator{client, 0};
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        auto spectatingIt = m_Spectators.find(client);
+        if (spectatingIt == m_Spectators.end()) {
+            return;
+        }
+        session = spectatingIt->second.session;
+        spectator.generation = spectatingIt->second.generation;
+    }
+    LOG_DEBUG("Resyncing spectator {} of game {}", client, session->id());
+    session->post([this, spectator](GameSession &session) {
+        // Everything it missed is in the snapshot, the moves after it are sent as usual
+        if (!session.finished()) {
+            m_Server.broadcastFrame({spectator}, snapshotFrame(session), true);
+        }
+    });
+}
 
-    if (m_ClientsWaitingForMatch.empty()) {
-        // Just adding this opponent to the waiting list, no need to lock
-        m_ClientsWaitingForMatch.insert(client);
-    } else {
+void ChessServer::stopSpectating(int client, uint32_t generation) {
+    Spectating spectating;
+    {
         std::scoped_lock lock(m_MatchingMutex);
-        // Need to lock as we read and match the opponent and pop it from the list
-        int opponent = *m_ClientsWaitingForMatch.rbegin();
+        auto spectatingIt = m_Spectators.find(client);
+        if (spectatingIt == m_Spectators.end() || (generation != 0 && spectatingIt->second.generation != generation)) {
+            return;
+        }
+        spectating = std::move(spectatingIt->second);
+        m_Spectators.erase(spectatingIt);
+    }
+    spectating.session->post([spectator = Recipient{client, spectating.generation}](GameSession &session) {
+        session.removeSpectator(spectator);
+    });
+}
+
+void ChessServer::resumeHandler(int client, Data &inData) {
+    ResumeRequest request;
+    if (inData.len < sizeof(unsigned char) + sizeof(ResumeRequest)) {
+        LOG_WARN("Did not receive entire resume request");
+        return;
+    }
+    std::memcpy(&request, &inData.buffer[1], sizeof(ResumeRequest));
+    const uint32_t generation = m_Server.connectionGeneration(client);
+    if (!claimArriving({client, generation})) {
+        m_Matchmaker.cancel({client, generation});
+    }
+    stopSpectating(client);
 
-        m_ClientsWaitingForMatch.erase(opponent);
+    std::shared_ptr<GameSession> session;
+    PieceColor color = WHITE;
+    FrameFormat format = FRAME_FORMAT_V1;
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        format = formatOf(client, generation);
+        auto seatIt = m_Seats.find(request.token);
+        if (seatIt != m_Seats.end() && !findPlaying(client, generation)) {
+            session = seatIt->second.session;
+            color = seatIt->second.color;
+        }
+    }
+    if (!session) {
+        // Also when this connection is playing already, a client is always answered
+        LOG_INFO("Client {} tried to resume an unknown or finished game", client);
+        m_Server.sendFrame(client, gameEndedFrame());
+        return;
+    }
+    session->post([this, color, client, generation, format](GameSession &session) {
+        resumeSeat(session, color, client, generation, format);
+    });
+}
 
-        m_ClientPairings.emplace(client, opponent);
-        m_ClientPairings.emplace(opponent, client);
+void ChessServer::resumeSeat(GameSession &session, PieceColor color, int client, uint32_t generation, FrameFormat format) {
+    if (session.finished()) {
+        m_Server.sendFrame(client, gameEndedFrame());
+        return;
+    }
+    // The seat may still be held by a connection that is dead but not noticed yet, the new one takes over.
+    // It may even have had the same fd, which was closed and handed to this connection since
+    const int previous = session.player(color);
+    {
+        // Checked under the lock, so a client leaving after this finds the game when it disconnects
+        std::scoped_lock lock(m_MatchingMutex);
+        if (m_Server.connectionGeneration(client) != generation) {
+            return;
+        }
+        if (findPlaying(client, generation)) {
+            m_Server.sendFrame(client, gameEndedFrame()); // Seated in another game since it asked
+            return;
+        }
+        if (Playing *playing = findPlaying(previous, session.generation(color)); playing && playing->session.get() == &session) {
+            m_ClientGames.erase(previous);
+        }
+        m_ClientGames.insert_or_assign(client, Playing{session.shared_from_this(), generation});
+        // Seated before the lock is let go, so the previous connection is never without an entry and still seated
+        session.seat(color, client, generation);
+    }
+    session.setFormat(color, format);
+    LOG_INFO("Client {} resumed game {} in place of {}", client, session.id(), previous);
 
-        std::shared_ptr<ChessGame> newGame = std::make_shared<ChessGame>();
+    const int opponent = session.opponent(client);
+    if (opponent >= 0) {
+        m_Server.colocate(client, opponent);
+    }
+    m_Server.sendFrame(client, resyncFrame(session, color));
+}
 
-        m_ClientGames.emplace(client, newGame);
-        m_ClientGames.emplace(opponent, newGame);
+void ChessServer::leaveGame(GameSession &session, int client, uint32_t generation) {
+    if (session.finished() || !session.isPlaying(client, generation)) {
+        return; // Its seat was taken over already, maybe by a new connection on the same fd
+    }
+    const PieceColor color = session.colorOf(client);
+    session.seat(color, -1, 0);
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        if (Playing *playing = findPlaying(client, generation); playing && playing->session.get() == &session) {
+            m_ClientGames.erase(client);
+        }
+    }
+    LOG_INFO("Client {} left game {}, its seat is kept for {} ms", client, session.id(), RECONNECT_GRACE_MS);
 
-        std::vector<char> opponentMessage;
-        opponentMessage.push_back(WHITE);
-        m_Server.sendMessage(opponent, opponentMessage);
+    std::weak_ptr<GameSession> weakSession = session.weak_from_this();
+    const uint32_t seating = session.seating(color);
+    m_Server.armTimer(RECONNECT_GRACE_MS, [this, weakSession, color, seating] {
+        if (std::shared_ptr<GameSession> session = weakSession.lock()) {
+            session->post([this, color, seating](GameSession &session) {
+                abandonGame(session, color, seating);
+            });
+        }
+    });
+}
 
-        std::vector<char> clientMessage;
-        clientMessage.push_back(BLACK);
-        m_Server.sendMessage(client, clientMessage);
+void ChessServer::abandonGame(GameSession &session, PieceColor color, uint32_t seating) {
+    if (session.finished() || session.seating(color) != seating) {
+        return; // Came back in time
     }
+    LOG_INFO("Game {} abandoned by {}", session.id(), (color == WHITE ? "white" : "black"));
+    const PieceColor winner = color == WHITE ? BLACK : WHITE;
+    SharedFrame frame = gameOverFrame(GAME_OVER_ABANDONED, winner);
+    m_Server.sendFrame(session.player(winner), frame);
+    endGame(session, std::move(frame));
 }
 
-void ChessServer::disconnectHandler(int client) {
-    PRINT_MSG("Disconnected!");
-    eraseClientAndOpponent(client);
+void ChessServer::scheduleRematch() {
+    // Clients left waiting get paired as their windows widen, even when nobody else arrives
+    if (m_Matchmaker.waiting() == 0 || m_RematchArmed.exchange(true)) {
+        return;
+    }
+    m_Server.armTimer(MATCH_REMATCH_INTERVAL_MS, [this] {
+        m_RematchArmed = false;
+        std::vector<MatchPair> pairs;
+        m_Matchmaker.rematch(MatchClock::now(), pairs);
+        startGames(pairs);
+        scheduleRematch();
+    });
 }
 
-void ChessServer::eraseClientAndOpponent(int client) {
-    if (m_EraseMutex.try_lock()) {
-        // This client has not been matched yet
-        if (m_ClientPairings.find(client) == m_ClientPairings.end()) {
-            if (m_ConnectedClients.find(client) != m_ConnectedClients.end()) {
-                PRINT_MSG("Erasing client from connected clients!");
-                m_ConnectedClients.erase(client);
-            }
-            if (m_ClientsWaitingForMatch.find(client) != m_ClientsWaitingForMatch.end()) {
-                PRINT_MSG("Erasing client from waiting from matches!");
-                m_ClientsWaitingForMatch.erase(client);
-            }
-        } else {
-            // Erasing a client that has been amtched
-            int opponent = m_ClientPairings[client];
-            if (m_ConnectedClients.find(client) != m_ConnectedClients.end()) {
-                PRINT_MSG("Erasing client from connected clients!");
-                m_ConnectedClients.erase(client);
-            }
-            if (m_ConnectedClients.find(opponent) != m_ConnectedClients.end()) {
-                PRINT_MSG("Erasing opponent from connected clients!");
-                m_ConnectedClients.erase(opponent);
+void ChessServer::startGames(std::vector<MatchPair> &pairs) {
+    // A player that left meanwhile puts its opponent back in the queue, which may pair it again
+    for (size_t i = 0; i < pairs.size(); i++) {
+        const MatchPair pair = pairs[i];
+        if (startGame(pair.white, pair.black)) {
+            continue;
+        }
+        for (const MatchTicket &ticket : {pair.white, pair.black}) {
+            if (m_Server.connectionGeneration(ticket.fd) == ticket.generation) {
+                m_Matchmaker.offer(ticket, MatchClock::now(), pairs);
+            } else {
+                LOG_DEBUG("Matched client {} had already left", ticket.fd);
             }
-            if (m_ClientPairings.count(client)) {
-                PRINT_MSG("Erasing pairings: " << client << " " << opponent);
-                m_ClientPairings.erase(client);
-                m_ClientGames.erase(client);
+        }
+    }
+}
+
+bool ChessServer::startGame(const MatchTicket &white, const MatchTicket &black) {
+    std::shared_ptr<GameSession> newGame;
+    {
+        // Checked under the lock, so a player leaving after this finds the game when it disconnects
+        std::scoped_lock lock(m_MatchingMutex);
+        if (m_Server.connectionGeneration(white.fd) != white.generation ||
+            m_Server.connectionGeneration(black.fd) != black.generation) {
+            return false;
+        }
+        newGame = std::make_shared<GameSession>(m_NextGameId++, Recipient{white.fd, white.generation}, Recipient{black.fd, black.generation},
+                                                m_TokenRandom(), m_TokenRandom());
+        // Nothing else can reach the session yet
+        newGame->setFormat(WHITE, formatOf(white.fd, white.generation));
+        newGame->setFormat(BLACK, formatOf(black.fd, black.generation));
+
+        // Over whatever an earlier connection on the same fd left, its own leaveGame will not touch these
+        m_ClientGames.insert_or_assign(black.fd, Playing{newGame, black.generation});
+        m_ClientGames.insert_or_assign(white.fd, Playing{newGame, white.generation});
+        m_Games.emplace(newGame->id(), newGame);
+        m_Seats.emplace(newGame->token(WHITE), Seat{newGame, WHITE});
+        m_Seats.emplace(newGame->token(BLACK), Seat{newGame, BLACK});
+        Metrics::add(METRIC_GAMES_STARTED);
+        newGame->post([this](GameSession &session) {
+            session.clock().turnStarted = std::chrono::steady_clock::now();
+            armFlagTimer(session);
+        });
+    }
+    LOG_INFO("Matched {} rated {} with {} rated {}", white.fd, white.rating, black.fd, black.rating);
+
+    // Handle the whole game on the worker of whoever waited longer
+    m_Server.colocate(black.fd, white.fd);
+
+    std::vector<char> whiteMessage;
+    whiteMessage.push_back(WHITE);
+    m_Server.sendMessage(white.fd, whiteMessage);
+
+    std::vector<char> blackMessage;
+    blackMessage.push_back(BLACK);
+    m_Server.sendMessage(black.fd, blackMessage);
+
+    // Older clients ignore it, they cannot come back after a disconnect anyway
+    for (const PieceColor color : {WHITE, BLACK}) {
+        const SessionToken session{newGame->token(color), newGame->id()};
+        std::vector<char> message(sizeof(unsigned char) + sizeof(SessionToken));
+        message[0] = SESSION;
+        std::memcpy(&message[1], &session, sizeof(SessionToken));
+        m_Server.sendMessage(newGame->player(color), message);
+    }
+    return true;
+}
+
+// The fd is closed already and may belong to a new connection by now, only what generation had is undone
+void ChessServer::disconnectHandler(int client, uint32_t generation) {
+    LOG_DEBUG("Disconnected!");
+    m_Analysis.cancelClient({client, generation});
+    stopSpectating(client, generation);
+    std::shared_ptr<GameSession> session;
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        if (Playing *playing = findPlaying(client, generation)) {
+            session = playing->session;
+        }
+        auto protocolIt = m_Protocols.find(client);
+        if (protocolIt != m_Protocols.end() && protocolIt->second.generation == generation) {
+            m_Protocols.erase(protocolIt);
+        }
+        auto arrivingIt = m_Arriving.find(client);
+        if (arrivingIt != m_Arriving.end() && arrivingIt->second == generation) {
+            m_Arriving.erase(arrivingIt); // Also one put back by a wait that ran out, which no timer claims
+        }
+    }
+    if (!session) {
+        return; // Still waiting for a match, the matchmaker drops it when it is next paired
+    }
+    // Queued behind the moves that arrived before it. The game goes on without the player for a while
+    session->post([this, client, generation](GameSession &session) {
+        leaveGame(session, client, generation);
+    });
+}
+
+Playing *ChessServer::findPlaying(int client, uint32_t generation) {
+    auto gameIt = m_ClientGames.find(client);
+    return gameIt != m_ClientGames.end() && gameIt->second.generation == generation ? &gameIt->second : nullptr;
+}
+
+std::shared_ptr<GameSession> ChessServer::playingSession(int client, uint32_t generation) {
+    struct CachedGame {
+        std::weak_ptr<GameSession> session;
+        uint32_t generation;
+    };
+    // Per worker, so the moves of a game in progress are routed without m_MatchingMutex. An entry goes
+    // stale when its fd is reopened, its game finishes or its seat is taken over, and every one of
+    // those is seen here before the global map would be asked
+    static thread_local std::unordered_map<int, CachedGame> cache;
+    auto cachedIt = cache.find(client);
+    if (cachedIt != cache.end() && cachedIt->second.generation == generation) {
+        std::shared_ptr<GameSession> session = cachedIt->second.session.lock();
+        if (session && !session->finished() && session->isPlaying(client, generation)) {
+            return session;
+        }
+    }
+
+    std::shared_ptr<GameSession> session;
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        if (Playing *playing = findPlaying(client, generation)) {
+            session = playing->session;
+        }
+    }
+    if (session) {
+        cache[client] = CachedGame{session, generation};
+    } else if (cachedIt != cache.end()) {
+        cache.erase(cachedIt);
+    }
+    return session;
+}
+
+void ChessServer::endGame(GameSession &session, SharedFrame spectatorFrame) {
+    if (session.finished()) {
+        return;
+    }
+    session.finish();
+    Metrics::add(METRIC_GAMES_ENDED);
+    m_Server.cancelTimer(session.clock().flagTimer);
+    m_FairPlay.submitGame(session.id(), session.game().getMoveHistory());
+    {
+        std::scoped_lock lock(m_MatchingMutex);
+        for (const PieceColor color : {WHITE, BLACK}) {
+            if (Playing *playing = findPlaying(session.player(color), session.generation(color)); playing && playing->session.get() == &session) {
+                m_ClientGames.erase(session.player(color));
             }
-            if (m_ClientPairings.count(opponent)) {
-                PRINT_MSG("Erasing pairings: " << opponent << " " << client);
-                m_ClientPairings.erase(opponent);
-                m_ClientGames.erase(opponent);
+            m_Seats.erase(session.token(color));
+        }
+        m_Games.erase(session.id());
+        for (int format = 0; format < NUM_FRAME_FORMATS; format++) {
+            for (const Recipient &spectator : session.spectators(static_cast<FrameFormat>(format))) {
+                auto spectatingIt = m_Spectators.find(spectator.fd);
+                if (spectatingIt != m_Spectators.end() && spectatingIt->second.generation == spectator.generation) {
+                    m_Spectators.erase(spectatingIt);
+                }
             }
         }
-        m_EraseMutex.unlock();
     }
+    // A resync, so lagging spectators learn of the end as well. The frame is the same in every format
+    if (!spectatorFrame) {
+        spectatorFrame = gameEndedFrame();
+    }
+    for (int format = 0; format < NUM_FRAME_FORMATS; format++) {
+        const std::vector<Recipient> &spectators = session.spectators(static_cast<FrameFormat>(format));
+        if (!spectators.empty()) {
+            m_Server.broadcastFrame(spectators, spectatorFrame, true);
+        }
+    }
+    session.clearSpectators();
+}
+
+void ChessServer::armFlagTimer(GameSession &session) {
+    GameClock &clock = session.clock();
+    m_Server.cancelTimer(clock.flagTimer);
+    const int64_t elapsedMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - clock.turnStarted).count();
+    const int64_t remainingMs = clock.remainingMs[session.game().getTurn()] - elapsedMs;
+    std::weak_ptr<GameSession> weakSession = session.weak_from_this();
+    const uint32_t moves = clock.moves;
+    clock.flagTimer = m_Server.armTimer(static_cast<uint32_t>(std::max<int64_t>(remainingMs, TIMER_TICK_MS)), [this, weakSession, moves] {
+        // Queued like everything else, a move that is already on its way is applied first
+        if (std::shared_ptr<GameSession> session = weakSession.lock()) {
+            session->post([this, moves](GameSession &session) {
+                checkFlag(session, moves);
+            });
+        }
+    });
+}
+
+void ChessServer::checkFlag(GameSession &session, uint32_t moves) {
+    GameClock &clock = session.clock();
+    if (session.finished() || clock.moves != moves) {
+        return;
+    }
+    const PieceColor loser = session.game().getTurn();
+    const int64_t elapsedMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - clock.turnStarted).count();
+    if (elapsedMs < clock.remainingMs[loser]) {
+        armFlagTimer(session); // Woken up a tick early
+        return;
+    }
+    LOG_INFO("Flag fell for {}", session.player(loser));
+    clock.remainingMs[loser] = 0;
+    SharedFrame frame = gameOverFrame(GAME_OVER_FLAG, loser == WHITE ? BLACK : WHITE);
+    m_Server.sendFrame(session.player(WHITE), frame);
+    m_Server.sendFrame(session.player(BLACK), frame);
+    endGame(session, std::move(frame));
+}
+
+void ChessServer::analysisHandler(int client, Data &inData, Data &outData) {
+    // Results usually arrive later through sendMessage, so nothing goes out for this read yet
+    outData.len = 0;
+    outData.pos = 0;
+
+    AnalysisRequest request;
+    if (inData.len < sizeof(unsigned char) + sizeof(AnalysisRequest)) {
+        LOG_WARN("Did not receive entire analysis request");
+        return;
+    }
+    std::memcpy(&request, &inData.buffer[1], sizeof(AnalysisRequest));
+    const size_t positionStart = sizeof(unsigned char) + sizeof(AnalysisRequest);
+    if (inData.len < positionStart + request.length) {
+        LOG_WARN("Did not receive entire analysis position");
+        return;
+    }
+    std::string position(inData.buffer.data() + positionStart, request.length);
+
+    // Connections used for analysis are not looking for a game
+    const MatchTicket ticket{client, m_Server.connectionGeneration(client)};
+    if (!claimArriving(ticket)) {
+        m_Matchmaker.cancel(ticket);
+    }
+
+    std::vector<char> message;
+    EngineBoard board;
+    SearchResult result;
+    if (!AnalysisService::parsePosition(position, request.isFen, board)) {
+        LOG_WARN("Invalid analysis position: {}", position);
+        message = analysisMessage(request.requestId, ANALYSIS_INVALID_POSITION, result);
+    } else if (m_Analysis.analyse({client, ticket.generation}, request.requestId, board, request.depth, request.timeMs,
+                                  result)) {
+        message = analysisMessage(request.requestId, ANALYSIS_CACHED, result);
+    } else {
+        return;
+    }
+    std::copy(message.begin(), message.end(), outData.buffer.begin());
+    outData.len = message.size();
+}
+
+std::vector<char> ChessServer::analysisMessage(uint32_t requestId, AnalysisStatus status, const SearchResult &result) {
+    AnalysisResponse response;
+    response.requestId = requestId;
+    response.status = status;
+    response.bestMove = result.bestMove;
+    response.score = static_cast<int16_t>(result.score);
+    response.depth = static_cast<uint8_t>(result.depth);
+    response.nodes = result.nodes;
+
+    std::vector<char> message(sizeof(unsigned char) + sizeof(AnalysisResponse));
+    message[0] = ANALYSIS_RESULT;
+    std::memcpy(&message[1], &response, sizeof(AnalysisResponse));
+    return message;
+}
+
+SharedFrame ChessServer::snapshotFrame(GameSession &session) {
+    ChessGame &game = session.game();
+    const std::vector<EncodedMove> moves = game.getMoveHistory();
+    GameSnapshot snapshot;
+    snapshot.gameId = session.id();
+    snapshot.remainingMs[WHITE] = static_cast<int32_t>(session.clock().remainingMs[WHITE]);
+    snapshot.remainingMs[BLACK] = static_cast<int32_t>(session.clock().remainingMs[BLACK]);
+    snapshot.totalMoves = static_cast<uint16_t>(moves.size());
+    snapshot.numMoves = static_cast<uint16_t>(std::min<size_t>(moves.size(), SNAPSHOT_MAX_MOVES));
+
+    std::vector<char> message(sizeof(unsigned char) + sizeof(GameSnapshot) + NUM_SQUARES + sizeof(unsigned char) +
+                              snapshot.numMoves * sizeof(EncodedMove));
+    size_t i = 0;
+    message[i++] = SNAPSHOT;
+    std::memcpy(&message[i], &snapshot, sizeof(GameSnapshot));
+    i += sizeof(GameSnapshot);
+    std::memcpy(&message[i], game.serializeBoard().data(), NUM_SQUARES);
+    i += NUM_SQUARES;
+    message[i++] = game.getTurn();
+    std::memcpy(&message[i], moves.data() + moves.size() - snapshot.numMoves, snapshot.numMoves * sizeof(EncodedMove));
+    return Server::makeFrame(message.data(), message.size());
+}
+
+SharedFrame ChessServer::resyncFrame(GameSession &session, PieceColor color) {
+    ChessGame &game = session.game();
+    const std::vector<EncodedMove> moves = game.getMoveHistory();
+    ResyncHeader header;
+    header.gameId = session.id();
+    header.color = color;
+    header.remainingMs[WHITE] = static_cast<int32_t>(session.clock().remainingMs[WHITE]);
+    header.remainingMs[BLACK] = static_cast<int32_t>(session.clock().remainingMs[BLACK]);
+    header.positionHash = game.positionHash();
+    header.totalMoves = static_cast<uint16_t>(moves.size());
+    header.numMoves = static_cast<uint16_t>(std::min<size_t>(moves.size(), RESYNC_MAX_MOVES));
+
+    std::vector<char> message(sizeof(unsigned char) + sizeof(ResyncHeader) + header.numMoves * sizeof(EncodedMove));
+    message[0] = RESYNC;
+    std::memcpy(&message[1], &header, sizeof(ResyncHeader));
+    std::memcpy(&message[1 + sizeof(ResyncHeader)], moves.data() + moves.size() - header.numMoves, header.numMoves * sizeof(EncodedMove));
+    return Server::makeFrame(message.data(), message.size());
+}
+
+SharedFrame ChessServer::gameEndedFrame(GameOverReason reason) {
+    const char message[] = {static_cast<char>(GAME_OVER), static_cast<char>(reason)};
+    return Server::makeFrame(message, sizeof(message));
+}
+
+SharedFrame ChessServer::gameOverFrame(GameOverReason reason, PieceColor winner) {
+    const char message[] = {static_cast<char>(GAME_OVER), static_cast<char>(reason), static_cast<char>(winner)};
+    return Server::makeFrame(message, sizeof(message));
+}
+
+SharedFrame ChessServer::adjudicateEndgame(ChessGame &game) {
+    std::array<unsigned char, NUM_SQUARES> serializedBoard = game.serializeBoard();
+    if (NUM_SQUARES - std::count(serializedBoard.begin(), serializedBoard.end(), 0) > m_Tablebases.maxPieces()) {
+        return nullptr;
+    }
+
+    // Castling and en passant no longer matter with this little material left
+    EngineBoard board;
+    board.clear();
+    for (int i = 0; i < NUM_SQUARES; i++) {
+        std::shared_ptr<Piece> piece = serializedBoard[i] ? game.getPiece(serializedBoard[i]) : nullptr;
+        if (piece) {
+            board.setPiece(i, makeEnginePiece(piece->getType(), piece->getColor()));
+        }
+    }
+    board.setSideToMove(game.getTurn());
+
+    TablebaseResult result;
+    if (!m_Tablebases.probe(board, result)) {
+        return nullptr;
+    }
+    if (result.wdl == 0) {
+        LOG_INFO("Adjudicated a tablebase draw");
+        const char message[] = {static_cast<char>(GAME_OVER), static_cast<char>(GAME_OVER_TABLEBASE_DRAW)};
+        return Server::makeFrame(message, sizeof(message));
+    }
+    LOG_INFO("Adjudicated a tablebase {} for the side to move, mate in {} plies", (result.wdl > 0 ? "win" : "loss"), result.dtm);
+    const PieceColor sideToMove = game.getTurn();
+    return gameOverFrame(GAME_OVER_TABLEBASE_WIN, result.wdl > 0 ? sideToMove : (sideToMove == WHITE ? BLACK : WHITE));
 }
 
 void ChessServer::run() {
@@ -1,21 +1,138 @@
 #ifdef CHESS_SERVER_BUILD
 #include "../chess.h"
 #include "../chess_game.h"
+#include "analysis-service.h"
+#include "fair-play.h"
+#include "game-session.h"
+#include "matchmaker.h"
+#include "metrics.h"
+#include "opening-book.h"
+#include "search-scheduler.h"
 #include "server.h"
+#include "tablebase.h"
+#include <random>
+
+#define TABLEBASE_DIRECTORY "tablebases"
+#define OPENING_BOOK_PATH "res/book.bin" // Built by `make book`, the server runs without one
+#define MATCH_INTENT_WINDOW_MS 20 // A new connection has this long to ask to spectate or analyse before it is offered a game
+#define RECONNECT_GRACE_MS 30000  // How long a player's seat is kept after it disconnects, its clock keeps running
+#define MATCH_WAIT_TIMEOUT_MS 60000 // A client nobody was paired with by then is taken out of the queue and told so
+#define PROTOCOL_VERSION 2        // The newest this server speaks, clients that never send HELLO speak 1
+#define PROTOCOL_FLAG_HASHES 0x01 // Version 2 relays carry the position hash
 
 namespace chess_online {
 
 enum Command : unsigned char {
-    MOVE
+    MOVE = 0x55,
+    ANALYSE = 0x41,
+    ANALYSIS_RESULT = 0x42,
+    GAME_OVER = 0x47, // Followed by a GameOverReason and the winner's PieceColor, if there is one
+    SEEK = 0x53,
+    SPECTATE = 0x4F, // Answered with a SNAPSHOT, then the spectator is sent every MOVE frame the players are
+    SNAPSHOT = 0x4E, // Followed by a GameSnapshot, sent again in place of the moves a lagging spectator missed
+    SESSION = 0x54,  // Followed by a SessionToken, sent to each player right after its color
+    RESUME = 0x52,   // Followed by a ResumeRequest, a new connection takes a player's seat back
+    RESYNC = 0x59,   // Followed by a ResyncHeader and the moves. Answers a RESUME that succeeded, a player sending
+                     // it alone, and a MOVE_V2 whose hash is not the server's
+    HELLO = 0x48,    // Followed by a Hello, both ways. Sent first by clients that speak more than version 1
+    MOVE_V2 = 0x4D   // Followed by a CompactMove, in place of MOVE both ways once version 2 is agreed on
+};
+
+enum GameOverReason : unsigned char {
+    GAME_OVER_FLAG,           // The loser's clock ran out
+    GAME_OVER_ENDED,          // Any other end, or no such game or seat. Sent to spectators and resumes, without a winner
+    GAME_OVER_ABANDONED,      // The loser left and did not come back within RECONNECT_GRACE_MS
+    GAME_OVER_CHECKMATE,
+    GAME_OVER_TABLEBASE_WIN,  // Adjudicated, the tablebase has a forced mate for the winner
+    GAME_OVER_TABLEBASE_DRAW, // Adjudicated, without a winner
+    GAME_OVER_NO_OPPONENT     // Nobody was paired with the client within MATCH_WAIT_TIMEOUT_MS, without a winner. A SEEK queues it again
+};
+
+enum AnalysisStatus : unsigned char {
+    ANALYSIS_SEARCHED,
+    ANALYSIS_CACHED,
+    ANALYSIS_INVALID_POSITION
+};
+
+#pragma pack(push, 1)
+// Followed by `length` bytes of FEN or space separated UCI moves
+struct AnalysisRequest {
+    uint32_t requestId;
+    uint8_t depth;   // 0 for the deepest allowed
+    uint16_t timeMs; // 0 for the longest allowed
+    uint8_t isFen;
+    uint16_t length;
+};
+
+// Sent while waiting for a match, clients that never send it are rated MATCH_DEFAULT_RATING
+struct SeekRequest {
+    uint16_t rating;
+};
+
+// Connections watching a game are not looking for one, they stop watching when it ends
+struct SpectateRequest {
+    uint32_t gameId; // 0 for the most recently started game
+};
+
+struct ResumeRequest {
+    uint64_t token;
 };
 
-struct ClientInfo {
+// Followed by the board as in a MOVE frame, the side to move and numMoves EncodedMoves. Those are the
+// latest ones when a game has more than a frame holds
+struct GameSnapshot {
+    uint32_t gameId;
+    int32_t remainingMs[2]; // Indexed by PieceColor, as of the last move
+    uint16_t totalMoves;
+    uint16_t numMoves;
+};
+
+struct AnalysisResponse {
+    uint32_t requestId;
+    AnalysisStatus status;
+    EncodedMove bestMove;
+    int16_t score; // Centipawns for the side to move
+    uint8_t depth;
+    uint64_t nodes;
+};
+#pragma pack(pop)
+
+#define SNAPSHOT_MAX_MOVES ((MAX_FRAME_SIZE - 1 - sizeof(GameSnapshot) - NUM_SQUARES - 1) / sizeof(EncodedMove))
+#define RESYNC_MAX_MOVES ((MAX_FRAME_SIZE - 1 - sizeof(ResyncHeader)) / sizeof(EncodedMove))
+
+// Who a spectating connection is watching
+struct Spectating {
+    std::shared_ptr<GameSession> session;
+    uint32_t generation;
+};
+
+// The game a player's connection is seated in
+struct Playing {
+    std::shared_ptr<GameSession> session;
+    uint32_t generation; // An entry left by an earlier connection on the same fd does not count
+};
+
+// A client in the matchmaker's queue, until it is paired or its wait runs out
+struct Waiting {
+    uint64_t wait; // Which offer the timeout was armed for, a later one replaces it
+    TimerHandle timeout;
+};
+
+// What a session token resumes
+struct Seat {
+    std::shared_ptr<GameSession> session;
     PieceColor color;
 };
 
+// Agreed on by a connection's HELLO
+struct Protocol {
+    uint32_t generation;
+    FrameFormat format;
+};
+
 class ChessServer {
 public:
-    ChessServer();
+    explicit ChessServer(IoBackend backend = IO_BACKEND_EPOLL, HeartbeatConfig heartbeat = {});
     ChessServer(const ChessServer &) = delete;
     ChessServer &operator=(const ChessServer &) = delete;
     ChessServer(ChessServer &&) noexcept = default;
@@ -25,17 +142,62 @@ public:
 
 private:
     Server m_Server;
-    std::unordered_set<int> m_ConnectedClients;                        // List of all clients still connected
-    std::unordered_map<int, int> m_ClientPairings;                     // Map from one clientFd to another. For every pair (X, Y), there will be two mappings from X->Y and Y->X
-    std::unordered_map<int, std::shared_ptr<ChessGame>> m_ClientGames; // All ongoing games
-    std::set<int> m_ClientsWaitingForMatch;                            // Clients waiting for a match
-    std::mutex m_MatchingMutex;                                        // When matching a player to an opponent, we need a mutex to make sure it doesn't match the same opponent with someone waiting
-    std::mutex m_EraseMutex;                                           // Once one player disconnects, the player and opponent are kicked off, make sure both don't disconnect at same time
+    Tablebases m_Tablebases;
+    OpeningBook m_OpeningBook;
+    AnalysisService m_Analysis;                                        // Declared before the scheduler so its threads are joined first
+    FairPlayAnalyzer m_FairPlay;
+    SearchScheduler m_SearchScheduler;
+    Matchmaker m_Matchmaker;
+    MetricsDumper m_MetricsDumper;
+    std::unordered_map<int, Playing> m_ClientGames;                     // All ongoing games, by the fd of each player that is there
+    std::unordered_map<uint32_t, std::shared_ptr<GameSession>> m_Games; // The same games by id, for spectators to find
+    std::unordered_map<int, Spectating> m_Spectators;                   // Keyed by the spectator's fd
+    std::unordered_map<uint64_t, Seat> m_Seats;                         // Keyed by session token, for as long as the game lasts
+    std::mt19937_64 m_TokenRandom{std::random_device{}()};
+    std::unordered_map<int, uint32_t> m_Arriving;                       // Generations of connections still in their intent window, by fd
+    std::unordered_map<int, Protocol> m_Protocols;                      // Connections that said HELLO, by fd
+    std::unordered_map<int, Waiting> m_Waiting;                         // Wait timeouts by fd, kept until they fire even once the client is paired
+    uint32_t m_NextGameId = 1;
+    uint64_t m_NextWait = 1;
+    std::atomic<bool> m_RematchArmed{false};                           // A timer will pair up clients whose windows have grown
+    std::mutex m_MatchingMutex;                                        // Guards the maps, id and random above. Starting a game, lookups and erasing a finished one all take it
 
     void responseHandler(int client, Data &inData, Data &outData);
     void acceptHandler(int client);
-    void disconnectHandler(int client);
-    void eraseClientAndOpponent(int client);
+    void seekHandler(int client, Data &inData);
+    void helloHandler(int client, Data &inData, Data &outData);
+    FrameFormat formatOf(int client, uint32_t generation); // Called with m_MatchingMutex held
+    bool claimArriving(const MatchTicket &ticket); // False once someone else has decided what the connection is for
+    void offerTicket(const MatchTicket &ticket);
+    void expireTicket(const MatchTicket &ticket, uint64_t wait);
+    void spectateHandler(int client, Data &inData);
+    void resyncHandler(int client);
+    void stopSpectating(int client, uint32_t generation = 0); // Only the connection with that generation, unless it is 0
+    void resumeHandler(int client, Data &inData);
+    void resumeSeat(GameSession &session, PieceColor color, int client, uint32_t generation, FrameFormat format);
+    void leaveGame(GameSession &session, int client, uint32_t generation);
+    void abandonGame(GameSession &session, PieceColor color, uint32_t seating);
+    void startGames(std::vector<MatchPair> &pairs);
+    bool startGame(const MatchTicket &white, const MatchTicket &black); // False if either has left meanwhile
+    void scheduleRematch();
+    void armFlagTimer(GameSession &session);
+    void checkFlag(GameSession &session, uint32_t moves);
+    void disconnectHandler(int client, uint32_t generation);
+    std::shared_ptr<GameSession> playingSession(int client, uint32_t generation); // The game client is seated in, if any
+    Playing *findPlaying(int client, uint32_t generation); // Called with m_MatchingMutex held
+    void applyMove(GameSession &session, int client, uint32_t generation, const std::vector<unsigned char> &response,
+                   std::chrono::steady_clock::time_point received);
+    static bool readMove(ChessGame &game, const std::vector<unsigned char> &command, Action &action);
+    bool readCompactMove(GameSession &session, int client, const std::vector<unsigned char> &command, Action &action);
+    static SharedFrame moveFrame(GameSession &session, const Action &action, FrameFormat format, uint64_t hash);
+    void endGame(GameSession &session, SharedFrame spectatorFrame = nullptr); // Spectators get GAME_OVER_ENDED unless given another
+    static SharedFrame gameOverFrame(GameOverReason reason, PieceColor winner);
+    SharedFrame adjudicateEndgame(ChessGame &game); // The GAME_OVER to send, nullptr unless the tablebase knows the result
+    void analysisHandler(int client, Data &inData, Data &outData);
+    static std::vector<char> analysisMessage(uint32_t requestId, AnalysisStatus status, const SearchResult &result);
+    static SharedFrame snapshotFrame(GameSession &session);
+    static SharedFrame gameEndedFrame(GameOverReason reason = GAME_OVER_ENDED); // Without a winner
+    static SharedFrame resyncFrame(GameSession &session, PieceColor color);
 };
 } // namespace chess_online
 #endif
\ No newline at end of file
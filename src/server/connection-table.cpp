@@ -0,0 +1,109 @@
+#ifdef CHESS_SERVER_BUILD
+#include "connection-table.h"
+#include "helpers.h"
+#include <stdexcept>
+
+namespace chess_online {
+ConnectionTable::ConnectionTable() {
+    for (std::atomic<Slot *> &chunk : m_Chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ConnectionTable::~ConnectionTable() {
+    for (std::atomic<Slot *> &chunk : m_Chunks) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+ConnectionTable::Slot *ConnectionTable::slotForOpen(int fd) {
+    if (fd < 0 || static_cast<unsigned>(fd) >= CONNECTION_CHUNK_SIZE * CONNECTION_MAX_CHUNKS) {
+        THROW_RUNTIME_ERROR("fd out of range for connection table: " << fd);
+    }
+    std::atomic<Slot *> &chunk = m_Chunks[fd / CONNECTION_CHUNK_SIZE];
+    Slot *slots = chunk.load(std::memory_order_acquire);
+    if (!slots) {
+        // Growth is rare, only opens contend on this lock and lookups never take it
+        std::scoped_lock lock(m_GrowMutex);
+        slots = chunk.load(std::memory_order_relaxed);
+        if (!slots) {
+            slots = new Slot[CONNECTION_CHUNK_SIZE];
+            chunk.store(slots, std::memory_order_release);
+        }
+    }
+    return &slots[fd % CONNECTION_CHUNK_SIZE];
+}
+
+uint32_t ConnectionTable::open(int fd, int workerId) {
+    Slot *opened = slotForOpen(fd);
+    opened->connection.inData.len = opened->connection.inData.pos = 0;
+    opened->connection.outQueue.clear();
+    opened->connection.writeArmed = false;
+    opened->connection.flushQueued = false;
+    opened->connection.sendsInFlight = 0;
+    opened->connection.recvArmed = false;
+    opened->connection.migrateTo = -1;
+    opened->connection.closing = false;
+    opened->connection.lagging = false;
+    opened->connection.resyncRequested = false;
+    opened->connection.lastActivity = std::chrono::steady_clock::now();
+    opened->connection.workerId.store(workerId, std::memory_order_relaxed);
+    return opened->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+void ConnectionTable::close(int fd) {
+    Slot *closed = slot(fd);
+    if (closed && (closed->generation.load(std::memory_order_relaxed) & 1)) {
+        closed->generation.fetch_add(1, std::memory_order_acq_rel);
+        closed->connection.outQueue.clear();
+    }
+}
+
+void OutboundQueue::push(SharedFrame frame) {
+    if (m_Overflowed || m_Count == OUTBOUND_QUEUE_FRAMES || m_Bytes + frame->size() > OUTBOUND_HIGH_WATER_BYTES) {
+        m_Overflowed = true;
+        return;
+    }
+    m_Bytes += frame->size();
+    m_Frames[(m_Head + m_Count) % OUTBOUND_QUEUE_FRAMES] = std::move(frame);
+    m_Count++;
+}
+
+int OutboundQueue::gather(iovec *iov, int maxIov) const {
+    int iovCount = 0;
+    for (size_t i = 0; i < m_Count && iovCount < maxIov; i++, iovCount++) {
+        const std::vector<char> &frame = *m_Frames[(m_Head + i) % OUTBOUND_QUEUE_FRAMES];
+        const size_t offset = i == 0 ? m_HeadOffset : 0;
+        iov[iovCount].iov_base = const_cast<char *>(frame.data() + offset);
+        iov[iovCount].iov_len = frame.size() - offset;
+    }
+    return iovCount;
+}
+
+void OutboundQueue::consume(size_t written) {
+    m_Bytes -= written;
+    while (written > 0) {
+        SharedFrame &frame = m_Frames[m_Head];
+        const size_t remaining = frame->size() - m_HeadOffset;
+        if (written < remaining) {
+            m_HeadOffset += written;
+            return;
+        }
+        written -= remaining;
+        frame.reset();
+        m_Head = (m_Head + 1) % OUTBOUND_QUEUE_FRAMES;
+        m_Count--;
+        m_HeadOffset = 0;
+    }
+}
+
+void OutboundQueue::clear() {
+    for (; m_Count > 0; m_Count--) {
+        m_Frames[m_Head].reset();
+        m_Head = (m_Head + 1) % OUTBOUND_QUEUE_FRAMES;
+    }
+    m_Head = m_HeadOffset = m_Bytes = 0;
+    m_Overflowed = false;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,123 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sys/uio.h>
+#include <vector>
+
+#define MAX_BUFFER_SIZE 4096U
+#define CONNECTION_CHUNK_SIZE 256U   // Slots allocated together when an fd first lands in a chunk
+#define CONNECTION_MAX_CHUNKS 4096U  // Enough for a million fds
+#define OUTBOUND_QUEUE_FRAMES 64U    // A client this far behind is not reading, it gets dropped
+#define OUTBOUND_HIGH_WATER_BYTES (64U * 1024U)
+
+namespace chess_online {
+
+struct Data {
+    Data() : len(0), pos(0), buffer() {};
+    size_t len;
+    size_t pos;
+    std::array<char, MAX_BUFFER_SIZE> buffer;
+};
+
+// A complete frame, length header included. Never modified once built, so one copy can be queued to
+// any number of connections
+using SharedFrame = std::shared_ptr<const std::vector<char>>;
+
+// Ring of frames waiting to be written, oldest first
+class OutboundQueue {
+public:
+    bool empty() const { return m_Count == 0; }
+    size_t bytes() const { return m_Bytes; }
+    size_t frames() const { return m_Count; }
+    bool overflowed() const { return m_Overflowed; } // The reader fell past the high-water mark
+    void push(SharedFrame frame);
+    int gather(iovec *iov, int maxIov) const;
+    void consume(size_t written);
+    void clear();
+
+private:
+    std::array<SharedFrame, OUTBOUND_QUEUE_FRAMES> m_Frames;
+    size_t m_Head = 0;
+    size_t m_Count = 0;
+    size_t m_HeadOffset = 0; // Bytes of the oldest frame already written
+    size_t m_Bytes = 0;      // Unwritten bytes over all frames
+    bool m_Overflowed = false;
+};
+
+// Only the worker that owns the connection touches its buffers
+struct Connection {
+    Data inData;
+    OutboundQueue outQueue;
+    bool writeArmed = false;  // EPOLLOUT is in the epoll interest, only while outQueue is not empty
+    bool flushQueued = false; // Already on the worker's list of connections to flush
+    uint16_t sendsInFlight = 0; // Linked sends submitted to io_uring and not completed yet
+    bool recvArmed = false;     // A multishot recv is submitted to io_uring
+    int migrateTo = -1;         // Moving to this worker once nothing is in flight on the current one
+    bool closing = false;       // Shut down, closed once the kernel is done with the sends still in flight
+    bool lagging = false;       // Missed a broadcast, skips the ones after it until a resync arrives
+    bool resyncRequested = false;
+    std::chrono::steady_clock::time_point lastActivity; // Last time anything was received
+    std::atomic<int> workerId{-1};
+};
+
+// Connections indexed directly by fd. Chunks are allocated on first use and never freed while the
+// table lives, so a lookup is two atomic loads and never races with growth. Each slot has a
+// generation that is odd while the fd is open and bumped on every open and close, so work queued
+// for a connection can tell when its fd has since been closed and handed to someone else
+class ConnectionTable {
+public:
+    ConnectionTable();
+    ~ConnectionTable();
+    ConnectionTable(const ConnectionTable &) = delete;
+    ConnectionTable &operator=(const ConnectionTable &) = delete;
+
+    uint32_t open(int fd, int workerId); // Returns the new generation
+    void close(int fd);
+
+    Connection *get(int fd) const; // nullptr unless the fd is open
+    Connection *get(int fd, uint32_t generation) const; // Also nullptr if the fd was reopened since
+    uint32_t generation(int fd) const;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> generation{0};
+        Connection connection;
+    };
+
+    std::array<std::atomic<Slot *>, CONNECTION_MAX_CHUNKS> m_Chunks;
+    std::mutex m_GrowMutex;
+
+    Slot *slot(int fd) const;
+    Slot *slotForOpen(int fd);
+};
+
+inline ConnectionTable::Slot *ConnectionTable::slot(int fd) const {
+    if (fd < 0 || static_cast<unsigned>(fd) >= CONNECTION_CHUNK_SIZE * CONNECTION_MAX_CHUNKS) {
+        return nullptr;
+    }
+    Slot *chunk = m_Chunks[fd / CONNECTION_CHUNK_SIZE].load(std::memory_order_acquire);
+    return chunk ? &chunk[fd % CONNECTION_CHUNK_SIZE] : nullptr;
+}
+
+inline Connection *ConnectionTable::get(int fd) const {
+    Slot *found = slot(fd);
+    return found && (found->generation.load(std::memory_order_acquire) & 1) ? &found->connection : nullptr;
+}
+
+inline Connection *ConnectionTable::get(int fd, uint32_t generation) const {
+    Slot *found = slot(fd);
+    return found && found->generation.load(std::memory_order_acquire) == generation ? &found->connection : nullptr;
+}
+
+inline uint32_t ConnectionTable::generation(int fd) const {
+    Slot *found = slot(fd);
+    return found ? found->generation.load(std::memory_order_acquire) : 0;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
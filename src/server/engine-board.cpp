@@ -0,0 +1,584 @@
+#ifdef CHESS_SERVER_BUILD
+#include "engine-board.h"
+#include "../zobrist.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace chess_online {
+
+namespace {
+const int KNIGHT_DELTAS[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+const int KING_DELTAS[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}};
+const int BISHOP_DIRECTIONS[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+const int ROOK_DIRECTIONS[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+const int WHITE_KING_START = 60;
+const int BLACK_KING_START = 4;
+
+// Target squares for each origin, terminated by -1
+using TargetTable = std::array<std::array<int8_t, 9>, NUM_SQUARES>;
+
+TargetTable buildTargets(const int (&deltas)[8][2]) {
+    TargetTable table;
+    for (int square = 0; square < NUM_SQUARES; square++) {
+        int count = 0;
+        for (const auto &delta : deltas) {
+            Position target = {square % 8 + delta[0], square / 8 + delta[1]};
+            if (isValidPosition(target)) {
+                table[square][count++] = static_cast<int8_t>(posToIndex(target));
+            }
+        }
+        table[square][count] = -1;
+    }
+    return table;
+}
+
+const TargetTable KNIGHT_TARGETS = buildTargets(KNIGHT_DELTAS);
+const TargetTable KING_TARGETS = buildTargets(KING_DELTAS);
+
+// Rights that survive a move touching the given square
+std::array<uint8_t, NUM_SQUARES> buildCastlingMasks() {
+    std::array<uint8_t, NUM_SQUARES> masks;
+    masks.fill(0xF);
+    masks[WHITE_KING_START] = static_cast<uint8_t>(~(CASTLE_WHITE_KING | CASTLE_WHITE_QUEEN) & 0xF);
+    masks[63] = static_cast<uint8_t>(~CASTLE_WHITE_KING & 0xF);
+    masks[56] = static_cast<uint8_t>(~CASTLE_WHITE_QUEEN & 0xF);
+    masks[BLACK_KING_START] = static_cast<uint8_t>(~(CASTLE_BLACK_KING | CASTLE_BLACK_QUEEN) & 0xF);
+    masks[7] = static_cast<uint8_t>(~CASTLE_BLACK_KING & 0xF);
+    masks[0] = static_cast<uint8_t>(~CASTLE_BLACK_QUEEN & 0xF);
+    return masks;
+}
+
+const std::array<uint8_t, NUM_SQUARES> CASTLING_MASKS = buildCastlingMasks();
+
+inline uint64_t pieceKey(EnginePiece piece, int square) {
+    return ZOBRIST.pieces[enginePieceColor(piece)][enginePieceType(piece)][square];
+}
+
+inline PieceColor opposite(PieceColor color) {
+    return color == WHITE ? BLACK : WHITE;
+}
+
+const char FEN_PIECES[] = " prnbqk";
+} // namespace
+
+EngineBoard::EngineBoard() {
+    clear();
+    fromFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", *this);
+}
+
+void EngineBoard::clear() {
+    m_Squares.fill(0);
+    m_SideToMove = WHITE;
+    m_Castling = 0;
+    m_EnPassant = -1;
+    m_HalfmoveClock = 0;
+    m_FullmoveNumber = 1;
+    m_KingSquares = {-1, -1};
+    m_History.clear();
+    m_Hash = computeHash();
+}
+
+void EngineBoard::setPiece(int square, EnginePiece piece) {
+    if (m_Squares[square]) {
+        m_Hash ^= pieceKey(m_Squares[square], square);
+    }
+    m_Squares[square] = piece;
+    if (piece) {
+        m_Hash ^= pieceKey(piece, square);
+        if (enginePieceType(piece) == KING) {
+            m_KingSquares[enginePieceColor(piece)] = static_cast<int8_t>(square);
+        }
+    }
+}
+
+void EngineBoard::setSideToMove(PieceColor color) {
+    if (color != m_SideToMove) {
+        m_SideToMove = color;
+        m_Hash ^= ZOBRIST.side;
+    }
+}
+
+void EngineBoard::setCastlingRights(uint8_t rights) {
+    m_Hash ^= ZOBRIST.castling[m_Castling] ^ ZOBRIST.castling[rights];
+    m_Castling = rights;
+}
+
+bool EngineBoard::fromFen(const std::string &fen, EngineBoard &board) {
+    std::istringstream stream(fen);
+    std::string placement, side, castling, enPassant;
+    int halfmove = 0, fullmove = 1;
+    if (!(stream >> placement >> side)) {
+        return false;
+    }
+    stream >> castling >> enPassant >> halfmove >> fullmove;
+
+    EngineBoard parsed = board;
+    parsed.clear();
+    int x = 0, y = 0;
+    for (char c : placement) {
+        if (c == '/') {
+            x = 0;
+            y++;
+        } else if (c >= '1' && c <= '8') {
+            x += c - '0';
+        } else {
+            const char *found = std::strchr(FEN_PIECES + 1, std::tolower(c));
+            if (!found || !isValidPosition({x, y})) {
+                return false;
+            }
+            PieceType type = static_cast<PieceType>(found - FEN_PIECES);
+            parsed.setPiece(posToIndex({x, y}), makeEnginePiece(type, std::isupper(c) ? WHITE : BLACK));
+            x++;
+        }
+    }
+    if (parsed.m_KingSquares[WHITE] < 0 || parsed.m_KingSquares[BLACK] < 0) {
+        return false;
+    }
+
+    parsed.setSideToMove(side == "b" ? BLACK : WHITE);
+    uint8_t rights = 0;
+    for (char c : castling) {
+        rights |= c == 'K' ? CASTLE_WHITE_KING : c == 'Q' ? CASTLE_WHITE_QUEEN
+                                             : c == 'k'   ? CASTLE_BLACK_KING
+                                             : c == 'q'   ? CASTLE_BLACK_QUEEN
+                                                          : 0;
+    }
+    // Drop rights the placement cannot support so castling never moves a missing rook
+    const EnginePiece whiteKing = makeEnginePiece(KING, WHITE), whiteRook = makeEnginePiece(ROOK, WHITE);
+    const EnginePiece blackKing = makeEnginePiece(KING, BLACK), blackRook = makeEnginePiece(ROOK, BLACK);
+    if (parsed.m_Squares[60] != whiteKing || parsed.m_Squares[63] != whiteRook) {
+        rights &= ~CASTLE_WHITE_KING;
+    }
+    if (parsed.m_Squares[60] != whiteKing || parsed.m_Squares[56] != whiteRook) {
+        rights &= ~CASTLE_WHITE_QUEEN;
+    }
+    if (parsed.m_Squares[4] != blackKing || parsed.m_Squares[7] != blackRook) {
+        rights &= ~CASTLE_BLACK_KING;
+    }
+    if (parsed.m_Squares[4] != blackKing || parsed.m_Squares[0] != blackRook) {
+        rights &= ~CASTLE_BLACK_QUEEN;
+    }
+    parsed.setCastlingRights(rights);
+    if (enPassant.size() == 2 && enPassant[0] >= 'a' && enPassant[0] <= 'h' && enPassant[1] >= '1' && enPassant[1] <= '8') {
+        parsed.m_EnPassant = static_cast<int8_t>(posToIndex({enPassant[0] - 'a', '8' - enPassant[1]}));
+        parsed.m_Hash ^= ZOBRIST.enPassantFile[parsed.m_EnPassant % 8];
+    }
+    parsed.m_HalfmoveClock = static_cast<uint16_t>(halfmove);
+    parsed.m_FullmoveNumber = static_cast<uint16_t>(fullmove);
+    board = std::move(parsed);
+    return true;
+}
+
+std::string EngineBoard::toFen() const {
+    std::ostringstream fen;
+    for (int y = 0; y < 8; y++) {
+        int empty = 0;
+        for (int x = 0; x < 8; x++) {
+            EnginePiece piece = m_Squares[posToIndex({x, y})];
+            if (!piece) {
+                empty++;
+                continue;
+            }
+            if (empty) {
+                fen << empty;
+                empty = 0;
+            }
+            char c = FEN_PIECES[enginePieceType(piece)];
+            fen << static_cast<char>(enginePieceColor(piece) == WHITE ? std::toupper(c) : c);
+        }
+        if (empty) {
+            fen << empty;
+        }
+        if (y < 7) {
+            fen << '/';
+        }
+    }
+    fen << (m_SideToMove == WHITE ? " w " : " b ");
+    if (!m_Castling) {
+        fen << '-';
+    }
+    if (m_Castling & CASTLE_WHITE_KING) fen << 'K';
+    if (m_Castling & CASTLE_WHITE_QUEEN) fen << 'Q';
+    if (m_Castling & CASTLE_BLACK_KING) fen << 'k';
+    if (m_Castling & CASTLE_BLACK_QUEEN) fen << 'q';
+    if (m_EnPassant >= 0) {
+        fen << ' ' << static_cast<char>('a' + m_EnPassant % 8) << static_cast<char>('8' - m_EnPassant / 8);
+    } else {
+        fen << " -";
+    }
+    fen << ' ' << m_HalfmoveClock << ' ' << m_FullmoveNumber;
+    return fen.str();
+}
+
+uint64_t EngineBoard::computeHash() const {
+    uint64_t hash = 0;
+    for (int square = 0; square < NUM_SQUARES; square++) {
+        if (m_Squares[square]) {
+            hash ^= pieceKey(m_Squares[square], square);
+        }
+    }
+    if (m_SideToMove == BLACK) {
+        hash ^= ZOBRIST.side;
+    }
+    hash ^= ZOBRIST.castling[m_Castling];
+    if (m_EnPassant >= 0) {
+        hash ^= ZOBRIST.enPassantFile[m_EnPassant % 8];
+    }
+    return hash;
+}
+
+int EngineBoard::pieceCount() const {
+    int count = 0;
+    for (EnginePiece piece : m_Squares) {
+        count += piece != 0;
+    }
+    return count;
+}
+
+void EngineBoard::addPawnMoves(MoveList &list, int square, bool capturesOnly) const {
+    const int direction = m_SideToMove == WHITE ? -1 : 1;
+    const int startRow = m_SideToMove == WHITE ? 6 : 1;
+    const int promotionRow = m_SideToMove == WHITE ? 0 : 7;
+    const int x = square % 8;
+    const int y = square / 8;
+    const int frontY = y + direction;
+    if (frontY < 0 || frontY > 7) {
+        return;
+    }
+
+    auto addMove = [&](int dst) {
+        if (frontY == promotionRow) {
+            list.add(encodeMove(square, dst, QUEEN));
+            list.add(encodeMove(square, dst, KNIGHT));
+            list.add(encodeMove(square, dst, ROOK));
+            list.add(encodeMove(square, dst, BISHOP));
+        } else {
+            list.add(encodeMove(square, dst));
+        }
+    };
+
+    int front = posToIndex({x, frontY});
+    if (!m_Squares[front] && (!capturesOnly || frontY == promotionRow)) {
+        addMove(front);
+        int doubleFront = front + direction * 8;
+        if (!capturesOnly && y == startRow && !m_Squares[doubleFront]) {
+            list.add(encodeMove(square, doubleFront));
+        }
+    }
+    for (int dx : {-1, 1}) {
+        if (x + dx < 0 || x + dx > 7) {
+            continue;
+        }
+        int target = posToIndex({x + dx, frontY});
+        EnginePiece occupant = m_Squares[target];
+        if ((occupant && enginePieceColor(occupant) != m_SideToMove) || target == m_EnPassant) {
+            addMove(target);
+        }
+    }
+}
+
+void EngineBoard::addCastlingMoves(MoveList &list) const {
+    const PieceColor enemy = opposite(m_SideToMove);
+    const int king = m_SideToMove == WHITE ? WHITE_KING_START : BLACK_KING_START;
+    const uint8_t kingSide = m_SideToMove == WHITE ? CASTLE_WHITE_KING : CASTLE_BLACK_KING;
+    const uint8_t queenSide = m_SideToMove == WHITE ? CASTLE_WHITE_QUEEN : CASTLE_BLACK_QUEEN;
+    if (!(m_Castling & (kingSide | queenSide)) || m_KingSquares[m_SideToMove] != king || isSquareAttacked(king, enemy)) {
+        return;
+    }
+    // Landing square attacks are caught by the legality check after makeMove
+    if ((m_Castling & kingSide) && !m_Squares[king + 1] && !m_Squares[king + 2] && !isSquareAttacked(king + 1, enemy)) {
+        list.add(encodeMove(king, king + 2));
+    }
+    if ((m_Castling & queenSide) && !m_Squares[king - 1] && !m_Squares[king - 2] && !m_Squares[king - 3] &&
+        !isSquareAttacked(king - 1, enemy)) {
+        list.add(encodeMove(king, king - 2));
+    }
+}
+
+void EngineBoard::generateMoves(MoveList &list, bool capturesOnly) const {
+    list.count = 0;
+    for (int square = 0; square < NUM_SQUARES; square++) {
+        EnginePiece piece = m_Squares[square];
+        if (!piece || enginePieceColor(piece) != m_SideToMove) {
+            continue;
+        }
+        auto addTarget = [&](int target) {
+            EnginePiece occupant = m_Squares[target];
+            if (occupant ? enginePieceColor(occupant) != m_SideToMove : !capturesOnly) {
+                list.add(encodeMove(square, target));
+            }
+            return occupant == 0;
+        };
+        auto addRays = [&](const int (&directions)[4][2]) {
+            for (const auto &direction : directions) {
+                Position target = {square % 8 + direction[0], square / 8 + direction[1]};
+                while (isValidPosition(target) && addTarget(posToIndex(target))) {
+                    target = {target.x + direction[0], target.y + direction[1]};
+                }
+            }
+        };
+
+        switch (enginePieceType(piece)) {
+        case PAWN:
+            addPawnMoves(list, square, capturesOnly);
+            break;
+        case KNIGHT:
+            for (const int8_t *target = KNIGHT_TARGETS[square].data(); *target >= 0; target++) {
+                addTarget(*target);
+            }
+            break;
+        case BISHOP:
+            addRays(BISHOP_DIRECTIONS);
+            break;
+        case ROOK:
+            addRays(ROOK_DIRECTIONS);
+            break;
+        case QUEEN:
+            addRays(BISHOP_DIRECTIONS);
+            addRays(ROOK_DIRECTIONS);
+            break;
+        case KING:
+            for (const int8_t *target = KING_TARGETS[square].data(); *target >= 0; target++) {
+                addTarget(*target);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (!capturesOnly) {
+        addCastlingMoves(list);
+    }
+}
+
+void EngineBoard::generateLegalMoves(MoveList &list) {
+    MoveList pseudoLegal;
+    generateMoves(pseudoLegal);
+    list.count = 0;
+    for (int i = 0; i < pseudoLegal.count; i++) {
+        UndoInfo undo = makeMove(pseudoLegal.moves[i]);
+        if (!leftKingInCheck()) {
+            list.add(pseudoLegal.moves[i]);
+        }
+        unmakeMove(pseudoLegal.moves[i], undo);
+    }
+}
+
+UndoInfo EngineBoard::makeMove(EncodedMove move) {
+    const int src = encodedMoveSrc(move);
+    const int dst = encodedMoveDst(move);
+    const PieceType promoteType = encodedMovePromoteType(move);
+    const EnginePiece piece = m_Squares[src];
+    const PieceType type = enginePieceType(piece);
+
+    UndoInfo undo{m_Squares[dst], m_Castling, m_EnPassant, m_HalfmoveClock, m_Hash};
+    m_History.push_back(m_Hash);
+
+    m_Hash ^= ZOBRIST.castling[m_Castling];
+    if (m_EnPassant >= 0) {
+        m_Hash ^= ZOBRIST.enPassantFile[m_EnPassant % 8];
+    }
+
+    if (type == PAWN && dst == m_EnPassant) {
+        int capturedSquare = dst + (m_SideToMove == WHITE ? 8 : -8);
+        undo.captured = m_Squares[capturedSquare];
+        m_Hash ^= pieceKey(undo.captured, capturedSquare);
+        m_Squares[capturedSquare] = 0;
+    } else if (undo.captured) {
+        m_Hash ^= pieceKey(undo.captured, dst);
+    }
+
+    EnginePiece placed = promoteType ? makeEnginePiece(promoteType, m_SideToMove) : piece;
+    m_Hash ^= pieceKey(piece, src) ^ pieceKey(placed, dst);
+    m_Squares[src] = 0;
+    m_Squares[dst] = placed;
+
+    if (type == KING) {
+        m_KingSquares[m_SideToMove] = static_cast<int8_t>(dst);
+        if (std::abs(dst - src) == 2) {
+            int rookSrc = dst > src ? src + 3 : src - 4;
+            int rookDst = dst > src ? src + 1 : src - 1;
+            EnginePiece rook = m_Squares[rookSrc];
+            m_Hash ^= pieceKey(rook, rookSrc) ^ pieceKey(rook, rookDst);
+            m_Squares[rookSrc] = 0;
+            m_Squares[rookDst] = rook;
+        }
+    }
+
+    m_EnPassant = (type == PAWN && std::abs(dst - src) == 16) ? static_cast<int8_t>((src + dst) / 2) : -1;
+    m_Castling &= CASTLING_MASKS[src] & CASTLING_MASKS[dst];
+    m_Hash ^= ZOBRIST.castling[m_Castling];
+    if (m_EnPassant >= 0) {
+        m_Hash ^= ZOBRIST.enPassantFile[m_EnPassant % 8];
+    }
+
+    m_HalfmoveClock = (type == PAWN || undo.captured) ? 0 : m_HalfmoveClock + 1;
+    if (m_SideToMove == BLACK) {
+        m_FullmoveNumber++;
+    }
+    m_SideToMove = opposite(m_SideToMove);
+    m_Hash ^= ZOBRIST.side;
+    return undo;
+}
+
+void EngineBoard::unmakeMove(EncodedMove move, const UndoInfo &undo) {
+    const int src = encodedMoveSrc(move);
+    const int dst = encodedMoveDst(move);
+    m_SideToMove = opposite(m_SideToMove);
+    if (m_SideToMove == BLACK) {
+        m_FullmoveNumber--;
+    }
+
+    EnginePiece piece = encodedMovePromoteType(move) ? makeEnginePiece(PAWN, m_SideToMove) : m_Squares[dst];
+    m_Squares[src] = piece;
+    m_Squares[dst] = 0;
+
+    const PieceType type = enginePieceType(piece);
+    if (type == PAWN && dst == undo.enPassant) {
+        m_Squares[dst + (m_SideToMove == WHITE ? 8 : -8)] = undo.captured;
+    } else {
+        m_Squares[dst] = undo.captured;
+    }
+    if (type == KING) {
+        m_KingSquares[m_SideToMove] = static_cast<int8_t>(src);
+        if (std::abs(dst - src) == 2) {
+            int rookSrc = dst > src ? src + 3 : src - 4;
+            int rookDst = dst > src ? src + 1 : src - 1;
+            m_Squares[rookSrc] = m_Squares[rookDst];
+            m_Squares[rookDst] = 0;
+        }
+    }
+
+    m_Castling = undo.castling;
+    m_EnPassant = undo.enPassant;
+    m_HalfmoveClock = undo.halfmoveClock;
+    m_Hash = undo.hash;
+    m_History.pop_back();
+}
+
+bool EngineBoard::applyMoves(const std::vector<EncodedMove> &moves) {
+    MoveList legal;
+    for (EncodedMove move : moves) {
+        generateLegalMoves(legal);
+        if (std::find(legal.moves.begin(), legal.moves.begin() + legal.count, move) == legal.moves.begin() + legal.count) {
+            return false;
+        }
+        makeMove(move);
+    }
+    return true;
+}
+
+bool EngineBoard::isSquareAttacked(int square, PieceColor by) const {
+    const int x = square % 8;
+    const int y = square / 8;
+
+    // Pawns attack towards the opponent, so look one row back from their point of view
+    const int pawnY = y + (by == WHITE ? 1 : -1);
+    const EnginePiece pawn = makeEnginePiece(PAWN, by);
+    if (pawnY >= 0 && pawnY < 8) {
+        if ((x > 0 && m_Squares[posToIndex({x - 1, pawnY})] == pawn) ||
+            (x < 7 && m_Squares[posToIndex({x + 1, pawnY})] == pawn)) {
+            return true;
+        }
+    }
+
+    const EnginePiece knight = makeEnginePiece(KNIGHT, by);
+    for (const int8_t *target = KNIGHT_TARGETS[square].data(); *target >= 0; target++) {
+        if (m_Squares[*target] == knight) {
+            return true;
+        }
+    }
+    const EnginePiece king = makeEnginePiece(KING, by);
+    for (const int8_t *target = KING_TARGETS[square].data(); *target >= 0; target++) {
+        if (m_Squares[*target] == king) {
+            return true;
+        }
+    }
+
+    const EnginePiece queen = makeEnginePiece(QUEEN, by);
+    auto rayAttacked = [&](const int (&directions)[4][2], EnginePiece slider) {
+        for (const auto &direction : directions) {
+            Position target = {x + direction[0], y + direction[1]};
+            while (isValidPosition(target)) {
+                EnginePiece occupant = m_Squares[posToIndex(target)];
+                if (occupant) {
+                    if (occupant == slider || occupant == queen) {
+                        return true;
+                    }
+                    break;
+                }
+                target = {target.x + direction[0], target.y + direction[1]};
+            }
+        }
+        return false;
+    };
+    return rayAttacked(BISHOP_DIRECTIONS, makeEnginePiece(BISHOP, by)) ||
+           rayAttacked(ROOK_DIRECTIONS, makeEnginePiece(ROOK, by));
+}
+
+bool EngineBoard::inCheck() const {
+    return isSquareAttacked(m_KingSquares[m_SideToMove], opposite(m_SideToMove));
+}
+
+bool EngineBoard::leftKingInCheck() const {
+    return isSquareAttacked(m_KingSquares[opposite(m_SideToMove)], m_SideToMove);
+}
+
+bool EngineBoard::isRepetition() const {
+    const int size = static_cast<int>(m_History.size());
+    const int oldest = std::max(0, size - m_HalfmoveClock);
+    for (int i = size - 2; i >= oldest; i -= 2) {
+        if (m_History[i] == m_Hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EngineBoard::isCapture(EncodedMove move) const {
+    const int dst = encodedMoveDst(move);
+    return m_Squares[dst] != 0 ||
+           (dst == m_EnPassant && enginePieceType(m_Squares[encodedMoveSrc(move)]) == PAWN);
+}
+
+EncodedMove EngineBoard::parseMove(const std::string &uci) {
+    if (uci.size() < 4) {
+        return 0;
+    }
+    Position src = {uci[0] - 'a', '8' - uci[1]};
+    Position dst = {uci[2] - 'a', '8' - uci[3]};
+    if (!isValidPosition(src) || !isValidPosition(dst)) {
+        return 0;
+    }
+    PieceType promoteType = NONE;
+    if (uci.size() > 4) {
+        const char *found = std::strchr(FEN_PIECES + 1, std::tolower(uci[4]));
+        promoteType = found ? static_cast<PieceType>(found - FEN_PIECES) : NONE;
+    }
+    EncodedMove move = encodeMove(posToIndex(src), posToIndex(dst), promoteType);
+
+    MoveList legal;
+    generateLegalMoves(legal);
+    for (int i = 0; i < legal.count; i++) {
+        if (legal.moves[i] == move) {
+            return move;
+        }
+    }
+    return 0;
+}
+
+std::string EngineBoard::moveToString(EncodedMove move) {
+    const int src = encodedMoveSrc(move);
+    const int dst = encodedMoveDst(move);
+    std::string uci = {static_cast<char>('a' + src % 8), static_cast<char>('8' - src / 8),
+                       static_cast<char>('a' + dst % 8), static_cast<char>('8' - dst / 8)};
+    if (encodedMovePromoteType(move)) {
+        uci += FEN_PIECES[encodedMovePromoteType(move)];
+    }
+    return uci;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
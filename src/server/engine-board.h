@@ -0,0 +1,96 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "../chess.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define MAX_MOVES 256
+
+namespace chess_online {
+
+enum CastlingRights : uint8_t {
+    CASTLE_WHITE_KING = 1,
+    CASTLE_WHITE_QUEEN = 2,
+    CASTLE_BLACK_KING = 4,
+    CASTLE_BLACK_QUEEN = 8
+};
+
+// A square holds the PieceType in the low 3 bits and the color in bit 3, 0 means empty
+using EnginePiece = uint8_t;
+
+inline EnginePiece makeEnginePiece(PieceType type, PieceColor color) {
+    return static_cast<EnginePiece>(type | (color == BLACK ? 8 : 0));
+}
+inline PieceType enginePieceType(EnginePiece piece) { return static_cast<PieceType>(piece & 7); }
+inline PieceColor enginePieceColor(EnginePiece piece) { return (piece & 8) ? BLACK : WHITE; }
+
+struct MoveList {
+    std::array<EncodedMove, MAX_MOVES> moves;
+    int count = 0;
+    void add(EncodedMove move) { moves[count++] = move; }
+};
+
+struct UndoInfo {
+    EnginePiece captured;
+    uint8_t castling;
+    int8_t enPassant;
+    uint16_t halfmoveClock;
+    uint64_t hash;
+};
+
+// Lightweight mailbox board used by search, the opening book and tablebases.
+// Square indices match posToIndex, so index 0 is a8 and index 63 is h1
+class EngineBoard {
+public:
+    EngineBoard(); // Starting position
+    static bool fromFen(const std::string &fen, EngineBoard &board);
+    std::string toFen() const;
+
+    void clear();
+    void setPiece(int square, EnginePiece piece);
+    void setSideToMove(PieceColor color);
+    void setCastlingRights(uint8_t rights);
+
+    void generateMoves(MoveList &list, bool capturesOnly = false) const; // Pseudo-legal
+    void generateLegalMoves(MoveList &list);
+    UndoInfo makeMove(EncodedMove move);
+    void unmakeMove(EncodedMove move, const UndoInfo &undo);
+    bool applyMoves(const std::vector<EncodedMove> &moves);
+
+    bool isSquareAttacked(int square, PieceColor by) const;
+    bool inCheck() const;
+    bool leftKingInCheck() const; // True if the side that just moved left its own king attacked
+    bool isRepetition() const;
+    bool isCapture(EncodedMove move) const;
+    EncodedMove parseMove(const std::string &uci); // Returns 0 if the move is not legal here
+    static std::string moveToString(EncodedMove move);
+
+    EnginePiece pieceAt(int square) const { return m_Squares[square]; }
+    PieceColor sideToMove() const { return m_SideToMove; }
+    uint8_t castlingRights() const { return m_Castling; }
+    int enPassantSquare() const { return m_EnPassant; }
+    int halfmoveClock() const { return m_HalfmoveClock; }
+    int kingSquare(PieceColor color) const { return m_KingSquares[color]; }
+    int pieceCount() const;
+    uint64_t hash() const { return m_Hash; }
+
+private:
+    std::array<EnginePiece, NUM_SQUARES> m_Squares;
+    PieceColor m_SideToMove;
+    uint8_t m_Castling;
+    int8_t m_EnPassant;
+    uint16_t m_HalfmoveClock;
+    uint16_t m_FullmoveNumber;
+    std::array<int8_t, 2> m_KingSquares;
+    uint64_t m_Hash;
+    std::vector<uint64_t> m_History; // Hashes of earlier positions, for repetition detection
+
+    uint64_t computeHash() const;
+    void addPawnMoves(MoveList &list, int square, bool capturesOnly) const;
+    void addCastlingMoves(MoveList &list) const;
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
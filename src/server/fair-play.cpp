@@ -0,0 +1,125 @@
+#ifdef CHESS_SERVER_BUILD
+#include "fair-play.h"
+#include "logger.h"
+#include <algorithm>
+#include <fstream>
+
+namespace chess_online {
+
+FairPlayAnalyzer::FairPlayAnalyzer(SearchScheduler &scheduler, const OpeningBook *book, const std::string &reportPath)
+    : m_Scheduler(scheduler), m_Book(book), m_ReportPath(reportPath) {
+}
+
+void FairPlayAnalyzer::submitGame(uint32_t gameId, std::vector<EncodedMove> moves) {
+    if (moves.size() <= FAIRPLAY_OPENING_PLIES) {
+        return;
+    }
+    {
+        std::scoped_lock lock(m_Mutex);
+        if (m_PendingGames.size() >= FAIRPLAY_MAX_QUEUED_GAMES) {
+            LOG_WARN("Fair play queue is full, skipping game");
+            return;
+        }
+        m_PendingGames.push_back({gameId, std::move(moves)});
+        if (m_Active) {
+            return;
+        }
+        m_Active = true;
+    }
+    // Called as a game ends on a network worker, the replay and the book lookups belong on an idle thread
+    m_Scheduler.postIdle([this] { startNextGame(); });
+}
+
+void FairPlayAnalyzer::startNextGame() {
+    while (1) {
+        {
+            std::scoped_lock lock(m_Mutex);
+            if (m_PendingGames.empty()) {
+                m_Active = false;
+                return;
+            }
+            m_Current = std::move(m_PendingGames.front());
+            m_PendingGames.pop_front();
+        }
+        m_Board = EngineBoard();
+        m_Ply = 0;
+        m_Results.clear();
+        while (m_Ply < m_Current.moves.size() && inOpening() && advance()) {
+        }
+        m_FirstScoredPly = m_Ply;
+        if (m_Ply < m_Current.moves.size()) {
+            analysePosition();
+            return;
+        }
+    }
+}
+
+bool FairPlayAnalyzer::advance() {
+    MoveList legal;
+    m_Board.generateLegalMoves(legal);
+    const EncodedMove move = m_Current.moves[m_Ply];
+    if (std::find(legal.moves.begin(), legal.moves.begin() + legal.count, move) == legal.moves.begin() + legal.count) {
+        m_Current.moves.resize(m_Ply);
+        return false;
+    }
+    m_Board.makeMove(move);
+    m_Ply++;
+    return true;
+}
+
+bool FairPlayAnalyzer::inOpening() const {
+    if (m_Ply < FAIRPLAY_OPENING_PLIES) {
+        return true;
+    }
+    if (!m_Book || !m_Book->isOpen()) {
+        return false;
+    }
+    const std::vector<BookMove> bookMoves = m_Book->lookup(m_Board);
+    return std::any_of(bookMoves.begin(), bookMoves.end(), [this](const BookMove &bookMove) {
+        return bookMove.move == m_Current.moves[m_Ply];
+    });
+}
+
+void FairPlayAnalyzer::analysePosition() {
+    SearchLimits limits;
+    limits.maxDepth = FAIRPLAY_DEPTH;
+    limits.useBook = false;
+    m_Scheduler.submit(m_Board, limits, [this](const SearchResult &result) {
+        onResult(result);
+    }, SEARCH_PRIORITY_IDLE);
+}
+
+void FairPlayAnalyzer::onResult(const SearchResult &result) {
+    m_Results.push_back(result);
+    if (m_Ply < m_Current.moves.size() && advance()) {
+        analysePosition();
+        return;
+    }
+    finishGame();
+    startNextGame();
+}
+
+void FairPlayAnalyzer::finishGame() {
+    FairPlayStats gameStats[2];
+    for (size_t ply = m_FirstScoredPly; ply < m_Current.moves.size(); ply++) {
+        const SearchResult &before = m_Results[ply - m_FirstScoredPly];
+        const SearchResult &after = m_Results[ply - m_FirstScoredPly + 1];
+        const int best = std::clamp(before.score, -FAIRPLAY_SCORE_CAP, FAIRPLAY_SCORE_CAP);
+        const int played = -std::clamp(after.score, -FAIRPLAY_SCORE_CAP, FAIRPLAY_SCORE_CAP);
+        FairPlayStats &stats = gameStats[ply % 2];
+        stats.moves++;
+        stats.agreedMoves += before.bestMove == m_Current.moves[ply];
+        stats.centipawnLoss += std::max(0, best - played);
+    }
+
+    std::ofstream report(m_ReportPath, std::ios::app);
+    report << "game " << m_Current.gameId << " plies " << m_Current.moves.size();
+    for (int color = WHITE; color <= BLACK; color++) {
+        report << (color == WHITE ? " white" : " black")
+               << " agreement " << gameStats[color].agreement()
+               << " acpl " << gameStats[color].averageCentipawnLoss();
+    }
+    report << std::endl;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
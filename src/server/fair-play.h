@@ -0,0 +1,72 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "engine-board.h"
+#include "opening-book.h"
+#include "search-scheduler.h"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define FAIRPLAY_DEPTH 6
+#define FAIRPLAY_OPENING_PLIES 8 // Book theory agrees with any engine, so it is not scored, nor are later book moves
+#define FAIRPLAY_SCORE_CAP 1000  // Keeps one blunder into a lost position from swamping the average
+#define FAIRPLAY_MAX_QUEUED_GAMES 256
+#define FAIRPLAY_REPORT_PATH "fairplay.log"
+
+namespace chess_online {
+
+struct FairPlayStats {
+    uint64_t moves = 0;
+    uint64_t agreedMoves = 0;     // Moves matching the engine's first choice
+    uint64_t centipawnLoss = 0;   // Summed over all scored moves
+    double agreement() const { return moves ? static_cast<double>(agreedMoves) / moves : 0.0; }
+    double averageCentipawnLoss() const { return moves ? static_cast<double>(centipawnLoss) / moves : 0.0; }
+};
+
+// Replays finished games on the scheduler's idle threads and records how often each side found the
+// engine's move and how many centipawns its moves lost. Results are reported per game, by game id.
+// Connections are not people, so nothing is added up per player until there are accounts to key it
+// by. Games are analysed one position at a time, so at most one background search exists however
+// many games are waiting. Scoring starts at the first move that is not in the opening book, if there
+// is one. The scheduler must be destroyed first, which drops the pending search without calling back
+class FairPlayAnalyzer {
+public:
+    explicit FairPlayAnalyzer(SearchScheduler &scheduler, const OpeningBook *book = nullptr,
+                              const std::string &reportPath = FAIRPLAY_REPORT_PATH);
+    FairPlayAnalyzer(const FairPlayAnalyzer &) = delete;
+    FairPlayAnalyzer &operator=(const FairPlayAnalyzer &) = delete;
+
+    // Games that do not start from the initial position are not supported
+    void submitGame(uint32_t gameId, std::vector<EncodedMove> moves);
+
+private:
+    struct GameRecord {
+        uint32_t gameId;
+        std::vector<EncodedMove> moves;
+    };
+
+    SearchScheduler &m_Scheduler;
+    const OpeningBook *m_Book; // Must outlive the analyzer
+    std::string m_ReportPath;
+    std::mutex m_Mutex;
+    std::deque<GameRecord> m_PendingGames;
+    bool m_Active = false; // A game is being analysed, the next one starts when it finishes
+
+    // Only touched by whichever thread is moving the current game forward
+    GameRecord m_Current;
+    EngineBoard m_Board;
+    size_t m_Ply = 0;
+    size_t m_FirstScoredPly = 0;
+    std::vector<SearchResult> m_Results; // One per analysed position, starting at m_FirstScoredPly
+
+    void startNextGame();
+    bool advance(); // Plays the next move, or cuts the game short if it is not legal here
+    bool inOpening() const; // The next move is one of the first plies or a book move
+    void analysePosition();
+    void onResult(const SearchResult &result);
+    void finishGame();
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
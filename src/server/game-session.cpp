@@ -0,0 +1,93 @@
+#ifdef CHESS_SERVER_BUILD
+#include "game-session.h"
+#include <thread>
+
+namespace chess_online {
+GameSession::GameSession(uint32_t id, const Recipient &white, const Recipient &black, uint64_t whiteToken, uint64_t blackToken)
+    : m_Id(id), m_Players{white.fd, black.fd}, m_Generations{white.generation, black.generation}, m_Tokens{whiteToken, blackToken}, m_Head(&m_Stub), m_Tail(&m_Stub) {
+}
+
+GameSession::~GameSession() {
+    // Commands still queued when the last reference goes away are dropped
+    Node *node = m_Tail;
+    while (node) {
+        Node *next = node->next.load(std::memory_order_relaxed);
+        if (node != &m_Stub) {
+            delete node;
+        }
+        node = next;
+    }
+}
+
+void GameSession::removeSpectator(const Recipient &spectator) {
+    for (std::vector<Recipient> &spectators : m_Spectators) {
+        for (Recipient &watching : spectators) {
+            if (watching.fd == spectator.fd && watching.generation == spectator.generation) {
+                watching = spectators.back();
+                spectators.pop_back();
+                return;
+            }
+        }
+    }
+}
+
+void GameSession::clearSpectators() {
+    for (std::vector<Recipient> &spectators : m_Spectators) {
+        spectators.clear();
+    }
+}
+
+void GameSession::post(GameCommand command) {
+    push(new Node{{}, std::move(command)});
+    if (m_Pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        drain();
+    }
+}
+
+void GameSession::push(Node *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *previous = m_Head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+}
+
+GameSession::Node *GameSession::pop() {
+    Node *tail = m_Tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_Stub) {
+        if (!next) {
+            return nullptr;
+        }
+        m_Tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        m_Tail = next;
+        return tail;
+    }
+    if (tail != m_Head.load(std::memory_order_acquire)) {
+        return nullptr; // A producer swapped the head but has not linked its node yet
+    }
+    // Put the stub back behind the last node so that node can be handed out
+    push(&m_Stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_Tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void GameSession::drain() {
+    do {
+        Node *node;
+        // The count says a command is there, it only has to finish being linked
+        while (!(node = pop())) {
+            std::this_thread::yield();
+        }
+        node->command(*this);
+        delete node;
+    } while (m_Pending.fetch_sub(1, std::memory_order_acq_rel) > 1);
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "../chess_game.h"
+#include "server.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#define GAME_CLOCK_INITIAL_MS (5 * 60 * 1000)
+#define GAME_CLOCK_INCREMENT_MS 3000
+
+namespace chess_online {
+
+class GameSession;
+using GameCommand = std::function<void(GameSession &)>;
+
+// What a connection is sent the moves as, chosen by its HELLO
+enum FrameFormat : uint8_t {
+    FRAME_FORMAT_V1,        // MOVE with the whole board, for clients that never said HELLO
+    FRAME_FORMAT_V2,        // MOVE_V2
+    FRAME_FORMAT_V2_HASHED, // MOVE_V2 and the position hash
+    NUM_FRAME_FORMATS
+};
+
+struct GameClock {
+    int64_t remainingMs[2] = {GAME_CLOCK_INITIAL_MS, GAME_CLOCK_INITIAL_MS}; // Indexed by PieceColor
+    std::chrono::steady_clock::time_point turnStarted;
+    uint32_t moves = 0;    // Tells a flag timer armed before the last move that it is stale
+    TimerHandle flagTimer; // Fires when the side to move runs out of time
+};
+
+// One game and the queue of everything that happens to it. Moves, disconnects and anything else
+// that touches the game are posted as commands from any thread. The thread that finds the queue
+// idle runs it until it is empty again, so commands are applied one at a time in the order they
+// were posted and nobody ever waits on a lock for the game
+class GameSession : public std::enable_shared_from_this<GameSession> {
+public:
+    GameSession(uint32_t id, const Recipient &white, const Recipient &black, uint64_t whiteToken, uint64_t blackToken);
+    ~GameSession();
+    GameSession(const GameSession &) = delete;
+    GameSession &operator=(const GameSession &) = delete;
+
+    // The caller keeps a reference to the session, the commands it ends up running may drop the others
+    void post(GameCommand command);
+
+    uint32_t id() const { return m_Id; }
+
+    // Only to be used from inside a command, apart from isPlaying and finished which any thread may ask
+    ChessGame &game() { return m_Game; }
+    GameClock &clock() { return m_Clock; }
+    int player(PieceColor color) const { return m_Players[color].load(std::memory_order_relaxed); } // -1 while that player is away
+    int opponent(int player) const { return player == this->player(WHITE) ? this->player(BLACK) : this->player(WHITE); }
+    uint32_t generation(PieceColor color) const { return m_Generations[color].load(std::memory_order_relaxed); } // Of the connection in the seat
+    bool isPlaying(int fd) const { return fd >= 0 && (fd == player(WHITE) || fd == player(BLACK)); }
+    bool isPlaying(int fd, uint32_t generation) const { return isPlaying(fd) && this->generation(colorOf(fd)) == generation; }
+    PieceColor colorOf(int player) const { return player == this->player(BLACK) ? BLACK : WHITE; }
+    uint64_t token(PieceColor color) const { return m_Tokens[color]; }
+    uint32_t seating(PieceColor color) const { return m_Seatings[color]; } // Changes whenever the seat is left or taken
+    void seat(PieceColor color, int player, uint32_t generation) {
+        m_Players[color].store(player, std::memory_order_relaxed);
+        m_Generations[color].store(generation, std::memory_order_relaxed);
+        m_Seatings[color]++;
+    }
+    FrameFormat format(PieceColor color) const { return m_Formats[color]; } // Of whoever is in the seat
+    void setFormat(PieceColor color, FrameFormat format) { m_Formats[color] = format; }
+    bool finished() const { return m_Finished.load(std::memory_order_relaxed); }
+    void finish() { m_Finished.store(true, std::memory_order_relaxed); }
+    const std::vector<Recipient> &spectators(FrameFormat format) const { return m_Spectators[format]; }
+    void addSpectator(const Recipient &spectator, FrameFormat format) { m_Spectators[format].push_back(spectator); }
+    void removeSpectator(const Recipient &spectator);
+    void clearSpectators();
+
+private:
+    // Intrusive multi producer single consumer queue, a push is one exchange and never fails
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        GameCommand command;
+    };
+
+    uint32_t m_Id; // Never reused while the server runs
+    ChessGame m_Game;
+    GameClock m_Clock;
+    std::atomic<int> m_Players[2]; // Indexed by PieceColor, atomic for the lookups that skip the queue
+    std::atomic<uint32_t> m_Generations[2];
+    uint64_t m_Tokens[2];
+    uint32_t m_Seatings[2] = {};
+    FrameFormat m_Formats[2] = {FRAME_FORMAT_V1, FRAME_FORMAT_V1};
+    std::atomic<bool> m_Finished{false};
+    std::vector<Recipient> m_Spectators[NUM_FRAME_FORMATS]; // Sent every move after the players, in no particular order
+
+    std::atomic<Node *> m_Head; // Producers push here
+    Node *m_Tail;               // The draining thread pops here
+    Node m_Stub;
+    std::atomic<size_t> m_Pending{0}; // Commands posted but not yet run, whoever raises it from zero drains
+
+    void push(Node *node);
+    Node *pop();
+    void drain();
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -1,14 +1,7 @@
 #ifdef CHESS_SERVER_BUILD
 #pragma once
-#include <iostream>
 #include <sstream>
-
-#define PRINT_MSG(msg)                        \
-    do {                                      \
-        std::ostringstream _oss;              \
-        _oss << msg;                          \
-        std::cout << _oss.str() << std::endl; \
-    } while (0)
+#include <stdexcept>
 
 #define THROW_RUNTIME_ERROR(msg)              \
     do {                                      \
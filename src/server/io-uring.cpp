@@ -0,0 +1,211 @@
+#ifdef CHESS_SERVER_BUILD
+#include "io-uring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace chess_online {
+IoUring::~IoUring() {
+    if (m_BufferRing) {
+        munmap(m_BufferRing, m_BufferRingSize);
+    }
+    if (m_Sqes) {
+        munmap(m_Sqes, m_SqesSize);
+    }
+    if (m_CqRing && m_CqRing != m_SqRing) {
+        munmap(m_CqRing, m_CqRingSize);
+    }
+    if (m_SqRing) {
+        munmap(m_SqRing, m_SqRingSize);
+    }
+    if (m_RingFd >= 0) {
+        close(m_RingFd);
+    }
+}
+
+bool IoUring::init(unsigned entries, unsigned completionEntries) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = completionEntries;
+    m_RingFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (m_RingFd < 0) {
+        return false;
+    }
+
+    m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+    }
+    m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd,
+                    IORING_OFF_SQ_RING);
+    if (m_SqRing == MAP_FAILED) {
+        m_SqRing = nullptr;
+        return false;
+    }
+    m_CqRing = singleMmap ? m_SqRing
+                          : mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd,
+                                 IORING_OFF_CQ_RING);
+    if (m_CqRing == MAP_FAILED) {
+        m_CqRing = nullptr;
+        return false;
+    }
+    m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    m_Sqes = static_cast<io_uring_sqe *>(sqes);
+
+    char *sqRing = static_cast<char *>(m_SqRing);
+    char *cqRing = static_cast<char *>(m_CqRing);
+    m_SqHead = reinterpret_cast<unsigned *>(sqRing + params.sq_off.head);
+    m_SqTail = reinterpret_cast<unsigned *>(sqRing + params.sq_off.tail);
+    m_SqArray = reinterpret_cast<unsigned *>(sqRing + params.sq_off.array);
+    m_SqMask = *reinterpret_cast<unsigned *>(sqRing + params.sq_off.ring_mask);
+    m_SqEntries = params.sq_entries;
+    m_CqHead = reinterpret_cast<unsigned *>(cqRing + params.cq_off.head);
+    m_CqTail = reinterpret_cast<unsigned *>(cqRing + params.cq_off.tail);
+    m_CqMask = *reinterpret_cast<unsigned *>(cqRing + params.cq_off.ring_mask);
+    m_Cqes = reinterpret_cast<io_uring_cqe *>(cqRing + params.cq_off.cqes);
+
+    // SQEs are used in ring order, so the indirection array never changes
+    for (unsigned i = 0; i < m_SqEntries; i++) {
+        m_SqArray[i] = i;
+    }
+    m_SqLocalTail = *m_SqTail;
+    return true;
+}
+
+bool IoUring::setupBufferRing(uint16_t group, unsigned count, unsigned size) {
+    m_BufferRingSize = count * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, m_BufferRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    m_BufferRing = static_cast<io_uring_buf_ring *>(ring);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(m_BufferRing);
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (syscall(__NR_io_uring_register, m_RingFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        return false;
+    }
+
+    m_BufferMask = count - 1;
+    m_BufferSize = size;
+    m_Buffers.resize(static_cast<size_t>(count) * size);
+    for (unsigned id = 0; id < count; id++) {
+        recycleBuffer(static_cast<uint16_t>(id));
+    }
+    return true;
+}
+
+bool IoUring::probeMultishot(uint16_t group) {
+    std::vector<char> probeSpace(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeSpace.data());
+    if (syscall(__NR_io_uring_register, m_RingFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    for (const int opcode : {IORING_OP_POLL_ADD, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL}) {
+        if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+
+    // Multishot accept and poll came before multishot recv, a kernel that keeps this one armed has all three
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) < 0) {
+        return false;
+    }
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockets[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    const char byte = 0;
+    bool armed = false;
+    io_uring_cqe cqe;
+    if (submitAndWait(0) >= 0 && write(sockets[1], &byte, 1) == 1 && submitAndWait(1) >= 0 && popCompletion(cqe)) {
+        armed = cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+    }
+    // The peer hanging up ends the recv, its last completion is reaped before the ring is used
+    close(sockets[1]);
+    while (armed && (cqe.flags & IORING_CQE_F_MORE)) {
+        if (submitAndWait(1) < 0 || !popCompletion(cqe)) {
+            armed = false;
+        } else if (cqe.flags & IORING_CQE_F_BUFFER) {
+            recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+    }
+    close(sockets[0]);
+    return armed;
+}
+
+unsigned IoUring::pendingSubmissions() const {
+    return m_SqLocalTail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+}
+
+io_uring_sqe *IoUring::getSqe() {
+    if (!reserve(1)) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_Sqes[m_SqLocalTail & m_SqMask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_SqLocalTail++;
+    return sqe;
+}
+
+bool IoUring::reserve(unsigned count) {
+    if (m_SqEntries - pendingSubmissions() < count) {
+        submitAndWait(0);
+    }
+    return m_SqEntries - pendingSubmissions() >= count;
+}
+
+int IoUring::submitAndWait(unsigned waitFor) {
+    __atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+    return enter(pendingSubmissions(), waitFor);
+}
+
+int IoUring::enter(unsigned toSubmit, unsigned waitFor) {
+    int result = static_cast<int>(syscall(__NR_io_uring_enter, m_RingFd, toSubmit, waitFor,
+                                          waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    // Interrupted or completions backed up, the caller reaps what is there and comes back
+    return result < 0 && (errno == EINTR || errno == EBUSY || errno == EAGAIN) ? 0 : result;
+}
+
+bool IoUring::popCompletion(io_uring_cqe &cqe) {
+    const unsigned head = *m_CqHead;
+    if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = m_Cqes[head & m_CqMask];
+    __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t id) {
+    // The ring's tail shares its slot with the first buffer's reserved field, so only the fields
+    // describing the buffer are written. Entries are indexed from the start of the ring by hand, in C++
+    // the header's flexible array member sits behind an empty struct that takes up space
+    const uint16_t tail = m_BufferRing->tail;
+    io_uring_buf &entry = reinterpret_cast<io_uring_buf *>(m_BufferRing)[tail & m_BufferMask];
+    entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry.len = m_BufferSize;
+    entry.bid = id;
+    __atomic_store_n(&m_BufferRing->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <vector>
+
+namespace chess_online {
+
+// Minimal io_uring over the raw syscalls, only what the server's event loop needs. One ring per
+// worker, only ever touched by that worker's thread
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    bool init(unsigned entries, unsigned completionEntries); // False if the kernel lacks io_uring
+    // Provided buffers for recv with IOSQE_BUFFER_SELECT. False if the kernel predates buffer rings
+    bool setupBufferRing(uint16_t group, unsigned count, unsigned size);
+    // Whether the opcodes the server uses exist and a multishot recv from the buffer group stays armed.
+    // Kernels before 6.0 have the ring and buffer rings but reject or end multishot recv
+    bool probeMultishot(uint16_t group);
+
+    io_uring_sqe *getSqe();          // Submits what is queued first if the ring is full
+    bool reserve(unsigned count);    // Makes sure the next `count` SQEs go in the same submission
+    int submitAndWait(unsigned waitFor);
+    bool popCompletion(io_uring_cqe &cqe);
+
+    char *buffer(uint16_t id) { return m_Buffers.data() + static_cast<size_t>(id) * m_BufferSize; }
+    void recycleBuffer(uint16_t id);
+
+private:
+    int m_RingFd = -1;
+    void *m_SqRing = nullptr;
+    void *m_CqRing = nullptr;
+    size_t m_SqRingSize = 0;
+    size_t m_CqRingSize = 0;
+    io_uring_sqe *m_Sqes = nullptr;
+    size_t m_SqesSize = 0;
+
+    unsigned *m_SqHead = nullptr;
+    unsigned *m_SqTail = nullptr;
+    unsigned *m_SqArray = nullptr;
+    unsigned m_SqMask = 0;
+    unsigned m_SqEntries = 0;
+    unsigned m_SqLocalTail = 0; // SQEs handed out but not yet published to the kernel
+    unsigned *m_CqHead = nullptr;
+    unsigned *m_CqTail = nullptr;
+    unsigned m_CqMask = 0;
+    io_uring_cqe *m_Cqes = nullptr;
+
+    io_uring_buf_ring *m_BufferRing = nullptr;
+    size_t m_BufferRingSize = 0;
+    unsigned m_BufferMask = 0;
+    unsigned m_BufferSize = 0;
+    std::vector<char> m_Buffers;
+
+    unsigned pendingSubmissions() const;
+    int enter(unsigned toSubmit, unsigned waitFor);
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,551 @@
+#ifdef CHESS_SERVER_BUILD
+#include "../chess_game.h"
+#include "chess-server.h"
+#include "server.h"
+#include "timer-wheel.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define LOADGEN_DEFAULT_CONNECTIONS 100
+#define LOADGEN_DEFAULT_THINK_MS 50    // Every move waits between half and one and a half times this
+#define LOADGEN_DEFAULT_DURATION_S 10
+#define LOADGEN_DEFAULT_MAX_PLIES 200  // Random games seldom end in mate, they are abandoned after this many plies
+#define LOADGEN_DEFAULT_HOST "127.0.0.1"
+#define LOADGEN_DEFAULT_PORT 12312
+#define LOADGEN_RECONNECT_DELAY_MS 100 // After a connection the server refused or dropped before pairing
+#define LOADGEN_EPOLL_EVENTS 256
+#define LOADGEN_RESUME_TIMEOUT_MS 1000 // A RESUME not answered by then has stalled the game, the run fails
+
+using namespace chess_online;
+using LoadClock = std::chrono::steady_clock;
+
+struct LoadConfig {
+    int connections = LOADGEN_DEFAULT_CONNECTIONS;
+    int thinkMs = LOADGEN_DEFAULT_THINK_MS;
+    int durationSeconds = LOADGEN_DEFAULT_DURATION_S;
+    int maxPlies = LOADGEN_DEFAULT_MAX_PLIES;
+    std::string host = LOADGEN_DEFAULT_HOST;
+    uint16_t port = LOADGEN_DEFAULT_PORT;
+    int protocol = 1;    // 2 says HELLO and sends MOVE_V2
+    bool hashes = false; // Version 2 moves carry the position hash both ways
+    int dropPercent = 0;    // Chance on each of its turns that a player drops its connection and resumes on a new one
+    int abandonPercent = 0; // Same, but it never comes back and the opponent waits out RECONNECT_GRACE_MS
+};
+
+// One simulated player. Every connection plays one game, then reconnects to be paired again
+struct LoadClient {
+    int fd = -1;
+    std::unique_ptr<ChessGame> game; // Set once paired
+    PieceColor color = WHITE;
+    uint32_t gameId = 0;             // From the SESSION frame, white moves first once it has it
+    uint64_t token = 0;              // From the same frame, sent in a RESUME after dropping the connection
+    bool resuming = false;           // Sent RESUME, the RESYNC answering it hands the turn back
+    int plies = 0;
+    LoadClock::time_point connectedAt; // Pairing time runs from here
+    LoadClock::time_point moveSentAt;
+    bool awaitingRelay = false;        // Sent a move, the server echoing it back completes it
+    TimerId timer = 0;
+    std::vector<char> in;
+    std::vector<char> out; // Whatever the socket did not take yet
+};
+
+struct LoadStats {
+    uint64_t gamesStarted = 0;
+    uint64_t gamesOver = 0; // Ended by a GAME_OVER from the server, a flag or an adjudication
+    uint64_t moves = 0;
+    uint64_t failedConnections = 0;
+    uint64_t boardMismatches = 0; // The server's board after a move differs from ours
+    uint64_t moveBytesSent = 0;     // Move frames, headers included
+    uint64_t moveBytesReceived = 0;
+    uint64_t movesReceived = 0;
+    uint64_t resumed = 0;         // Dropped connections whose RESUME was answered with the game as we had it
+    uint64_t resumesRefused = 0;  // Answered with a GAME_OVER instead
+    uint64_t resumesStalled = 0;  // Not answered at all within LOADGEN_RESUME_TIMEOUT_MS
+    uint64_t abandoned = 0;       // Players that dropped their connection and never came back
+    uint64_t abandonsAwarded = 0; // Games the server ended for the opponent of one of them
+    std::vector<double> pairingMs;
+    std::vector<double> relayUs;
+};
+
+class LoadGenerator {
+public:
+    explicit LoadGenerator(const LoadConfig &config) : m_Config(config), m_Clients(config.connections), m_Random(1) {}
+
+    bool run() {
+        if ((m_EpollFd = epoll_create1(0)) < 0) {
+            std::cerr << "Failed to create epoll" << std::endl;
+            return false;
+        }
+        m_Start = LoadClock::now();
+        for (int slot = 0; slot < m_Config.connections; slot++) {
+            connect(slot);
+        }
+        const auto end = m_Start + std::chrono::seconds(m_Config.durationSeconds);
+        epoll_event events[LOADGEN_EPOLL_EVENTS];
+        while (LoadClock::now() < end) {
+            const int ready = epoll_wait(m_EpollFd, events, LOADGEN_EPOLL_EVENTS, m_Timers.size() ? TIMER_TICK_MS : 100);
+            for (int i = 0; i < ready; i++) {
+                handleEvent(static_cast<int>(events[i].data.u32), events[i].events);
+            }
+            m_Timers.advance(currentTick());
+        }
+        const double seconds = std::chrono::duration<double>(LoadClock::now() - m_Start).count();
+        for (int slot = 0; slot < m_Config.connections; slot++) {
+            disconnect(slot);
+        }
+        close(m_EpollFd);
+        return report(seconds);
+    }
+
+private:
+    LoadConfig m_Config;
+    std::vector<LoadClient> m_Clients;
+    LoadStats m_Stats;
+    TimerWheel m_Timers;
+    std::mt19937 m_Random;
+    int m_EpollFd = -1;
+    LoadClock::time_point m_Start;
+
+    uint64_t currentTick() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(LoadClock::now() - m_Start).count() / TIMER_TICK_MS;
+    }
+
+    void after(int slot, int delayMs, TimerWheel::Callback callback) {
+        m_Clients[slot].timer = m_Timers.arm(std::max(1, delayMs / TIMER_TICK_MS), std::move(callback));
+    }
+
+    void connect(int slot) {
+        LoadClient &client = m_Clients[slot];
+        client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int noDelay = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_Config.port);
+        inet_pton(AF_INET, m_Config.host.c_str(), &address.sin_addr);
+        if (::connect(client.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 && errno != EINPROGRESS) {
+            m_Stats.failedConnections++;
+            close(client.fd);
+            client.fd = -1;
+            after(slot, LOADGEN_RECONNECT_DELAY_MS, [this, slot] { connect(slot); });
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = static_cast<uint32_t>(slot);
+        epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, client.fd, &event);
+        client.connectedAt = LoadClock::now();
+        // Sent right away, a loopback connect is done by now and otherwise flush waits for it to complete.
+        // The server reads them before its intent window closes and it pairs anyone
+        if (m_Config.protocol >= 2) {
+            const Hello hello{static_cast<uint8_t>(m_Config.protocol), static_cast<uint8_t>(m_Config.hashes ? PROTOCOL_FLAG_HASHES : 0)};
+            std::vector<char> payload(sizeof(unsigned char) + sizeof(Hello));
+            payload[0] = static_cast<char>(HELLO);
+            std::memcpy(&payload[1], &hello, sizeof(Hello));
+            queue(client, payload);
+        }
+        if (client.resuming) {
+            const ResumeRequest request{client.token};
+            std::vector<char> payload(sizeof(unsigned char) + sizeof(ResumeRequest));
+            payload[0] = static_cast<char>(RESUME);
+            std::memcpy(&payload[1], &request, sizeof(ResumeRequest));
+            queue(client, payload);
+            after(slot, LOADGEN_RESUME_TIMEOUT_MS, [this, slot] {
+                m_Clients[slot].timer = 0;
+                m_Stats.resumesStalled++;
+                reconnect(slot);
+            });
+        }
+        if (!client.out.empty() && !flush(slot)) {
+            // A refused connect, reported as an error event on the next loop turn
+            event.events = EPOLLIN | EPOLLOUT;
+            epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, client.fd, &event);
+        }
+    }
+
+    void disconnect(int slot) {
+        LoadClient &client = m_Clients[slot];
+        m_Timers.cancel(client.timer);
+        if (client.fd >= 0) {
+            close(client.fd); // Also leaves the epoll set
+        }
+        client = LoadClient();
+    }
+
+    // A finished, abandoned or broken game, or a connection that never got paired
+    void reconnect(int slot) {
+        const bool paired = m_Clients[slot].game != nullptr;
+        disconnect(slot);
+        if (paired) {
+            connect(slot);
+            return;
+        }
+        m_Stats.failedConnections++;
+        after(slot, LOADGEN_RECONNECT_DELAY_MS, [this, slot] { connect(slot); });
+    }
+
+    // On the player's turn, so nothing is in flight. Resuming keeps the game and takes the seat back on a
+    // new connection, otherwise it starts over as a new player and the opponent is left waiting
+    void drop(int slot, bool resume) {
+        LoadClient &client = m_Clients[slot];
+        std::unique_ptr<ChessGame> game = std::move(client.game);
+        const PieceColor color = client.color;
+        const uint32_t gameId = client.gameId;
+        const uint64_t token = client.token;
+        const int plies = client.plies;
+        disconnect(slot);
+        if (resume) {
+            client.game = std::move(game);
+            client.color = color;
+            client.gameId = gameId;
+            client.token = token;
+            client.plies = plies;
+            client.resuming = true;
+        } else {
+            m_Stats.abandoned++;
+        }
+        connect(slot);
+    }
+
+    void handleEvent(int slot, uint32_t events) {
+        LoadClient &client = m_Clients[slot];
+        if (events & (EPOLLHUP | EPOLLERR)) {
+            reconnect(slot);
+            return;
+        }
+        if ((events & EPOLLOUT) && !flush(slot)) {
+            reconnect(slot);
+            return;
+        }
+        if (!(events & EPOLLIN)) {
+            return;
+        }
+        char buffer[4096];
+        ssize_t received;
+        while ((received = recv(client.fd, buffer, sizeof(buffer), 0)) > 0) {
+            client.in.insert(client.in.end(), buffer, buffer + received);
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            reconnect(slot); // The opponent left or the server closed it
+            return;
+        }
+        size_t pos = 0;
+        while (client.in.size() - pos >= FRAME_HEADER_SIZE) {
+            const size_t len = static_cast<unsigned char>(client.in[pos]) << 8 | static_cast<unsigned char>(client.in[pos + 1]);
+            if (client.in.size() - pos < FRAME_HEADER_SIZE + len) {
+                break;
+            }
+            const std::vector<char> payload(client.in.begin() + pos + FRAME_HEADER_SIZE, client.in.begin() + pos + FRAME_HEADER_SIZE + len);
+            pos += FRAME_HEADER_SIZE + len;
+            if (!handleFrame(slot, payload)) {
+                reconnect(slot);
+                return;
+            }
+        }
+        client.in.erase(client.in.begin(), client.in.begin() + pos);
+    }
+
+    // False once the game is over, for whatever reason
+    bool handleFrame(int slot, const std::vector<char> &payload) {
+        LoadClient &client = m_Clients[slot];
+        if (payload.empty()) {
+            return true;
+        }
+        const unsigned char type = static_cast<unsigned char>(payload[0]);
+        if (payload.size() == 1 && type == FRAME_PING) {
+            return send(slot, {static_cast<char>(FRAME_PONG)});
+        }
+        if (!client.game && payload.size() == 1) {
+            // Paired, the only frame before a game starts is the assigned color
+            client.game = std::make_unique<ChessGame>();
+            client.color = static_cast<PieceColor>(type);
+            m_Stats.pairingMs.push_back(std::chrono::duration<double, std::milli>(LoadClock::now() - client.connectedAt).count());
+            return true;
+        }
+        if (type == SESSION && client.game && client.gameId == 0 && payload.size() == 1 + sizeof(SessionToken)) {
+            SessionToken session;
+            std::memcpy(&session, &payload[1], sizeof(SessionToken));
+            client.gameId = session.gameId;
+            client.token = session.token;
+            if (client.color == WHITE) {
+                m_Stats.gamesStarted++;
+                return scheduleMove(slot);
+            }
+            return true;
+        }
+        if (type == RESYNC && client.resuming && payload.size() >= 1 + sizeof(ResyncHeader)) {
+            // Nothing was played while we were away, it was our turn
+            ResyncHeader header;
+            std::memcpy(&header, &payload[1], sizeof(ResyncHeader));
+            client.resuming = false;
+            m_Timers.cancel(client.timer);
+            client.timer = 0;
+            if (header.gameId != client.gameId || header.color != client.color || header.positionHash != client.game->positionHash()) {
+                m_Stats.boardMismatches++;
+                return false;
+            }
+            m_Stats.resumed++;
+            return client.game->getTurn() != client.color || scheduleMove(slot);
+        }
+        if (type == GAME_OVER) {
+            m_Stats.gamesOver += client.game != nullptr;
+            m_Stats.resumesRefused += client.resuming;
+            m_Stats.abandonsAwarded += payload.size() >= 2 && static_cast<unsigned char>(payload[1]) == GAME_OVER_ABANDONED;
+            return false;
+        }
+        if (type == MOVE && client.game && payload.size() == 2 + sizeof(NetworkMove) + NUM_SQUARES + 1) {
+            countReceived(payload);
+            return applyRelay(slot, payload) && moveApplied(slot);
+        }
+        if (type == MOVE_V2 && client.game && payload.size() >= 1 + sizeof(CompactMove)) {
+            countReceived(payload);
+            return applyCompactRelay(slot, payload) && moveApplied(slot);
+        }
+        return true;
+    }
+
+    void countReceived(const std::vector<char> &payload) {
+        m_Stats.moveBytesReceived += FRAME_HEADER_SIZE + payload.size();
+        m_Stats.movesReceived++;
+    }
+
+    bool applyRelay(int slot, const std::vector<char> &payload) {
+        ChessGame &game = *m_Clients[slot].game;
+        NetworkMove networkMove;
+        std::memcpy(&networkMove, &payload[2], sizeof(NetworkMove));
+        std::shared_ptr<Piece> piece = game.getPiece(static_cast<unsigned char>(payload[1]));
+        if (!piece) {
+            m_Stats.boardMismatches++;
+            return false;
+        }
+        game.processMove(piece, game.decodeMove(networkMove));
+        std::array<unsigned char, NUM_SQUARES> board;
+        std::memcpy(board.data(), &payload[2 + sizeof(NetworkMove)], NUM_SQUARES);
+        if (board != game.serializeBoard()) {
+            m_Stats.boardMismatches++;
+            return false;
+        }
+        return true;
+    }
+
+    // Checked against the hash before it is applied, when the server sends one
+    bool applyCompactRelay(int slot, const std::vector<char> &payload) {
+        LoadClient &client = m_Clients[slot];
+        ChessGame &game = *client.game;
+        CompactMove compact;
+        std::memcpy(&compact, &payload[1], sizeof(CompactMove));
+        uint64_t hash;
+        const bool hashed = payload.size() >= 1 + sizeof(CompactMove) + sizeof(hash);
+        if (hashed) {
+            std::memcpy(&hash, &payload[1 + sizeof(CompactMove)], sizeof(hash));
+        }
+        Action action;
+        if (compact.gameId != client.gameId || (hashed && hash != game.positionHash()) || !game.findMove(compact.move, action)) {
+            m_Stats.boardMismatches++;
+            return false;
+        }
+        game.processMove(action.piece, action.move);
+        return true;
+    }
+
+    bool moveApplied(int slot) {
+        LoadClient &client = m_Clients[slot];
+        ChessGame &game = *client.game;
+        client.plies++;
+        if (client.awaitingRelay) {
+            client.awaitingRelay = false;
+            m_Stats.moves++;
+            m_Stats.relayUs.push_back(std::chrono::duration<double, std::micro>(LoadClock::now() - client.moveSentAt).count());
+        }
+        if (game.isCheckmate()) {
+            return false;
+        }
+        return game.getTurn() != client.color || scheduleMove(slot);
+    }
+
+    bool scheduleMove(int slot) {
+        // Left to a timer, the frame being handled may be followed by others for the same connection
+        const int roll = std::uniform_int_distribution<int>(0, 99)(m_Random);
+        if (roll < m_Config.dropPercent + m_Config.abandonPercent) {
+            const bool resume = roll < m_Config.dropPercent;
+            after(slot, TIMER_TICK_MS, [this, slot, resume] {
+                m_Clients[slot].timer = 0;
+                drop(slot, resume);
+            });
+            return true;
+        }
+        if (m_Config.thinkMs == 0) {
+            return makeMove(slot);
+        }
+        std::uniform_int_distribution<int> think(m_Config.thinkMs / 2, m_Config.thinkMs * 3 / 2);
+        after(slot, think(m_Random), [this, slot] {
+            m_Clients[slot].timer = 0;
+            if (!makeMove(slot)) {
+                reconnect(slot);
+            }
+        });
+        return true;
+    }
+
+    // False when the game is over instead, a stalemate or long enough
+    bool makeMove(int slot) {
+        LoadClient &client = m_Clients[slot];
+        std::vector<Action> moves = client.game->getValidMoves();
+        if (moves.empty() || client.plies >= m_Config.maxPlies) {
+            return false;
+        }
+        Action action = moves[std::uniform_int_distribution<size_t>(0, moves.size() - 1)(m_Random)];
+        auto pawn = std::dynamic_pointer_cast<Pawn>(action.piece);
+        if (pawn && !pawn->isPromoted() && pawn->canPromote(action.move)) {
+            action.move.promoteType = QUEEN;
+        }
+
+        std::vector<char> payload;
+        if (m_Config.protocol >= 2) {
+            const Move &move = action.move;
+            const CompactMove compact{client.gameId, encodeMove(posToIndex(move.src), posToIndex(move.dst), move.promoteType)};
+            payload.resize(sizeof(unsigned char) + sizeof(CompactMove));
+            payload[0] = static_cast<char>(MOVE_V2);
+            std::memcpy(&payload[1], &compact, sizeof(CompactMove));
+            if (m_Config.hashes) {
+                const uint64_t hash = client.game->positionHash();
+                const char *hashBytes = reinterpret_cast<const char *>(&hash);
+                payload.insert(payload.end(), hashBytes, hashBytes + sizeof(hash));
+            }
+        } else {
+            // The same layout ChessClient::sendMove writes
+            const NetworkMove networkMove = ChessGame::encodeNetworkMove(action.move);
+            payload.push_back(static_cast<char>(MOVE));
+            const std::array<unsigned char, NUM_SQUARES> board = client.game->serializeBoard();
+            payload.insert(payload.end(), board.begin(), board.end());
+            payload.push_back(static_cast<char>(action.piece->getPieceKey()));
+            const char *moveBytes = reinterpret_cast<const char *>(&networkMove);
+            payload.insert(payload.end(), moveBytes, moveBytes + sizeof(NetworkMove));
+        }
+
+        m_Stats.moveBytesSent += FRAME_HEADER_SIZE + payload.size();
+        client.moveSentAt = LoadClock::now();
+        client.awaitingRelay = true;
+        return send(slot, payload);
+    }
+
+    bool send(int slot, const std::vector<char> &payload) {
+        LoadClient &client = m_Clients[slot];
+        const bool idle = client.out.empty();
+        queue(client, payload);
+        return !idle || flush(slot);
+    }
+
+    static void queue(LoadClient &client, const std::vector<char> &payload) {
+        client.out.push_back(static_cast<char>(payload.size() >> 8));
+        client.out.push_back(static_cast<char>(payload.size() & 0xFF));
+        client.out.insert(client.out.end(), payload.begin(), payload.end());
+    }
+
+    bool flush(int slot) {
+        LoadClient &client = m_Clients[slot];
+        while (!client.out.empty()) {
+            const ssize_t sent = ::send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return false;
+                }
+                break;
+            }
+            client.out.erase(client.out.begin(), client.out.begin() + sent);
+        }
+        epoll_event event{};
+        event.events = client.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+        event.data.u32 = static_cast<uint32_t>(slot);
+        epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, client.fd, &event);
+        return true;
+    }
+
+    static double percentile(std::vector<double> &values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, static_cast<size_t>(values.size() * fraction))];
+    }
+
+    bool report(double seconds) {
+        std::cout << m_Config.connections << " connections, " << m_Config.thinkMs << " ms think time, " << seconds << " s, protocol "
+                  << m_Config.protocol << (m_Config.hashes ? " with hashes" : "") << std::endl;
+        std::cout << m_Stats.gamesStarted << " games, " << m_Stats.gamesOver << " ended by the server, " << m_Stats.moves << " moves, " << m_Stats.moves / seconds
+                  << " moves per second" << std::endl;
+        std::cout << "pairing: p50 " << percentile(m_Stats.pairingMs, 0.5) << " ms, p99 " << percentile(m_Stats.pairingMs, 0.99)
+                  << " ms, max " << percentile(m_Stats.pairingMs, 1.0) << " ms over " << m_Stats.pairingMs.size() << " pairings" << std::endl;
+        std::cout << "relay: p50 " << percentile(m_Stats.relayUs, 0.5) << " us, p99 " << percentile(m_Stats.relayUs, 0.99)
+                  << " us, p999 " << percentile(m_Stats.relayUs, 0.999) << " us, max " << percentile(m_Stats.relayUs, 1.0) << " us"
+                  << std::endl;
+        if (m_Stats.moves > 0 && m_Stats.movesReceived > 0) {
+            std::cout << "move frames: " << static_cast<double>(m_Stats.moveBytesSent) / m_Stats.moves << " bytes sent, "
+                      << static_cast<double>(m_Stats.moveBytesReceived) / m_Stats.movesReceived << " bytes received" << std::endl;
+        }
+        if (m_Config.dropPercent > 0 || m_Config.abandonPercent > 0) {
+            std::cout << "resumes: " << m_Stats.resumed << " resumed, " << m_Stats.resumesRefused << " refused, "
+                      << m_Stats.resumesStalled << " never answered, "
+                      << m_Stats.abandoned << " players left for good, " << m_Stats.abandonsAwarded
+                      << " games awarded to their opponents" << std::endl;
+        }
+        std::cout << m_Stats.failedConnections << " connections dropped before pairing, " << m_Stats.boardMismatches
+                  << " board mismatches" << std::endl;
+        return m_Stats.moves > 0 && m_Stats.boardMismatches == 0 && m_Stats.resumesStalled == 0;
+    }
+};
+
+// Plays random legal games against a running server and reports throughput and latency. Relay latency
+// is from sending a move to the server echoing it back, which it does right before relaying it
+int main(int argc, char *argv[]) {
+    LoadConfig config;
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--connections") == 0 && hasValue) {
+            config.connections = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--think-ms") == 0 && hasValue) {
+            config.thinkMs = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--duration") == 0 && hasValue) {
+            config.durationSeconds = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-plies") == 0 && hasValue) {
+            config.maxPlies = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--host") == 0 && hasValue) {
+            config.host = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && hasValue) {
+            config.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--protocol") == 0 && hasValue) {
+            config.protocol = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--hashes") == 0) {
+            config.hashes = true;
+        } else if (std::strcmp(argv[i], "--drop-percent") == 0 && hasValue) {
+            config.dropPercent = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--abandon-percent") == 0 && hasValue) {
+            config.abandonPercent = std::atoi(argv[++i]);
+        } else {
+            config.connections = 0;
+            break;
+        }
+    }
+    if (config.connections <= 0 || config.thinkMs < 0 || config.durationSeconds <= 0 || config.maxPlies <= 0 ||
+        config.protocol < 1 || config.protocol > PROTOCOL_VERSION || (config.hashes && config.protocol < 2) ||
+        config.dropPercent < 0 || config.abandonPercent < 0 || config.dropPercent + config.abandonPercent > 100) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--connections n] [--think-ms ms] [--duration s] [--max-plies n] [--host ip] [--port port]"
+                  << " [--protocol 1|2] [--hashes] [--drop-percent n] [--abandon-percent n]" << std::endl;
+        return 1;
+    }
+    return LoadGenerator(config).run() ? 0 : 1;
+}
+#endif
\ No newline at end of file
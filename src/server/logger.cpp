@@ -0,0 +1,143 @@
+#ifdef CHESS_SERVER_BUILD
+#include "logger.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace chess_online {
+namespace {
+const char *levelName(int level) {
+    switch (level) {
+    case LOG_LEVEL_DEBUG:
+        return "DEBUG";
+    case LOG_LEVEL_INFO:
+        return "INFO ";
+    case LOG_LEVEL_WARN:
+        return "WARN ";
+    default:
+        return "ERROR";
+    }
+}
+} // namespace
+
+Logger &Logger::instance() {
+    // Leaked, threads that are still running at exit may log into their rings until the very end
+    static Logger *logger = new Logger();
+    return *logger;
+}
+
+Logger::Logger() : m_Start(std::chrono::steady_clock::now()) {
+    m_Writer = std::thread(&Logger::writerLoop, this);
+    std::atexit([] {
+        instance().shutdown();
+    });
+}
+
+Logger::RingOwner::RingOwner() : ring(Logger::instance().addRing()) {}
+
+Logger::RingOwner::~RingOwner() {
+    ring->retired.store(true, std::memory_order_release);
+}
+
+Logger::Ring &Logger::threadRing() {
+    static thread_local RingOwner owner;
+    return *owner.ring;
+}
+
+Logger::Ring *Logger::addRing() {
+    std::scoped_lock lock(m_RingsMutex);
+    m_Rings.push_back(std::make_unique<Ring>());
+    return m_Rings.back().get();
+}
+
+void Logger::writerLoop() {
+    while (!m_Stopping.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+    }
+}
+
+void Logger::shutdown() {
+    m_Stopping.store(true, std::memory_order_release);
+    if (m_Writer.joinable()) {
+        m_Writer.join();
+    }
+    drain();
+}
+
+size_t Logger::drain() {
+    m_Batch.clear();
+    uint64_t dropped = 0;
+    {
+        std::scoped_lock lock(m_RingsMutex);
+        for (auto it = m_Rings.begin(); it != m_Rings.end();) {
+            Ring &ring = **it;
+            // Read before the head, so a retired ring found empty has nothing more coming
+            const bool retired = ring.retired.load(std::memory_order_acquire);
+            const uint64_t head = ring.head.load(std::memory_order_acquire);
+            for (uint64_t tail = ring.tail.load(std::memory_order_relaxed); tail != head; tail++) {
+                m_Batch.push_back(ring.records[tail & (LOG_RING_RECORDS - 1)]);
+            }
+            ring.tail.store(head, std::memory_order_release);
+            dropped += ring.dropped.exchange(0, std::memory_order_relaxed);
+            it = retired ? m_Rings.erase(it) : it + 1;
+        }
+    }
+    if (m_Batch.empty() && dropped == 0) {
+        return 0;
+    }
+
+    // Every ring is in order on its own, merged they are only roughly so
+    std::stable_sort(m_Batch.begin(), m_Batch.end(), [](const LogRecord &a, const LogRecord &b) {
+        return a.nanoseconds < b.nanoseconds;
+    });
+    m_Output.clear();
+    for (const LogRecord &record : m_Batch) {
+        format(record);
+    }
+    if (dropped > 0) {
+        m_Output += "Log rings were full, dropped " + std::to_string(dropped) + " records\n";
+    }
+    std::fwrite(m_Output.data(), 1, m_Output.size(), stdout);
+    std::fflush(stdout);
+    return m_Batch.size();
+}
+
+void Logger::format(const LogRecord &record) {
+    char number[64];
+    std::snprintf(number, sizeof(number), "[%12.6f] %s ", static_cast<double>(record.nanoseconds) / 1e9, levelName(record.level));
+    m_Output += number;
+    int argument = 0;
+    for (const char *c = record.format; *c; c++) {
+        if (c[0] != '{' || c[1] != '}' || argument == record.numArgs) {
+            m_Output += *c;
+            continue;
+        }
+        const uint64_t value = record.values[argument];
+        switch (record.types[argument++]) {
+        case LOG_ARG_INT:
+            m_Output += std::to_string(static_cast<int64_t>(value));
+            break;
+        case LOG_ARG_UINT:
+            m_Output += std::to_string(value);
+            break;
+        case LOG_ARG_DOUBLE: {
+            double real;
+            std::memcpy(&real, &value, sizeof(real));
+            std::snprintf(number, sizeof(number), "%g", real);
+            m_Output += number;
+            break;
+        }
+        case LOG_ARG_CHAR:
+            m_Output += static_cast<char>(value);
+            break;
+        case LOG_ARG_TEXT:
+            m_Output.append(record.text + (value >> 32), value & 0xFFFFFFFF);
+            break;
+        }
+        c++;
+    }
+    m_Output += '\n';
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#ifndef LOG_MIN_LEVEL
+#ifdef DEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+#define LOG_RING_RECORDS 1024    // Per thread, a power of two. Records logged while it is full are dropped
+#define LOG_MAX_ARGS 6           // Further arguments are ignored
+#define LOG_TEXT_BYTES 48        // Room for string arguments in a record, longer ones are truncated
+#define LOG_FLUSH_INTERVAL_MS 5  // How long the writer sleeps when every ring is empty
+
+// `{}` in the format is replaced by the next argument. The format must be a string literal, it is
+// formatted later by the writer thread. Levels below LOG_MIN_LEVEL compile to nothing, arguments included
+#define LOG_AT(level, ...)                                                   \
+    do {                                                                     \
+        if constexpr ((level) >= LOG_MIN_LEVEL) {                            \
+            ::chess_online::Logger::instance().log((level), __VA_ARGS__);    \
+        }                                                                    \
+    } while (0)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+namespace chess_online {
+
+enum LogArgumentType : uint8_t {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_CHAR,
+    LOG_ARG_TEXT // Offset into the record's text in the upper half, length in the lower
+};
+
+// What a log call leaves in its thread's ring, nothing is formatted on the calling thread
+struct LogRecord {
+    uint64_t nanoseconds; // Since the logger started
+    const char *format;
+    uint8_t level;
+    uint8_t numArgs;
+    uint8_t textUsed;
+    std::array<uint8_t, LOG_MAX_ARGS> types;
+    uint64_t values[LOG_MAX_ARGS];
+    char text[LOG_TEXT_BYTES];
+};
+static_assert(sizeof(LogRecord) == 128, "Two cache lines per record");
+
+// Every thread that logs gets a single producer, single consumer ring of records the first time it
+// does. Logging is a few stores and a release, there are no locks and no system calls. A writer thread
+// drains all rings, orders the records by time, formats them and writes them out in one go
+class Logger {
+public:
+    static Logger &instance(); // Never destroyed, whatever is left is written out at exit
+
+    template <size_t N, typename... Args>
+    void log(int level, const char (&format)[N], const Args &...args) {
+        Ring &ring = threadRing();
+        const uint64_t head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) == LOG_RING_RECORDS) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogRecord &record = ring.records[head & (LOG_RING_RECORDS - 1)];
+        record.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+        record.format = format;
+        record.level = static_cast<uint8_t>(level);
+        record.numArgs = 0;
+        record.textUsed = 0;
+        (encode(record, args), ...);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    struct Ring {
+        std::array<LogRecord, LOG_RING_RECORDS> records;
+        alignas(64) std::atomic<uint64_t> head{0}; // Only the owning thread moves it
+        alignas(64) std::atomic<uint64_t> tail{0}; // Only the writer moves it
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false}; // The owning thread exited, freed once drained
+    };
+    struct RingOwner {
+        Ring *ring;
+        RingOwner();
+        ~RingOwner();
+    };
+
+    std::chrono::steady_clock::time_point m_Start;
+    std::mutex m_RingsMutex; // Taken when a thread logs for the first time and by the writer, never by log()
+    std::vector<std::unique_ptr<Ring>> m_Rings;
+    std::vector<LogRecord> m_Batch; // Only touched by the writer
+    std::string m_Output;
+    std::atomic<bool> m_Stopping{false};
+    std::thread m_Writer;
+
+    Logger();
+    static Ring &threadRing();
+    Ring *addRing();
+    void writerLoop();
+    size_t drain();
+    void shutdown();
+    void format(const LogRecord &record);
+
+    template <typename T>
+    static void encode(LogRecord &record, const T &value) {
+        if (record.numArgs == LOG_MAX_ARGS) {
+            return;
+        }
+        uint8_t &type = record.types[record.numArgs];
+        uint64_t &slot = record.values[record.numArgs++];
+        if constexpr (std::is_same_v<T, char>) {
+            type = LOG_ARG_CHAR;
+            slot = static_cast<unsigned char>(value);
+        } else if constexpr (std::is_enum_v<T>) {
+            type = LOG_ARG_INT;
+            slot = static_cast<uint64_t>(static_cast<int64_t>(value));
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            type = LOG_ARG_INT;
+            slot = static_cast<uint64_t>(static_cast<int64_t>(value));
+        } else if constexpr (std::is_integral_v<T>) {
+            type = LOG_ARG_UINT;
+            slot = static_cast<uint64_t>(value);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            type = LOG_ARG_DOUBLE;
+            const double number = value;
+            std::memcpy(&slot, &number, sizeof(slot));
+        } else {
+            const std::string_view text(value);
+            const size_t len = std::min<size_t>(text.size(), LOG_TEXT_BYTES - record.textUsed);
+            std::memcpy(record.text + record.textUsed, text.data(), len);
+            type = LOG_ARG_TEXT;
+            slot = static_cast<uint64_t>(record.textUsed) << 32 | len;
+            record.textUsed += static_cast<uint8_t>(len);
+        }
+    }
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
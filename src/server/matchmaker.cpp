@@ -0,0 +1,132 @@
+#ifdef CHESS_SERVER_BUILD
+#include "matchmaker.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace chess_online {
+void Matchmaker::offer(const MatchTicket &ticket, MatchClock::time_point now, std::vector<MatchPair> &pairs) {
+    std::scoped_lock lock(m_Mutex);
+    auto existing = m_Waiting.find(ticket.fd);
+    if (existing != m_Waiting.end()) {
+        remove(existing->second); // Left by whoever had this fd before
+    }
+    WaitingEntry *opponent = findOpponent(ticket, m_Window.initial, now, nullptr);
+    if (opponent) {
+        pairs.push_back({opponent->ticket, ticket});
+        remove(opponent);
+    } else {
+        insert(ticket, now);
+    }
+    if (now - m_LastRematch >= std::chrono::milliseconds(MATCH_REMATCH_INTERVAL_MS)) {
+        rematchLocked(now, pairs);
+    }
+}
+
+void Matchmaker::rematch(MatchClock::time_point now, std::vector<MatchPair> &pairs) {
+    std::scoped_lock lock(m_Mutex);
+    rematchLocked(now, pairs);
+}
+
+bool Matchmaker::cancel(const MatchTicket &ticket) {
+    std::scoped_lock lock(m_Mutex);
+    auto existing = m_Waiting.find(ticket.fd);
+    if (existing == m_Waiting.end() || existing->second->ticket.generation != ticket.generation) {
+        return false;
+    }
+    remove(existing->second);
+    return true;
+}
+
+size_t Matchmaker::waiting() {
+    std::scoped_lock lock(m_Mutex);
+    return m_Waiting.size();
+}
+
+int Matchmaker::bucketOf(int rating) {
+    return std::clamp(rating, 0, MATCH_RATING_MAX - 1) / MATCH_BUCKET_WIDTH;
+}
+
+int Matchmaker::window(const WaitingEntry &entry, MatchClock::time_point now) const {
+    const auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.since).count();
+    return static_cast<int>(std::min<int64_t>(MATCH_RATING_MAX, m_Window.initial + waited * m_Window.growthPerSecond / 1000));
+}
+
+Matchmaker::WaitingEntry *Matchmaker::findOpponent(const MatchTicket &ticket, int ticketWindow, MatchClock::time_point now,
+                                                   const WaitingEntry *exclude) {
+    const int center = bucketOf(ticket.rating);
+    WaitingEntry *best = nullptr;
+    int bestDifference = 0;
+    // Outwards from the ticket's own bucket, a long waiter far away may still accept it
+    for (int distance = 0; distance < MATCH_NUM_BUCKETS; distance++) {
+        if (best && (distance - 1) * MATCH_BUCKET_WIDTH > bestDifference) {
+            break; // Everyone further out is further away in rating than the best found
+        }
+        for (int bucket : {center - distance, center + distance}) {
+            if (bucket < 0 || bucket >= MATCH_NUM_BUCKETS) {
+                continue;
+            }
+            for (WaitingEntry *entry = m_Buckets[bucket].head; entry; entry = entry->next) {
+                const int difference = std::abs(entry->ticket.rating - ticket.rating);
+                if (entry == exclude || difference > std::max(ticketWindow, window(*entry, now))) {
+                    continue;
+                }
+                // Buckets are oldest first, so of two equally close opponents the one waiting longer wins
+                if (!best || difference < bestDifference) {
+                    best = entry;
+                    bestDifference = difference;
+                }
+            }
+            if (distance == 0) {
+                break; // Both sides are the same bucket
+            }
+        }
+    }
+    return best;
+}
+
+void Matchmaker::insert(const MatchTicket &ticket, MatchClock::time_point since) {
+    WaitingEntry *entry;
+    if (m_FreeEntries.empty()) {
+        entry = &m_Entries.emplace_back();
+    } else {
+        entry = m_FreeEntries.back();
+        m_FreeEntries.pop_back();
+    }
+    entry->ticket = ticket;
+    entry->since = since;
+    Bucket &bucket = m_Buckets[bucketOf(ticket.rating)];
+    entry->previous = bucket.tail;
+    entry->next = nullptr;
+    (bucket.tail ? bucket.tail->next : bucket.head) = entry;
+    bucket.tail = entry;
+    m_Waiting[ticket.fd] = entry;
+}
+
+void Matchmaker::remove(WaitingEntry *entry) {
+    Bucket &bucket = m_Buckets[bucketOf(entry->ticket.rating)];
+    (entry->previous ? entry->previous->next : bucket.head) = entry->next;
+    (entry->next ? entry->next->previous : bucket.tail) = entry->previous;
+    m_Waiting.erase(entry->ticket.fd);
+    m_FreeEntries.push_back(entry);
+}
+
+void Matchmaker::rematchLocked(MatchClock::time_point now, std::vector<MatchPair> &pairs) {
+    m_LastRematch = now;
+    for (int bucket = 0; bucket < MATCH_NUM_BUCKETS; bucket++) {
+        WaitingEntry *entry = m_Buckets[bucket].head;
+        while (entry) {
+            WaitingEntry *opponent = findOpponent(entry->ticket, window(*entry, now), now, entry);
+            if (!opponent) {
+                entry = entry->next;
+                continue;
+            }
+            const bool entryFirst = entry->since <= opponent->since;
+            pairs.push_back({entryFirst ? entry->ticket : opponent->ticket, entryFirst ? opponent->ticket : entry->ticket});
+            remove(entry);
+            remove(opponent);
+            entry = m_Buckets[bucket].head; // The opponent may have been next in this bucket
+        }
+    }
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
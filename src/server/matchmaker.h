@@ -0,0 +1,93 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define MATCH_DEFAULT_RATING 1500
+#define MATCH_RATING_MAX 4000
+#define MATCH_BUCKET_WIDTH 50
+#define MATCH_NUM_BUCKETS (MATCH_RATING_MAX / MATCH_BUCKET_WIDTH)
+#define MATCH_INITIAL_WINDOW 100          // Rating difference accepted straight away
+#define MATCH_WINDOW_GROWTH_PER_SECOND 100 // After long enough anyone is accepted
+#define MATCH_REMATCH_INTERVAL_MS 250      // How often offers also pair up clients whose windows have grown
+
+namespace chess_online {
+
+using MatchClock = std::chrono::steady_clock;
+
+// A client waiting for a game. The generation tells a reused fd apart from the client that left
+struct MatchTicket {
+    int fd = -1;
+    uint32_t generation = 0;
+    int rating = MATCH_DEFAULT_RATING;
+};
+
+// How far apart in rating two clients may be, the longer they wait the wider
+struct MatchWindow {
+    int initial = MATCH_INITIAL_WINDOW;
+    int growthPerSecond = MATCH_WINDOW_GROWTH_PER_SECOND;
+};
+
+struct MatchPair {
+    MatchTicket white; // Whoever waited longer
+    MatchTicket black;
+};
+
+// Pairs clients of similar rating. Waiting clients sit in buckets of MATCH_BUCKET_WIDTH rating points,
+// oldest first, and a client accepts any opponent within its window, which widens the longer it
+// waits. Two clients pair when either one accepts the other. Finding an opponent only looks at the
+// buckets the window covers and scans each of them. That scan stays short however many clients are
+// waiting: two clients of the same rating always accept each other, so a bucket never holds more
+// than MATCH_BUCKET_WIDTH of them, and with the default window never more than one.
+// Everything is done under one mutex. The lock-free single slot this replaced could only pair
+// whoever came next, which stopped being enough once ratings had to be compared, and one short
+// critical section per arriving client is far below the rate clients connect at.
+// A waiting client that disconnects is not removed, whoever pairs with it next finds it gone
+class Matchmaker {
+public:
+    explicit Matchmaker(MatchWindow window = {}) : m_Window(window) {}
+    Matchmaker(const Matchmaker &) = delete;
+    Matchmaker &operator=(const Matchmaker &) = delete;
+
+    // Appends the pairs this made, the ticket's own if someone acceptable was waiting
+    void offer(const MatchTicket &ticket, MatchClock::time_point now, std::vector<MatchPair> &pairs);
+    void rematch(MatchClock::time_point now, std::vector<MatchPair> &pairs); // Pairs up clients whose windows have grown
+    bool cancel(const MatchTicket &ticket); // False if the ticket was not waiting, it may just have been paired
+    size_t waiting();
+
+private:
+    struct WaitingEntry {
+        MatchTicket ticket;
+        MatchClock::time_point since;
+        WaitingEntry *previous = nullptr;
+        WaitingEntry *next = nullptr;
+    };
+    struct Bucket {
+        WaitingEntry *head = nullptr; // Oldest
+        WaitingEntry *tail = nullptr;
+    };
+
+    MatchWindow m_Window;
+    std::mutex m_Mutex;
+    std::array<Bucket, MATCH_NUM_BUCKETS> m_Buckets;
+    std::unordered_map<int, WaitingEntry *> m_Waiting; // By fd, for cancelling
+    std::deque<WaitingEntry> m_Entries;                // Never shrinks, unused entries are on the free list
+    std::vector<WaitingEntry *> m_FreeEntries;
+    MatchClock::time_point m_LastRematch;
+
+    static int bucketOf(int rating);
+    int window(const WaitingEntry &entry, MatchClock::time_point now) const;
+    WaitingEntry *findOpponent(const MatchTicket &ticket, int ticketWindow, MatchClock::time_point now,
+                               const WaitingEntry *exclude);
+    void insert(const MatchTicket &ticket, MatchClock::time_point since);
+    void remove(WaitingEntry *entry);
+    void rematchLocked(MatchClock::time_point now, std::vector<MatchPair> &pairs);
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
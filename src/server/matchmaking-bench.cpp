@@ -0,0 +1,129 @@
+#ifdef CHESS_SERVER_BUILD
+#include "matchmaker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define BENCH_DEFAULT_TICKETS 1000000
+#define BENCH_RATING_MEAN 1500.0
+#define BENCH_RATING_DEVIATION 350.0
+#define BENCH_ARRIVAL_SPACING_US 100 // Simulated time between arrivals, 10k clients per second
+#define BENCH_CROWDED_OFFERS 10000   // Timed after the matchmaker is filled
+
+using namespace chess_online;
+
+static int randomRating(std::mt19937 &random) {
+    std::normal_distribution<double> ratings(BENCH_RATING_MEAN, BENCH_RATING_DEVIATION);
+    return std::clamp(static_cast<int>(ratings(random)), 0, MATCH_RATING_MAX - 1);
+}
+
+// Every thread offers its own stream of tickets the way the server's workers do on accept
+static bool throughput(int numThreads, int ticketsPerThread) {
+    Matchmaker matchmaker;
+    std::atomic<uint64_t> pairs{0};
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 random(t);
+            std::vector<MatchPair> made;
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < ticketsPerThread; i++) {
+                matchmaker.offer({t * ticketsPerThread + i, 1, randomRating(random)}, MatchClock::now(), made);
+            }
+            pairs.fetch_add(made.size(), std::memory_order_relaxed);
+        });
+    }
+
+    auto begin = MatchClock::now();
+    start.store(true, std::memory_order_release);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(MatchClock::now() - begin).count();
+
+    uint64_t offered = static_cast<uint64_t>(numThreads) * ticketsPerThread;
+    std::cout << numThreads << " threads offered " << offered << " clients and made " << pairs.load() << " pairs in "
+              << seconds * 1000.0 << " ms, " << static_cast<uint64_t>(offered / seconds) << " clients per second, "
+              << matchmaker.waiting() << " left waiting" << std::endl;
+    return pairs.load() * 2 + matchmaker.waiting() == offered;
+}
+
+// Offer latency with `count` clients arriving, on a simulated clock so waiting windows widen as they
+// would at that arrival rate
+static bool latency(int count) {
+    Matchmaker matchmaker;
+    std::mt19937 random(count);
+    std::vector<MatchPair> pairs;
+    std::vector<double> nanoseconds(count);
+    size_t peakWaiting = 0;
+    MatchClock::time_point now = MatchClock::now();
+    for (int i = 0; i < count; i++) {
+        now += std::chrono::microseconds(BENCH_ARRIVAL_SPACING_US);
+        const MatchTicket ticket{i, 1, randomRating(random)};
+        auto begin = std::chrono::steady_clock::now();
+        matchmaker.offer(ticket, now, pairs);
+        nanoseconds[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        peakWaiting = std::max(peakWaiting, matchmaker.waiting());
+    }
+    std::sort(nanoseconds.begin(), nanoseconds.end());
+    std::cout << count << " clients: p50 " << nanoseconds[count / 2] << " ns, p99 " << nanoseconds[count * 99 / 100]
+              << " ns, max " << nanoseconds.back() << " ns, " << pairs.size() << " pairs, at most " << peakWaiting
+              << " waiting" << std::endl;
+    return pairs.size() * 2 + matchmaker.waiting() == static_cast<size_t>(count);
+}
+
+// Offer latency once `count` clients with no slack at all have been offered first, so as many are
+// waiting as the ratings allow and every bucket is as long as it can get
+static bool crowded(int count) {
+    Matchmaker matchmaker(MatchWindow{0, 0});
+    std::mt19937 random(count);
+    std::vector<MatchPair> pairs;
+    MatchClock::time_point now = MatchClock::now();
+    for (int i = 0; i < count; i++) {
+        matchmaker.offer({i, 1, randomRating(random)}, now, pairs);
+    }
+    const size_t filled = matchmaker.waiting();
+
+    std::vector<double> nanoseconds(BENCH_CROWDED_OFFERS);
+    for (int i = 0; i < BENCH_CROWDED_OFFERS; i++) {
+        // Uniform, so the sparse buckets far from the mean are hit as often as the full ones
+        const MatchTicket ticket{count + i, 1, static_cast<int>(random() % MATCH_RATING_MAX)};
+        auto begin = std::chrono::steady_clock::now();
+        matchmaker.offer(ticket, now, pairs);
+        nanoseconds[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    }
+    std::sort(nanoseconds.begin(), nanoseconds.end());
+    std::cout << count << " clients with narrow windows left " << filled << " waiting, then " << BENCH_CROWDED_OFFERS
+              << " more: p50 " << nanoseconds[BENCH_CROWDED_OFFERS / 2] << " ns, p99 "
+              << nanoseconds[BENCH_CROWDED_OFFERS * 99 / 100] << " ns, max " << nanoseconds.back() << " ns" << std::endl;
+    return pairs.size() * 2 + matchmaker.waiting() == static_cast<size_t>(count + BENCH_CROWDED_OFFERS);
+}
+
+// Measures how many clients per second the matchmaker pairs and how long one pairing takes as the
+// number of arriving clients grows
+int main(int argc, char *argv[]) {
+    int numThreads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::max(2U, std::thread::hardware_concurrency()));
+    int ticketsPerThread = argc > 2 ? std::atoi(argv[2]) : BENCH_DEFAULT_TICKETS;
+    if (numThreads <= 0 || ticketsPerThread <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [threads] [tickets per thread]" << std::endl;
+        return 1;
+    }
+    bool consistent = throughput(numThreads, ticketsPerThread);
+    for (int count : {1000, 10000, 100000}) {
+        consistent = latency(count) && consistent;
+    }
+    for (int count : {1000, 10000, 100000}) {
+        consistent = crowded(count) && consistent;
+    }
+    // Every offered client is either paired or still waiting
+    return consistent ? 0 : 1;
+}
+#endif
\ No newline at end of file
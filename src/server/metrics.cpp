@@ -0,0 +1,162 @@
+#ifdef CHESS_SERVER_BUILD
+#include "metrics.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace chess_online {
+namespace {
+const char *const COUNTER_NAMES[NUM_METRIC_COUNTERS] = {
+    "connections_opened", "connections_closed", "bytes_in", "bytes_out", "frames_in", "frames_out",
+    "frames_skipped", "moves_validated", "moves_rejected", "games_started", "games_ended"};
+const char *const HISTOGRAM_NAMES[NUM_METRIC_HISTOGRAMS] = {"recv_to_relay", "validation"};
+} // namespace
+
+std::atomic<Metrics::Shard *> Metrics::s_Shards{nullptr};
+
+Metrics::Shard &Metrics::threadShard() {
+    static thread_local Shard *shard = [] {
+        Shard *created = new Shard();
+        created->next = s_Shards.load(std::memory_order_relaxed);
+        while (!s_Shards.compare_exchange_weak(created->next, created, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return created;
+    }();
+    return *shard;
+}
+
+// Values below METRICS_SUB_BUCKETS get a bucket each, above that every power of two is split into
+// METRICS_SUB_BUCKETS equal parts
+size_t Metrics::bucketOf(uint64_t value) {
+    value = std::min<uint64_t>(value, (1ULL << METRICS_VALUE_BITS) - 1);
+    if (value < METRICS_SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    const int shift = 63 - __builtin_clzll(value) - METRICS_SUB_BUCKET_BITS;
+    return static_cast<size_t>(shift + 1) * METRICS_SUB_BUCKETS + static_cast<size_t>((value >> shift) - METRICS_SUB_BUCKETS);
+}
+
+uint64_t Metrics::bucketUpperBound(size_t bucket) {
+    if (bucket < METRICS_SUB_BUCKETS) {
+        return bucket;
+    }
+    const int shift = static_cast<int>(bucket / METRICS_SUB_BUCKETS) - 1;
+    return ((METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+void Metrics::record(MetricHistogram histogram, std::chrono::steady_clock::duration elapsed) {
+    const uint64_t nanoseconds = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    Shard &shard = threadShard();
+    std::atomic<uint64_t> &bucket = shard.buckets[histogram][bucketOf(nanoseconds)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic<uint64_t> &sum = shard.sums[histogram];
+    sum.store(sum.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+}
+
+MetricsSnapshot Metrics::snapshot() {
+    MetricsSnapshot snapshot;
+    for (Shard *shard = s_Shards.load(std::memory_order_acquire); shard; shard = shard->next) {
+        for (int counter = 0; counter < NUM_METRIC_COUNTERS; counter++) {
+            snapshot.counters[counter] += shard->counters[counter].load(std::memory_order_relaxed);
+        }
+        for (int histogram = 0; histogram < NUM_METRIC_HISTOGRAMS; histogram++) {
+            HistogramSnapshot &total = snapshot.histograms[histogram];
+            for (size_t bucket = 0; bucket < METRICS_NUM_BUCKETS; bucket++) {
+                const uint64_t count = shard->buckets[histogram][bucket].load(std::memory_order_relaxed);
+                total.buckets[bucket] += count;
+                total.count += count;
+            }
+            total.sum += shard->sums[histogram].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+uint64_t HistogramSnapshot::percentile(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < METRICS_NUM_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return Metrics::bucketUpperBound(bucket);
+        }
+    }
+    return max();
+}
+
+uint64_t HistogramSnapshot::max() const {
+    for (size_t bucket = METRICS_NUM_BUCKETS; bucket-- > 0;) {
+        if (buckets[bucket] > 0) {
+            return Metrics::bucketUpperBound(bucket);
+        }
+    }
+    return 0;
+}
+
+// One `name value` per line, latencies in microseconds
+std::string Metrics::format(const MetricsSnapshot &snapshot) {
+    std::ostringstream out;
+    for (int counter = 0; counter < NUM_METRIC_COUNTERS; counter++) {
+        out << COUNTER_NAMES[counter] << " " << snapshot.counters[counter] << "\n";
+    }
+    // Shards are read one after another, a close can be counted before the open it belongs to
+    const auto active = [&snapshot](MetricCounter opened, MetricCounter closed) {
+        return std::max<int64_t>(0, static_cast<int64_t>(snapshot.counters[opened] - snapshot.counters[closed]));
+    };
+    out << "connections_active " << active(METRIC_CONNECTIONS_OPENED, METRIC_CONNECTIONS_CLOSED) << "\n";
+    out << "games_active " << active(METRIC_GAMES_STARTED, METRIC_GAMES_ENDED) << "\n";
+    for (int histogram = 0; histogram < NUM_METRIC_HISTOGRAMS; histogram++) {
+        const HistogramSnapshot &values = snapshot.histograms[histogram];
+        const std::string name = HISTOGRAM_NAMES[histogram];
+        out << name << "_count " << values.count << "\n";
+        out << name << "_mean_us " << (values.count ? values.sum / 1000.0 / values.count : 0.0) << "\n";
+        for (const auto &[label, fraction] : {std::pair{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}}) {
+            out << name << "_" << label << "_us " << values.percentile(fraction) / 1000.0 << "\n";
+        }
+        out << name << "_max_us " << values.max() / 1000.0 << "\n";
+    }
+    return out.str();
+}
+
+MetricsDumper::MetricsDumper(const std::string &path, uint32_t intervalMs)
+    : m_Path(path), m_IntervalMs(intervalMs), m_Start(std::chrono::steady_clock::now()), m_Thread(&MetricsDumper::dumpLoop, this) {}
+
+MetricsDumper::~MetricsDumper() {
+    {
+        std::scoped_lock lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Condition.notify_one();
+    m_Thread.join();
+}
+
+void MetricsDumper::dumpLoop() {
+    std::unique_lock lock(m_Mutex);
+    while (!m_Condition.wait_for(lock, std::chrono::milliseconds(m_IntervalMs), [this] { return m_Stopping; })) {
+        dump();
+    }
+}
+
+void MetricsDumper::dump() {
+    // Readers never see a half written file
+    const std::string temporaryPath = m_Path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::trunc);
+        file << "uptime_seconds " << std::chrono::duration<double>(std::chrono::steady_clock::now() - m_Start).count() << "\n"
+             << Metrics::format(Metrics::snapshot());
+        if (!file) {
+            LOG_ERROR("Failed to write metrics: {}", temporaryPath);
+            return;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), m_Path.c_str()) != 0) {
+        LOG_ERROR("Failed to replace metrics: {}", m_Path);
+    }
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
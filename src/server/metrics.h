@@ -0,0 +1,105 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define METRICS_DUMP_PATH "metrics.txt"
+#define METRICS_DUMP_INTERVAL_MS 10000
+#define METRICS_SUB_BUCKET_BITS 4 // 16 buckets per power of two, a value is reported within 1/16 of itself
+#define METRICS_SUB_BUCKETS (1U << METRICS_SUB_BUCKET_BITS)
+#define METRICS_VALUE_BITS 40     // Nanoseconds up to about 18 minutes, longer ones count as that
+#define METRICS_NUM_BUCKETS ((METRICS_VALUE_BITS - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+namespace chess_online {
+
+enum MetricCounter {
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_FRAMES_IN,
+    METRIC_FRAMES_OUT,
+    METRIC_FRAMES_SKIPPED, // Broadcast to a lagging recipient and dropped
+    METRIC_MOVES_VALIDATED,
+    METRIC_MOVES_REJECTED,
+    METRIC_GAMES_STARTED,
+    METRIC_GAMES_ENDED,
+    NUM_METRIC_COUNTERS
+};
+
+enum MetricHistogram {
+    HISTOGRAM_RECV_TO_RELAY, // From handling a move's frame to the relay being queued for the opponent
+    HISTOGRAM_VALIDATION,    // Checking the board and applying the move
+    NUM_METRIC_HISTOGRAMS
+};
+
+struct HistogramSnapshot {
+    std::array<uint64_t, METRICS_NUM_BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t percentile(double fraction) const; // Upper end of the bucket holding it
+    uint64_t max() const;
+};
+
+struct MetricsSnapshot {
+    std::array<uint64_t, NUM_METRIC_COUNTERS> counters{};
+    std::array<HistogramSnapshot, NUM_METRIC_HISTOGRAMS> histograms;
+};
+
+// Counters and log-linear latency histograms, in the style of HdrHistogram. Every thread that records
+// gets its own shard the first time it does, which only it writes to, with plain stores. Shards are
+// never freed and are summed by whoever takes a snapshot, neither side takes a lock
+class Metrics {
+public:
+    static void add(MetricCounter counter, uint64_t amount = 1) {
+        std::atomic<uint64_t> &value = threadShard().counters[counter];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    static void record(MetricHistogram histogram, std::chrono::steady_clock::duration elapsed);
+    static MetricsSnapshot snapshot();
+    static std::string format(const MetricsSnapshot &snapshot);
+
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, NUM_METRIC_COUNTERS> counters{};
+        std::array<std::array<std::atomic<uint64_t>, METRICS_NUM_BUCKETS>, NUM_METRIC_HISTOGRAMS> buckets{};
+        std::array<std::atomic<uint64_t>, NUM_METRIC_HISTOGRAMS> sums{};
+        Shard *next = nullptr;
+    };
+
+    static std::atomic<Shard *> s_Shards; // Pushed onto, never removed from
+    static Shard &threadShard();
+};
+
+// Writes a snapshot to a file every interval, replacing the previous one in one rename
+class MetricsDumper {
+public:
+    explicit MetricsDumper(const std::string &path = METRICS_DUMP_PATH, uint32_t intervalMs = METRICS_DUMP_INTERVAL_MS);
+    ~MetricsDumper();
+    MetricsDumper(const MetricsDumper &) = delete;
+    MetricsDumper &operator=(const MetricsDumper &) = delete;
+
+private:
+    std::string m_Path;
+    uint32_t m_IntervalMs;
+    std::chrono::steady_clock::time_point m_Start;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_Stopping = false;
+    std::thread m_Thread;
+
+    void dumpLoop();
+    void dump();
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#ifdef CHESS_SERVER_BUILD
+#include "opening-book.h"
+#include "logger.h"
+#include <endian.h>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace chess_online {
+
+namespace {
+// Polyglot promotion codes, indexed by PieceType
+const uint16_t BOOK_PROMOTIONS[7] = {0, 0, 3, 1, 2, 4, 0};
+const PieceType BOOK_PROMOTION_TYPES[5] = {NONE, KNIGHT, BISHOP, ROOK, QUEEN};
+
+bool isCastling(const EngineBoard &board, int src, int dst) {
+    return enginePieceType(board.pieceAt(src)) == KING && std::abs(dst - src) == 2;
+}
+
+// Polyglot rows count up from white's side and castling is written as king takes rook
+uint16_t toBookMove(const EngineBoard &board, EncodedMove move) {
+    int src = encodedMoveSrc(move);
+    int dst = encodedMoveDst(move);
+    if (isCastling(board, src, dst)) {
+        dst = dst > src ? src + 3 : src - 4;
+    }
+    return static_cast<uint16_t>((dst % 8) | ((7 - dst / 8) << 3) | ((src % 8) << 6) | ((7 - src / 8) << 9) |
+                                 (BOOK_PROMOTIONS[encodedMovePromoteType(move)] << 12));
+}
+
+EncodedMove fromBookMove(const EngineBoard &board, uint16_t bookMove) {
+    int dst = (7 - ((bookMove >> 3) & 7)) * 8 + (bookMove & 7);
+    int src = (7 - ((bookMove >> 9) & 7)) * 8 + ((bookMove >> 6) & 7);
+    int promotion = (bookMove >> 12) & 7;
+    EnginePiece piece = board.pieceAt(src);
+    if (enginePieceType(piece) == KING && board.pieceAt(dst) == makeEnginePiece(ROOK, enginePieceColor(piece))) {
+        dst = dst > src ? src + 2 : src - 2;
+    }
+    return encodeMove(src, dst, promotion < 5 ? BOOK_PROMOTION_TYPES[promotion] : NONE);
+}
+} // namespace
+
+OpeningBook::~OpeningBook() {
+    if (m_Entries) {
+        munmap(const_cast<Entry *>(m_Entries), m_MappedSize);
+    }
+}
+
+bool OpeningBook::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_WARN("No opening book at: {}", path);
+        return false;
+    }
+    struct stat fileStat{};
+    if (fstat(fd, &fileStat) < 0 || fileStat.st_size < static_cast<off_t>(sizeof(Entry))) {
+        LOG_WARN("Opening book is empty: {}", path);
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Failed to map opening book: {}", path);
+        return false;
+    }
+    madvise(mapped, fileStat.st_size, MADV_RANDOM);
+
+    m_Entries = static_cast<const Entry *>(mapped);
+    m_MappedSize = fileStat.st_size;
+    m_NumEntries = m_MappedSize / sizeof(Entry);
+    LOG_INFO("Opened opening book with {} entries", m_NumEntries);
+    return true;
+}
+
+std::vector<BookMove> OpeningBook::lookup(const EngineBoard &board) const {
+    std::vector<BookMove> moves;
+    if (!m_Entries) {
+        return moves;
+    }
+    const uint64_t key = board.hash();
+    size_t low = 0;
+    size_t high = m_NumEntries;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (be64toh(m_Entries[mid].key) < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    for (size_t i = low; i < m_NumEntries && be64toh(m_Entries[i].key) == key; i++) {
+        moves.push_back({fromBookMove(board, be16toh(m_Entries[i].move)), be16toh(m_Entries[i].weight)});
+    }
+    return moves;
+}
+
+EncodedMove OpeningBook::pickMove(const EngineBoard &board) const {
+    std::vector<BookMove> moves = lookup(board);
+    if (moves.empty()) {
+        return 0;
+    }
+
+    // Guard against hash collisions by only keeping moves that are legal here
+    EngineBoard position = board;
+    MoveList legal;
+    position.generateLegalMoves(legal);
+    uint32_t totalWeight = 0;
+    auto end = std::remove_if(moves.begin(), moves.end(), [&](const BookMove &bookMove) {
+        return std::find(legal.moves.begin(), legal.moves.begin() + legal.count, bookMove.move) ==
+               legal.moves.begin() + legal.count;
+    });
+    moves.erase(end, moves.end());
+    for (const BookMove &bookMove : moves) {
+        totalWeight += bookMove.weight;
+    }
+    if (totalWeight == 0) {
+        return 0;
+    }
+
+    thread_local std::mt19937 generator(std::random_device{}());
+    uint32_t pick = std::uniform_int_distribution<uint32_t>(0, totalWeight - 1)(generator);
+    for (const BookMove &bookMove : moves) {
+        if (pick < bookMove.weight) {
+            return bookMove.move;
+        }
+        pick -= bookMove.weight;
+    }
+    return 0;
+}
+
+bool OpeningBook::writeBook(const std::string &linesPath, const std::string &bookPath, int maxPly) {
+    std::ifstream lines(linesPath);
+    if (!lines) {
+        LOG_ERROR("Failed to open opening lines: {}", linesPath);
+        return false;
+    }
+
+    // Ordered by key then move, which is the order the book must be written in
+    std::map<std::pair<uint64_t, uint16_t>, uint32_t> counts;
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream moves(line);
+        std::string uci;
+        EngineBoard board;
+        for (int ply = 0; ply < maxPly && moves >> uci; ply++) {
+            EncodedMove move = board.parseMove(uci);
+            if (!move) {
+                LOG_WARN("Skipping illegal move {} in line: {}", uci, line);
+                break;
+            }
+            counts[{board.hash(), toBookMove(board, move)}]++;
+            board.makeMove(move);
+        }
+    }
+
+    std::ofstream book(bookPath, std::ios::binary | std::ios::trunc);
+    if (!book) {
+        LOG_ERROR("Failed to create opening book: {}", bookPath);
+        return false;
+    }
+    for (const auto &[keyAndMove, count] : counts) {
+        Entry entry{htobe64(keyAndMove.first), htobe16(keyAndMove.second),
+                    htobe16(static_cast<uint16_t>(std::min<uint32_t>(count, 0xFFFF))), 0};
+        book.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+    LOG_INFO("Wrote {} entries to {}", counts.size(), bookPath);
+    return static_cast<bool>(book);
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "engine-board.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define BOOK_MAX_PLY 24
+
+namespace chess_online {
+
+struct BookMove {
+    EncodedMove move;
+    uint16_t weight;
+};
+
+// Read-only opening book in the Polyglot entry layout: 16 byte big-endian records of
+// (key, move, weight, learn) sorted by key. Keys are our own Zobrist hashes rather than the
+// Polyglot random table, so books must be generated with writeBook. The file is mapped, not
+// parsed, so every server process shares the same page cache copy
+class OpeningBook {
+public:
+    OpeningBook() = default;
+    ~OpeningBook();
+    OpeningBook(const OpeningBook &) = delete;
+    OpeningBook &operator=(const OpeningBook &) = delete;
+
+    bool open(const std::string &path);
+    bool isOpen() const { return m_Entries != nullptr; }
+    std::vector<BookMove> lookup(const EngineBoard &board) const;
+    EncodedMove pickMove(const EngineBoard &board) const; // Weighted random, 0 when out of book
+
+    // Build a book from a text file with one opening per line, as space separated UCI moves
+    static bool writeBook(const std::string &linesPath, const std::string &bookPath, int maxPly = BOOK_MAX_PLY);
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint16_t move;
+        uint16_t weight;
+        uint32_t learn;
+    };
+    static_assert(sizeof(Entry) == 16, "Book entries must match the on-disk layout");
+
+    const Entry *m_Entries = nullptr;
+    size_t m_NumEntries = 0;
+    size_t m_MappedSize = 0;
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+#ifdef CHESS_SERVER_BUILD
+#include "search-scheduler.h"
+#include "logger.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace chess_online {
+
+namespace {
+// The kernel only gives SCHED_IDLE threads a core nothing else wants, fall back to the lowest nice value
+void lowerThreadPriority() {
+    sched_param param{};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0 &&
+        setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 19) != 0) {
+        LOG_WARN("Failed to lower priority of idle search thread");
+    }
+}
+} // namespace
+
+SearchScheduler::SearchScheduler(int numThreads, int numIdleThreads) {
+    for (int i = 0; i < numThreads; ++i) {
+        m_Workers.emplace_back(&SearchScheduler::workerLoop, this, SEARCH_PRIORITY_NORMAL);
+    }
+    for (int i = 0; i < numIdleThreads; ++i) {
+        m_Workers.emplace_back(&SearchScheduler::workerLoop, this, SEARCH_PRIORITY_IDLE);
+    }
+}
+
+SearchScheduler::~SearchScheduler() {
+    {
+        std::scoped_lock lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Condition.notify_all();
+    m_IdleCondition.notify_all();
+    for (std::thread &worker : m_Workers) {
+        worker.join();
+    }
+}
+
+SearchJobId SearchScheduler::submit(const EngineBoard &board, const SearchLimits &limits, SearchCallback callback,
+                                    SearchPriority priority) {
+    if (m_Book && limits.useBook) {
+        EncodedMove bookMove = m_Book->pickMove(board);
+        if (bookMove) {
+            SearchResult result;
+            result.bestMove = bookMove;
+            answer(std::move(callback), result, priority);
+            return 0;
+        }
+    }
+    TablebaseResult tablebaseResult;
+    if (m_Tablebases && board.pieceCount() <= m_Tablebases->maxPieces() && m_Tablebases->probe(board, tablebaseResult)) {
+        SearchResult result;
+        result.bestMove = m_Tablebases->bestMove(board);
+        result.score = tablebaseScore(tablebaseResult, 0);
+        if (result.bestMove) {
+            answer(std::move(callback), result, priority);
+            return 0;
+        }
+    }
+
+    std::shared_ptr<Job> job =
+        std::make_shared<Job>(Job{0, Search(board, limits, m_Tablebases), std::move(callback), priority, false, 0});
+    {
+        std::scoped_lock lock(m_Mutex);
+        job->id = m_NextJobId++;
+        job->turn = m_NextTurn++;
+        m_Jobs.emplace(job->id, job);
+        (priority == SEARCH_PRIORITY_IDLE ? m_IdleRunQueue : m_RunQueue).push(job);
+    }
+    (priority == SEARCH_PRIORITY_IDLE ? m_IdleCondition : m_Condition).notify_one();
+    return job->id;
+}
+
+// An idle caller may be a search thread itself, going on from the callback of its last search. Answering
+// it inline would recurse once per position the book or the tablebases know
+void SearchScheduler::answer(SearchCallback callback, const SearchResult &result, SearchPriority priority) {
+    if (!callback) {
+        return;
+    }
+    if (priority == SEARCH_PRIORITY_IDLE) {
+        postIdle([callback = std::move(callback), result] { callback(result); });
+        return;
+    }
+    callback(result);
+}
+
+void SearchScheduler::postIdle(SearchTask task) {
+    {
+        std::scoped_lock lock(m_Mutex);
+        m_IdleTasks.push_back(std::move(task));
+    }
+    m_IdleCondition.notify_one();
+}
+
+void SearchScheduler::cancel(SearchJobId jobId) {
+    std::scoped_lock lock(m_Mutex);
+    auto it = m_Jobs.find(jobId);
+    if (it != m_Jobs.end()) {
+        it->second->cancelled = true;
+        m_Jobs.erase(it);
+    }
+}
+
+size_t SearchScheduler::activeJobs() {
+    std::scoped_lock lock(m_Mutex);
+    return m_Jobs.size();
+}
+
+void SearchScheduler::workerLoop(SearchPriority priority) {
+    const bool idle = priority == SEARCH_PRIORITY_IDLE;
+    if (idle) {
+        lowerThreadPriority();
+    }
+    RunQueue &runQueue = idle ? m_IdleRunQueue : m_RunQueue;
+    std::condition_variable &condition = idle ? m_IdleCondition : m_Condition;
+    while (1) {
+        std::shared_ptr<Job> job;
+        SearchTask task;
+        bool normalQueueDrained = false;
+        {
+            std::unique_lock lock(m_Mutex);
+            // Idle work backs off entirely while any normal job is waiting for a thread
+            condition.wait(lock, [&] {
+                return m_Stopping ||
+                       ((!runQueue.empty() || (idle && !m_IdleTasks.empty())) && (!idle || m_RunQueue.empty()));
+            });
+            if (m_Stopping) {
+                return;
+            }
+            if (idle && !m_IdleTasks.empty()) {
+                task = std::move(m_IdleTasks.front());
+                m_IdleTasks.pop_front();
+            } else {
+                job = runQueue.top();
+                runQueue.pop();
+                normalQueueDrained = !idle && m_RunQueue.empty() && (!m_IdleRunQueue.empty() || !m_IdleTasks.empty());
+                if (job->cancelled) {
+                    continue;
+                }
+            }
+        }
+        if (normalQueueDrained) {
+            m_IdleCondition.notify_all();
+        }
+        if (task) {
+            task();
+            continue;
+        }
+
+        // Only one thread holds a job at a time, so the search itself needs no locking
+        if (SearchClock::now() >= job->search.limits().deadline) {
+            job->search.stop();
+        }
+        if (job->search.run(idle ? IDLE_SEARCH_SLICE_NODES : SEARCH_SLICE_NODES) == SEARCH_RUNNING) {
+            {
+                std::scoped_lock lock(m_Mutex);
+                if (!job->cancelled) {
+                    job->turn = m_NextTurn++;
+                    runQueue.push(job);
+                }
+            }
+            if (idle) {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        {
+            std::scoped_lock lock(m_Mutex);
+            if (job->cancelled) {
+                continue;
+            }
+            m_Jobs.erase(job->id);
+        }
+        if (job->callback) {
+            job->callback(job->search.result());
+        }
+    }
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "opening-book.h"
+#include "search.h"
+#include "tablebase.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define NUM_SEARCH_THREADS 2
+#define NUM_IDLE_SEARCH_THREADS 1
+#define SEARCH_SLICE_NODES 4096U // Roughly a millisecond of work before a job can be preempted
+#define IDLE_SEARCH_SLICE_NODES 1024U
+
+namespace chess_online {
+
+using SearchJobId = uint64_t;
+using SearchCallback = std::function<void(const SearchResult &result)>;
+using SearchTask = std::function<void()>;
+
+enum SearchPriority {
+    SEARCH_PRIORITY_NORMAL,
+    SEARCH_PRIORITY_IDLE // Background work, only runs on SCHED_IDLE threads while no normal job is waiting
+};
+
+// Multiplexes many concurrent searches over a fixed pool of threads. Each job runs for one
+// node-budget slice at a time and goes back into the queue, which is ordered by deadline,
+// so a bot with little time left is always served before one that can afford to wait. Jobs
+// with the same deadline take turns, one slice each
+class SearchScheduler {
+public:
+    explicit SearchScheduler(int numThreads = NUM_SEARCH_THREADS, int numIdleThreads = NUM_IDLE_SEARCH_THREADS);
+    ~SearchScheduler();
+    SearchScheduler(const SearchScheduler &) = delete;
+    SearchScheduler &operator=(const SearchScheduler &) = delete;
+
+    // Both must outlive the scheduler
+    void setOpeningBook(const OpeningBook *book) { m_Book = book; }
+    void setTablebases(const Tablebases *tablebases) { m_Tablebases = tablebases; }
+
+    // The callback runs on a search thread once the search finishes or its deadline passes.
+    // Book and tablebase moves return job id 0 and cannot be cancelled. A normal job is answered straight
+    // away on the calling thread, an idle one from an idle thread like any other idle work
+    SearchJobId submit(const EngineBoard &board, const SearchLimits &limits, SearchCallback callback,
+                       SearchPriority priority = SEARCH_PRIORITY_NORMAL);
+    void cancel(SearchJobId jobId); // The callback will not be called
+    void postIdle(SearchTask task); // Runs on an idle thread ahead of idle searches, dropped if the scheduler stops first
+    size_t activeJobs();
+
+private:
+    struct Job {
+        SearchJobId id;
+        Search search;
+        SearchCallback callback;
+        SearchPriority priority;
+        bool cancelled;
+        uint64_t turn; // Taken each time the job is queued, so a requeued job goes behind its equals
+    };
+
+    struct EarliestDeadlineFirst {
+        bool operator()(const std::shared_ptr<Job> &a, const std::shared_ptr<Job> &b) const {
+            if (a->search.limits().deadline != b->search.limits().deadline) {
+                return a->search.limits().deadline > b->search.limits().deadline;
+            }
+            return a->turn > b->turn;
+        }
+    };
+
+    using RunQueue = std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job>>, EarliestDeadlineFirst>;
+
+    const OpeningBook *m_Book = nullptr;
+    const Tablebases *m_Tablebases = nullptr;
+    std::vector<std::thread> m_Workers;
+    RunQueue m_RunQueue;
+    RunQueue m_IdleRunQueue; // Never sees a deadline, so its jobs always take turns
+    std::deque<SearchTask> m_IdleTasks;
+    std::unordered_map<SearchJobId, std::shared_ptr<Job>> m_Jobs; // Queued or currently running
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    std::condition_variable m_IdleCondition;
+    SearchJobId m_NextJobId = 1;
+    uint64_t m_NextTurn = 0;
+    bool m_Stopping = false;
+
+    void answer(SearchCallback callback, const SearchResult &result, SearchPriority priority);
+    void workerLoop(SearchPriority priority);
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
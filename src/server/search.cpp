@@ -0,0 +1,306 @@
+#ifdef CHESS_SERVER_BUILD
+#include "search.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace chess_online {
+
+namespace {
+const int SCORE_INFINITY = MATE_SCORE + 1;
+const int PIECE_VALUES[7] = {0, 100, 500, 320, 330, 900, 0}; // Indexed by PieceType
+
+// Mate scores are stored relative to the node so they stay correct at other plies
+int scoreToTable(int score, int ply) {
+    return score > MATE_BOUND ? score + ply : score < -MATE_BOUND ? score - ply
+                                                                  : score;
+}
+
+int scoreFromTable(int score, int ply) {
+    return score > MATE_BOUND ? score - ply : score < -MATE_BOUND ? score + ply
+                                                                  : score;
+}
+} // namespace
+
+Search::Search(const EngineBoard &board, const SearchLimits &limits, const Tablebases *tablebases)
+    : m_Board(board), m_Limits(limits), m_Tablebases(tablebases), m_Stack(SEARCH_MAX_PLY + 1), m_Height(0),
+      m_Table(SEARCH_TT_ENTRIES), m_Killers{}, m_FirstLegalMove(0), m_RootMoves(0), m_Depth(1), m_Done(false) {
+    MoveList legal;
+    m_Board.generateLegalMoves(legal);
+    m_RootMoves = legal.count;
+    if (legal.count == 0) {
+        m_Result.score = m_Board.inCheck() ? -MATE_SCORE : 0;
+        m_Done = true;
+        return;
+    }
+    m_FirstLegalMove = legal.moves[0];
+    startIteration();
+}
+
+SearchStatus Search::run(uint64_t nodeBudget) {
+    const uint64_t sliceEnd = m_Result.nodes + nodeBudget;
+    unsigned steps = 0;
+    while (!m_Done) {
+        if (m_Result.nodes >= sliceEnd) {
+            return SEARCH_RUNNING;
+        }
+        if ((m_Limits.maxNodes && m_Result.nodes >= m_Limits.maxNodes) ||
+            ((steps++ & 1023) == 0 && SearchClock::now() >= m_Limits.deadline)) {
+            stop();
+            break;
+        }
+        step();
+    }
+    return SEARCH_DONE;
+}
+
+void Search::stop() {
+    if (m_Done) {
+        return;
+    }
+    // Root children that finished searching are exact enough to prefer over the last iteration
+    if (m_Height > 0 && m_Stack[0].bestMove) {
+        m_Result.bestMove = m_Stack[0].bestMove;
+        m_Result.score = m_Stack[0].bestScore;
+    }
+    if (!m_Result.bestMove) {
+        m_Result.bestMove = m_FirstLegalMove;
+    }
+    m_Height = 0;
+    m_Done = true;
+}
+
+void Search::startIteration() {
+    m_Height = 0;
+    pushFrame(m_Depth, 0, -SCORE_INFINITY, SCORE_INFINITY, false);
+}
+
+void Search::completeIteration(const Frame &root) {
+    m_Result.bestMove = root.bestMove;
+    m_Result.score = root.bestScore;
+    m_Result.depth = m_Depth;
+    if (m_Depth >= m_Limits.maxDepth || m_RootMoves == 1 || std::abs(root.bestScore) > MATE_BOUND) {
+        m_Height = 0;
+        m_Done = true;
+        return;
+    }
+    m_Depth++;
+    startIteration();
+}
+
+void Search::pushFrame(int depth, int ply, int alpha, int beta, bool quiescence) {
+    Frame &frame = m_Stack[m_Height++];
+    frame.depth = depth;
+    frame.ply = ply;
+    frame.alpha = alpha;
+    frame.beta = beta;
+    frame.quiescence = quiescence;
+    frame.initialized = false;
+}
+
+void Search::step() {
+    Frame &frame = m_Stack[m_Height - 1];
+    if (!frame.initialized) {
+        enterNode(frame);
+        return;
+    }
+
+    if (frame.index < frame.moves.count) {
+        EncodedMove move = nextMove(frame);
+        UndoInfo undo = m_Board.makeMove(move);
+        if (m_Board.leftKingInCheck()) {
+            m_Board.unmakeMove(move, undo);
+            return;
+        }
+        frame.legalMoves++;
+        frame.currentMove = move;
+        frame.undo = undo;
+        pushFrame(frame.depth - 1, frame.ply + 1, -frame.beta, -frame.alpha, frame.quiescence);
+        return;
+    }
+
+    // Every move has been searched (or a cutoff skipped the rest)
+    int score = frame.bestScore;
+    if (frame.legalMoves == 0 && !frame.quiescence) {
+        score = frame.inCheck ? -MATE_SCORE + frame.ply : 0;
+    }
+    if (!frame.quiescence) {
+        storeEntry(frame, score);
+    }
+    if (frame.ply == 0) {
+        completeIteration(frame);
+    } else {
+        returnScore(score);
+    }
+}
+
+void Search::enterNode(Frame &frame) {
+    m_Result.nodes++;
+    frame.initialized = true;
+    frame.index = 0;
+    frame.legalMoves = 0;
+    frame.bestMove = 0;
+    frame.bestScore = -SCORE_INFINITY;
+    frame.moves.count = 0;
+
+    if (frame.ply > 0 && (m_Board.isRepetition() || m_Board.halfmoveClock() >= 100)) {
+        returnScore(0);
+        return;
+    }
+    if (frame.ply >= SEARCH_MAX_PLY - 1) {
+        returnScore(evaluate());
+        return;
+    }
+    TablebaseResult tablebaseResult;
+    if (frame.ply > 0 && m_Tablebases && m_Board.pieceCount() <= m_Tablebases->maxPieces() &&
+        m_Tablebases->probe(m_Board, tablebaseResult)) {
+        returnScore(tablebaseScore(tablebaseResult, frame.ply));
+        return;
+    }
+
+    frame.inCheck = m_Board.inCheck();
+    if (!frame.quiescence) {
+        if (frame.inCheck) {
+            frame.depth++;
+        }
+        frame.quiescence = frame.depth <= 0;
+    }
+
+    if (frame.quiescence) {
+        int standPat = evaluate();
+        if (standPat >= frame.beta) {
+            returnScore(standPat);
+            return;
+        }
+        frame.alpha = std::max(frame.alpha, standPat);
+        frame.bestScore = standPat;
+        m_Board.generateMoves(frame.moves, true);
+        orderMoves(frame, 0);
+        return;
+    }
+
+    EncodedMove ttMove = 0;
+    const TTEntry &entry = m_Table[m_Board.hash() & (SEARCH_TT_ENTRIES - 1)];
+    if (entry.key == m_Board.hash()) {
+        ttMove = entry.move;
+        if (frame.ply > 0 && entry.depth >= frame.depth) {
+            int score = scoreFromTable(entry.score, frame.ply);
+            if (entry.bound == BOUND_EXACT ||
+                (entry.bound == BOUND_LOWER && score >= frame.beta) ||
+                (entry.bound == BOUND_UPPER && score <= frame.alpha)) {
+                returnScore(score);
+                return;
+            }
+        }
+    }
+
+    frame.originalAlpha = frame.alpha;
+    m_Board.generateMoves(frame.moves);
+    orderMoves(frame, ttMove);
+}
+
+void Search::returnScore(int score) {
+    m_Height--;
+    Frame &parent = m_Stack[m_Height - 1];
+    m_Board.unmakeMove(parent.currentMove, parent.undo);
+
+    int value = -score;
+    if (value <= parent.bestScore) {
+        return;
+    }
+    parent.bestScore = value;
+    parent.bestMove = parent.currentMove;
+    if (value <= parent.alpha) {
+        return;
+    }
+    parent.alpha = value;
+    if (value >= parent.beta) {
+        if (!parent.quiescence && !m_Board.isCapture(parent.currentMove)) {
+            std::array<EncodedMove, 2> &killers = m_Killers[parent.ply];
+            if (killers[0] != parent.currentMove) {
+                killers[1] = killers[0];
+                killers[0] = parent.currentMove;
+            }
+        }
+        parent.index = parent.moves.count;
+    }
+}
+
+void Search::orderMoves(Frame &frame, EncodedMove ttMove) {
+    const std::array<EncodedMove, 2> &killers = m_Killers[frame.ply];
+    for (int i = 0; i < frame.moves.count; i++) {
+        EncodedMove move = frame.moves.moves[i];
+        int score = 0;
+        if (move == ttMove) {
+            score = 1000000;
+        } else if (m_Board.isCapture(move)) {
+            EnginePiece victim = m_Board.pieceAt(encodedMoveDst(move));
+            int victimValue = victim ? PIECE_VALUES[enginePieceType(victim)] : PIECE_VALUES[PAWN];
+            int attackerValue = PIECE_VALUES[enginePieceType(m_Board.pieceAt(encodedMoveSrc(move)))];
+            score = 100000 + victimValue * 10 - attackerValue / 10;
+        } else if (encodedMovePromoteType(move)) {
+            score = 90000 + PIECE_VALUES[encodedMovePromoteType(move)];
+        } else if (move == killers[0]) {
+            score = 80000;
+        } else if (move == killers[1]) {
+            score = 79000;
+        }
+        frame.moveScores[i] = score;
+    }
+}
+
+EncodedMove Search::nextMove(Frame &frame) {
+    int best = frame.index;
+    for (int i = frame.index + 1; i < frame.moves.count; i++) {
+        if (frame.moveScores[i] > frame.moveScores[best]) {
+            best = i;
+        }
+    }
+    std::swap(frame.moves.moves[frame.index], frame.moves.moves[best]);
+    std::swap(frame.moveScores[frame.index], frame.moveScores[best]);
+    return frame.moves.moves[frame.index++];
+}
+
+void Search::storeEntry(const Frame &frame, int score) {
+    TTEntry &entry = m_Table[m_Board.hash() & (SEARCH_TT_ENTRIES - 1)];
+    entry.key = m_Board.hash();
+    entry.score = static_cast<int16_t>(scoreToTable(score, frame.ply));
+    entry.move = frame.bestMove;
+    entry.depth = static_cast<uint8_t>(std::max(0, frame.depth));
+    entry.bound = score <= frame.originalAlpha ? BOUND_UPPER : score >= frame.beta ? BOUND_LOWER
+                                                                                    : BOUND_EXACT;
+}
+
+int Search::evaluate() const {
+    int score = 0;
+    for (int square = 0; square < NUM_SQUARES; square++) {
+        EnginePiece piece = m_Board.pieceAt(square);
+        if (!piece) {
+            continue;
+        }
+        const int x = square % 8;
+        const int y = square / 8;
+        const int centrality = 6 - (std::abs(2 * x - 7) + std::abs(2 * y - 7)) / 2;
+        const PieceColor color = enginePieceColor(piece);
+        int value = PIECE_VALUES[enginePieceType(piece)];
+        switch (enginePieceType(piece)) {
+        case PAWN: {
+            int advanced = color == WHITE ? 6 - y : y - 1;
+            value += advanced * advanced * 2;
+            break;
+        }
+        case KNIGHT:
+        case BISHOP:
+            value += centrality * 5;
+            break;
+        case QUEEN:
+            value += centrality * 2;
+            break;
+        default:
+            break;
+        }
+        score += color == WHITE ? value : -value;
+    }
+    return m_Board.sideToMove() == WHITE ? score : -score;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "engine-board.h"
+#include "tablebase.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#define SEARCH_MAX_PLY 64
+#define SEARCH_TT_ENTRIES (1U << 14) // Per search, kept small so thousands of bots fit in memory
+#define MATE_SCORE 30000
+#define MATE_BOUND (MATE_SCORE - 2 * SEARCH_MAX_PLY) // Scores beyond this are forced mates
+
+namespace chess_online {
+
+using SearchClock = std::chrono::steady_clock;
+
+struct SearchLimits {
+    int maxDepth = SEARCH_MAX_PLY;
+    uint64_t maxNodes = 0; // 0 means unlimited
+    SearchClock::time_point deadline = SearchClock::time_point::max();
+    bool useBook = true; // Let the scheduler answer from the opening book without searching
+};
+
+struct SearchResult {
+    EncodedMove bestMove = 0;
+    int score = 0; // Centipawns from the side to move's point of view
+    int depth = 0; // Last fully completed iteration
+    uint64_t nodes = 0;
+};
+
+inline int tablebaseScore(const TablebaseResult &result, int ply) {
+    return result.wdl == 0 ? 0 : result.wdl * (MATE_SCORE - ply - result.dtm);
+}
+
+enum SearchStatus {
+    SEARCH_RUNNING,
+    SEARCH_DONE
+};
+
+// Iterative deepening alpha-beta search kept on an explicit stack, so it can be suspended
+// after any node and resumed later by whichever thread picks it up next
+class Search {
+public:
+    Search(const EngineBoard &board, const SearchLimits &limits, const Tablebases *tablebases = nullptr);
+    SearchStatus run(uint64_t nodeBudget); // Search at most nodeBudget more nodes
+    void stop();                           // Finish now with the best move found so far
+    bool isDone() const { return m_Done; }
+    const SearchResult &result() const { return m_Result; }
+    const SearchLimits &limits() const { return m_Limits; }
+
+private:
+    enum Bound : uint8_t {
+        BOUND_EXACT,
+        BOUND_LOWER,
+        BOUND_UPPER
+    };
+
+    struct TTEntry {
+        uint64_t key;
+        int16_t score;
+        EncodedMove move;
+        uint8_t depth;
+        Bound bound;
+    };
+
+    struct Frame {
+        MoveList moves;
+        std::array<int, MAX_MOVES> moveScores;
+        UndoInfo undo;
+        EncodedMove currentMove;
+        EncodedMove bestMove;
+        int index;
+        int legalMoves;
+        int alpha;
+        int originalAlpha;
+        int beta;
+        int bestScore;
+        int depth;
+        int ply;
+        bool quiescence;
+        bool initialized;
+        bool inCheck;
+    };
+
+    EngineBoard m_Board;
+    SearchLimits m_Limits;
+    const Tablebases *m_Tablebases;
+    SearchResult m_Result;
+    std::vector<Frame> m_Stack; // Preallocated, m_Height frames are live
+    int m_Height;
+    std::vector<TTEntry> m_Table;
+    std::array<std::array<EncodedMove, 2>, SEARCH_MAX_PLY> m_Killers;
+    EncodedMove m_FirstLegalMove;
+    int m_RootMoves;
+    int m_Depth;
+    bool m_Done;
+
+    void startIteration();
+    void completeIteration(const Frame &root);
+    void pushFrame(int depth, int ply, int alpha, int beta, bool quiescence);
+    void step();
+    void enterNode(Frame &frame);
+    void returnScore(int score);
+    void orderMoves(Frame &frame, EncodedMove ttMove);
+    EncodedMove nextMove(Frame &frame);
+    void storeEntry(const Frame &frame, int score);
+    int evaluate() const;
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -2,12 +2,29 @@
 #include "chess-server.h"
 #include "helpers.h"
 #include "server.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <thread>
 
-int main() {
-    chess_online::ChessServer ChessServer;
+int main(int argc, char *argv[]) {
+    chess_online::IoBackend backend = chess_online::IO_BACKEND_EPOLL;
+    chess_online::HeartbeatConfig heartbeat;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--io-uring") == 0) {
+            backend = chess_online::IO_BACKEND_URING;
+        } else if (std::strcmp(argv[i], "--heartbeat-interval") == 0 && i + 1 < argc) {
+            heartbeat.intervalMs = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--heartbeat-missed") == 0 && i + 1 < argc) {
+            heartbeat.missedMax = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--io-uring] [--heartbeat-interval ms] [--heartbeat-missed count]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    chess_online::ChessServer ChessServer(backend, heartbeat);
     ChessServer.run();
 }
 #endif
\ No newline at end of file
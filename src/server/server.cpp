@@ -5,23 +5,74 @@
 
 #include "server.h"
 #include "helpers.h"
+#include "logger.h"
+#include "metrics.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdexcept>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 namespace chess_online {
-Server::Server(uint16_t port)
-    : m_Port(port), m_Address{}, m_DataHandler(nullptr) {
-    createSocket();
+namespace {
+thread_local int t_WorkerId = -1; // Lets sendFrame skip the task queue when already on the owning worker
+
+enum UringOperation : uint64_t {
+    URING_WAKEUP,
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND,
+    URING_CANCEL,
+    URING_TIMER
+};
+
+// Completions carry the fd and its generation, so ones arriving after the fd was closed and reused are
+// recognised as stale. Connection fds stay below 2^24, the size of the connection table
+uint64_t uringTag(UringOperation operation, int fd = 0, uint32_t generation = 0) {
+    return static_cast<uint64_t>(operation) << 56 | static_cast<uint64_t>(generation) << 24 |
+           static_cast<uint32_t>(fd);
+}
+UringOperation uringOperation(uint64_t tag) { return static_cast<UringOperation>(tag >> 56); }
+int uringFd(uint64_t tag) { return static_cast<int>(tag & 0xFFFFFF); }
+uint32_t uringGeneration(uint64_t tag) { return static_cast<uint32_t>(tag >> 24); }
+} // namespace
+
+Server::Server(uint16_t port, IoBackend backend, HeartbeatConfig heartbeat)
+    : m_Port(port), m_Backend(backend), m_Heartbeat(heartbeat), m_Address{}, m_Start(std::chrono::steady_clock::now()),
+      m_DataHandler(nullptr) {
+    if (m_Heartbeat.intervalMs < TIMER_TICK_MS || m_Heartbeat.missedMax == 0) {
+        THROW_RUNTIME_ERROR("Invalid heartbeat, every " << m_Heartbeat.intervalMs << " ms and " << m_Heartbeat.missedMax << " missed");
+    }
+    const char ping = static_cast<char>(FRAME_PING);
+    const char pong = static_cast<char>(FRAME_PONG);
+    m_PingFrame = makeFrame(&ping, 1);
+    m_PongFrame = makeFrame(&pong, 1);
     m_Address.sin_family = AF_INET;
     m_Address.sin_addr.s_addr = htonl(INADDR_ANY);
     m_Address.sin_port = htons(m_Port);
-    bindAndListen();
-    setupEpoll();
+    for (int i = 0; i < NUM_WORKER_THREADS; ++i) {
+        m_ListenFds[i] = createSocket();
+        bindAndListen(m_ListenFds[i]);
+        if ((m_WorkerEventFds[i] = eventfd(0, EFD_NONBLOCK)) < 0) {
+            THROW_RUNTIME_ERROR("Failed to create eventfd");
+        }
+        if ((m_WorkerTimerFds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+            THROW_RUNTIME_ERROR("Failed to create timerfd");
+        }
+    }
+    if (m_Backend == IO_BACKEND_URING && !setupUring()) {
+        LOG_WARN("io_uring with multishot recv is not available, falling back to epoll");
+        m_Backend = IO_BACKEND_EPOLL;
+    }
+    if (m_Backend == IO_BACKEND_EPOLL) {
+        setupEpoll();
+    }
 }
 
 void Server::registerDataHandler(DataHandler handler) {
@@ -36,46 +87,70 @@ void Server::registerDisconnectHandler(DisconnectHandler handler) {
     m_DisconnectHandler = handler;
 }
 
-void Server::createSocket() {
-    PRINT_MSG("Creating socket..");
-    if ((m_SocketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+void Server::registerResyncHandler(ResyncHandler handler) {
+    m_ResyncHandler = handler;
+}
+
+int Server::createSocket() {
+    LOG_DEBUG("Creating socket..");
+    int socketFd;
+    if ((socketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
         THROW_RUNTIME_ERROR("Failed to create socket");
     }
     int opt = 1;
-    if (setsockopt(m_SocketFd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
         THROW_RUNTIME_ERROR("Failed to set socket options");
     }
+    return socketFd;
 }
 
-void Server::bindAndListen() {
-    PRINT_MSG("Binding..");
-    if (bind(m_SocketFd, (struct sockaddr *)&m_Address, sizeof(m_Address)) < 0) {
+void Server::bindAndListen(int socketFd) {
+    LOG_DEBUG("Binding..");
+    if (bind(socketFd, (struct sockaddr *)&m_Address, sizeof(m_Address)) < 0) {
         THROW_RUNTIME_ERROR("Failed to bind socket to port: " << m_Port);
     }
 
-    PRINT_MSG("Listening..");
-    if (listen(m_SocketFd, BACKLOG_SIZE) < 0) {
+    LOG_DEBUG("Listening..");
+    if (listen(socketFd, BACKLOG_SIZE) < 0) {
         THROW_RUNTIME_ERROR("Failed to listen");
     }
 }
 
 void Server::setupEpoll() {
-    PRINT_MSG("Setting up Epoll..");
+    LOG_INFO("Setting up Epoll..");
     for (int i = 0; i < NUM_WORKER_THREADS; ++i) {
         if ((m_WorkerEpollFds[i] = epoll_create1(0)) < 0) {
             THROW_RUNTIME_ERROR("Failed to create epoll instance");
         }
+        addToEpoll(m_WorkerEpollFds[i], m_WorkerEventFds[i], EPOLLIN);
+        addToEpoll(m_WorkerEpollFds[i], m_WorkerTimerFds[i], EPOLLIN);
+        addToEpoll(m_WorkerEpollFds[i], m_ListenFds[i], EPOLLIN);
     }
 }
 
-void Server::addToEpoll(int epfd, int fd) {
-    PRINT_MSG("Adding to epoll(epfd, fd): (" << epfd << ", " << fd << ")" << std::endl);
+bool Server::setupUring() {
+    LOG_INFO("Setting up io_uring..");
+    for (int i = 0; i < NUM_WORKER_THREADS; ++i) {
+        m_WorkerRings[i] = std::make_unique<IoUring>();
+        // Every ring is on the same kernel, the first one finding out what it supports is enough
+        if (!m_WorkerRings[i]->init(URING_ENTRIES, URING_COMPLETION_ENTRIES) ||
+            !m_WorkerRings[i]->setupBufferRing(URING_BUFFER_GROUP, URING_BUFFER_COUNT, MAX_BUFFER_SIZE) ||
+            (i == 0 && !m_WorkerRings[i]->probeMultishot(URING_BUFFER_GROUP))) {
+            for (std::unique_ptr<IoUring> &ring : m_WorkerRings) {
+                ring.reset();
+            }
+            return false;
+        }
+    }
+    return true;
+}
 
-    m_ClientInData.emplace(fd, std::make_shared<Data>());
-    m_ClientOutData.emplace(fd, std::make_shared<Data>());
+void Server::addToEpoll(int epfd, int fd, uint32_t events) {
+    LOG_DEBUG("Adding to epoll(epfd, fd): ({}, {})", epfd, fd);
 
     struct epoll_event event{};
-    event.events = EPOLLIN | EPOLLET;
+    event.events = events;
     event.data.fd = fd;
 
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
@@ -83,13 +158,21 @@ void Server::addToEpoll(int epfd, int fd) {
     }
 }
 
-void Server::removeFromEpoll(int epfd, int fd) {
-    PRINT_MSG("Removing from epoll..");
+void Server::addClient(int workerId, int fd) {
+    const uint32_t generation = m_Connections.open(fd, workerId);
+    Metrics::add(METRIC_CONNECTIONS_OPENED);
+    if (m_Backend == IO_BACKEND_URING) {
+        submitRecv(workerId, fd, generation);
+    } else {
+        addToEpoll(m_WorkerEpollFds[workerId], fd);
+    }
+    armHeartbeat(fd, generation, m_Heartbeat.intervalMs);
+}
 
-    m_ClientInData.erase(fd);
-    m_ClientOutData.erase(fd);
+void Server::removeFromEpoll(int epfd, int fd) {
+    LOG_DEBUG("Removing from epoll..");
 
-    m_FdToEpollFd.erase(fd);
+    m_Connections.close(fd);
 
     if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
         THROW_RUNTIME_ERROR("Failed to remove from epoll");
@@ -97,7 +180,7 @@ void Server::removeFromEpoll(int epfd, int fd) {
 }
 
 void Server::modifyEpoll(int epfd, int fd, uint32_t events) {
-    // PRINT_MSG("Modifying epoll for fd: " << fd << " with events: " << events);
+    // LOG_DEBUG("Modifying epoll for fd: {} with events: {}", fd, events);
 
     struct epoll_event event{};
     event.events = events | EPOLLET; // Always use edge-triggered mode
@@ -108,131 +191,797 @@ void Server::modifyEpoll(int epfd, int fd, uint32_t events) {
     }
 }
 
-void Server::listenThread() {
-    PRINT_MSG("Listen thread running..");
+void Server::acceptConnections(int workerId) {
     sockaddr_in clientAddress;
     socklen_t clientLen = sizeof(clientAddress);
     int clientSocket;
     std::array<char, 16> clientIp{};
-    while (1) {
-        if ((clientSocket = accept4(m_SocketFd, (sockaddr *)&clientAddress, &clientLen, SOCK_NONBLOCK)) < 0) {
-            continue;
-        }
-
+    // The listen socket is level triggered, drain it so one wakeup covers a burst of connections
+    while ((clientSocket = accept4(m_ListenFds[workerId], (sockaddr *)&clientAddress, &clientLen, SOCK_NONBLOCK)) >= 0) {
         inet_ntop(AF_INET, &clientAddress.sin_addr, clientIp.data(), INET_ADDRSTRLEN);
 
-        PRINT_MSG("Accepted connection from: " << clientIp.data() << " with socket value: " << clientSocket);
+        LOG_DEBUG("Accepted connection from: {} with socket value: {}", clientIp.data(), clientSocket);
 
-        addToEpoll(m_WorkerEpollFds[m_CurrentWorker], clientSocket);
-        m_FdToEpollFd.emplace(clientSocket, m_WorkerEpollFds[m_CurrentWorker]);
-        m_CurrentWorker++;
-        if (m_CurrentWorker >= NUM_WORKER_THREADS) {
-            m_CurrentWorker = 0;
-        }
+        acceptClient(workerId, clientSocket);
+    }
+}
 
-        if (m_AcceptHandler) {
-            m_AcceptHandler(clientSocket);
-        }
+void Server::acceptClient(int workerId, int clientSocket) {
+    // Moves are tiny and latency bound, waiting to coalesce them only delays the relay
+    int noDelay = 1;
+    if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0) {
+        LOG_WARN("Failed to disable Nagle on socket: {}", clientSocket);
+    }
+    addClient(workerId, clientSocket);
+    if (m_AcceptHandler) {
+        m_AcceptHandler(clientSocket);
     }
 }
 
 void Server::handleThread(int workerId) {
-    std::ostringstream msg;
-    PRINT_MSG("Starting worker thread: " << std::this_thread::get_id() << " with workerId: " << workerId);
+    LOG_DEBUG("Starting worker thread with workerId: {}", workerId);
+    t_WorkerId = workerId;
     while (1) {
-        int eventsReady = epoll_wait(m_WorkerEpollFds[workerId], m_WorkerEpollEvents[workerId], NUM_EPOLL_EVENTS_MAX, 0);
+        int eventsReady = epoll_wait(m_WorkerEpollFds[workerId], m_WorkerEpollEvents[workerId], NUM_EPOLL_EVENTS_MAX,
+                                     EPOLL_WAIT_TIMEOUT_MS);
         if (eventsReady <= 0) {
             continue;
         }
-        // PRINT_MSG("Events ready: " << eventsReady);
+        // LOG_DEBUG("Events ready: {}", eventsReady);
         for (int i = 0; i < eventsReady; ++i) {
             epoll_event currentEvent = m_WorkerEpollEvents[workerId][i];
             int currentClientFd = currentEvent.data.fd;
-            // PRINT_MSG("WorkerId: " << workerId);
-            // PRINT_MSG("Events: " << currentEvent.events);
-            if (currentClientFd == m_SocketFd) {
-                PRINT_MSG("It is the server fd, event: " << currentEvent.events);
+            // LOG_DEBUG("WorkerId: {}", workerId);
+            // LOG_DEBUG("Events: {}", currentEvent.events);
+            if (currentClientFd == m_WorkerEventFds[workerId]) {
+                runWorkerTasks(workerId);
+                continue;
+            }
+            if (currentClientFd == m_WorkerTimerFds[workerId]) {
+                m_WorkerTimersDue[workerId] = true;
                 continue;
             }
+            if (currentClientFd == m_ListenFds[workerId]) {
+                acceptConnections(workerId);
+                continue;
+            }
+            Connection *owned = m_Connections.get(currentClientFd);
+            if (owned && owned->workerId.load(std::memory_order_relaxed) != workerId) {
+                continue; // Moved to another worker earlier in this batch, which reads it from now on
+            }
             if (currentEvent.events & (EPOLLHUP | EPOLLERR)) {
-                closeConnection(m_WorkerEpollFds[workerId], currentClientFd);
+                closeConnection(workerId, currentClientFd);
                 continue;
             }
-            if (currentEvent.events & EPOLLOUT) {
-                if (handleWrite(currentClientFd) < 0) {
-                    closeConnection(m_WorkerEpollFds[workerId], currentClientFd);
-                    continue;
-                }
-                modifyEpoll(m_WorkerEpollFds[workerId], currentClientFd, EPOLLIN);
+            if ((currentEvent.events & EPOLLIN) && handleRead(currentClientFd) <= 0) {
+                closeConnection(workerId, currentClientFd);
+                continue;
             }
-            if (currentEvent.events & EPOLLIN) {
-                if (handleRead(currentClientFd) <= 0) {
-                    closeConnection(m_WorkerEpollFds[workerId], currentClientFd);
-                    continue;
-                }
-                modifyEpoll(m_WorkerEpollFds[workerId], currentClientFd, EPOLLOUT);
+            Connection *connection = m_Connections.get(currentClientFd);
+            if (connection && (currentEvent.events & EPOLLOUT)) {
+                scheduleFlush(workerId, currentClientFd, *connection);
+            }
+        }
+        runDueTimers(workerId);
+        // Everything queued while handling this batch goes out now, one write per connection
+        flushConnections(workerId);
+    }
+}
+
+void Server::uringThread(int workerId) {
+    LOG_DEBUG("Starting io_uring worker thread with workerId: {}", workerId);
+    t_WorkerId = workerId;
+    IoUring &ring = *m_WorkerRings[workerId];
+    submitPoll(workerId, m_WorkerEventFds[workerId], uringTag(URING_WAKEUP));
+    submitPoll(workerId, m_WorkerTimerFds[workerId], uringTag(URING_TIMER));
+    submitAccept(workerId);
+    io_uring_cqe cqe;
+    while (1) {
+        // Sends queued by the last batch are submitted by the same call that waits for the next one
+        ring.submitAndWait(1);
+        while (ring.popCompletion(cqe)) {
+            handleCompletion(workerId, cqe);
+        }
+        runDueTimers(workerId);
+        flushConnections(workerId);
+    }
+}
+
+void Server::handleCompletion(int workerId, const io_uring_cqe &cqe) {
+    const bool more = cqe.flags & IORING_CQE_F_MORE; // A multishot request stays armed
+    const int fd = uringFd(cqe.user_data);
+    const uint32_t generation = uringGeneration(cqe.user_data);
+    switch (uringOperation(cqe.user_data)) {
+    case URING_WAKEUP:
+        runWorkerTasks(workerId);
+        if (!more) {
+            submitPoll(workerId, m_WorkerEventFds[workerId], cqe.user_data);
+        }
+        break;
+    case URING_TIMER:
+        m_WorkerTimersDue[workerId] = true;
+        if (!more) {
+            submitPoll(workerId, m_WorkerTimerFds[workerId], cqe.user_data);
+        }
+        break;
+    case URING_ACCEPT:
+        if (cqe.res >= 0) {
+            LOG_DEBUG("Accepted connection with socket value: {}", cqe.res);
+            acceptClient(workerId, cqe.res);
+        }
+        if (!more) {
+            submitAccept(workerId);
+        }
+        break;
+    case URING_RECV: {
+        IoUring &ring = *m_WorkerRings[workerId];
+        Connection *connection = m_Connections.get(fd, generation);
+        const bool migrating = connection && connection->migrateTo >= 0;
+        bool alive = connection && !connection->closing && (cqe.res > 0 || cqe.res == -ENOBUFS || (migrating && cqe.res == -ECANCELED));
+        if (alive && cqe.res > 0) {
+            alive = receiveData(fd, *connection, ring.buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT), cqe.res);
+        }
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            ring.recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        if (!connection) {
+            break;
+        }
+        if (!alive) {
+            closeConnection(workerId, fd);
+        } else if (!more && migrating) {
+            connection->recvArmed = false;
+            handOff(fd, *connection);
+        } else if (!more) {
+            submitRecv(workerId, fd, generation); // Out of provided buffers, or the kernel ended it
+        }
+        break;
+    }
+    case URING_SEND: {
+        Connection *connection = m_Connections.get(fd, generation);
+        if (!connection) {
+            break;
+        }
+        connection->sendsInFlight--;
+        if (connection->closing) {
+            if (connection->sendsInFlight == 0) {
+                closeConnection(workerId, fd);
             }
+            break;
+        }
+        if (cqe.res > 0) {
+            connection->outQueue.consume(cqe.res);
+            Metrics::add(METRIC_BYTES_OUT, cqe.res);
+        } else if (cqe.res != -ECANCELED) {
+            closeConnection(workerId, fd);
+            break;
+        }
+        // A short send cancels the rest of its chain, whatever is left goes out in the next one
+        if (connection->sendsInFlight == 0 && connection->migrateTo >= 0) {
+            handOff(fd, *connection);
+        } else if (connection->sendsInFlight == 0 && !connection->outQueue.empty()) {
+            scheduleFlush(workerId, fd, *connection);
+        }
+        break;
+    }
+    case URING_CANCEL:
+        break;
+    }
+}
+
+void Server::submitPoll(int workerId, int fd, uint64_t tag) {
+    io_uring_sqe *sqe = m_WorkerRings[workerId]->getSqe();
+    if (!sqe) {
+        THROW_RUNTIME_ERROR("io_uring submission queue is full");
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = tag;
+}
+
+void Server::submitAccept(int workerId) {
+    io_uring_sqe *sqe = m_WorkerRings[workerId]->getSqe();
+    if (!sqe) {
+        THROW_RUNTIME_ERROR("io_uring submission queue is full");
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_ListenFds[workerId];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = uringTag(URING_ACCEPT);
+}
+
+void Server::submitRecv(int workerId, int fd, uint32_t generation) {
+    io_uring_sqe *sqe = m_WorkerRings[workerId]->getSqe();
+    if (!sqe) {
+        THROW_RUNTIME_ERROR("io_uring submission queue is full");
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = uringTag(URING_RECV, fd, generation);
+    m_Connections.get(fd, generation)->recvArmed = true;
+}
+
+// Queued frames go out as a chain of linked sends, one per frame, so they reach the socket in order
+// without waiting on each other's completions. Only one chain per connection is in flight at a time
+bool Server::submitSends(int workerId, int fd, Connection &connection) {
+    if (connection.sendsInFlight > 0 || connection.migrateTo >= 0 || connection.closing || connection.outQueue.empty()) {
+        return true;
+    }
+    IoUring &ring = *m_WorkerRings[workerId];
+    iovec iov[WRITE_MAX_FRAMES];
+    const int frameCount = connection.outQueue.gather(iov, WRITE_MAX_FRAMES);
+    if (!ring.reserve(frameCount)) {
+        return false;
+    }
+    const uint32_t generation = m_Connections.generation(fd);
+    for (int i = 0; i < frameCount; i++) {
+        io_uring_sqe *sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(iov[i].iov_base);
+        sqe->len = static_cast<uint32_t>(iov[i].iov_len);
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = i + 1 < frameCount ? IOSQE_IO_LINK : 0;
+        sqe->user_data = uringTag(URING_SEND, fd, generation);
+    }
+    connection.sendsInFlight = static_cast<uint16_t>(frameCount);
+    return true;
+}
+
+// Runs on the worker that owns the connection. With epoll the fd simply leaves this worker's epoll.
+// With io_uring its recv is cancelled first and the hand off waits for that and any sends to complete,
+// as their completions arrive on this worker's ring. Frames queued meanwhile wait for the new owner
+void Server::migrate(int workerId, int fd, Connection &connection, int targetWorkerId) {
+    if (connection.closing) {
+        return;
+    }
+    LOG_DEBUG("Moving fd {} from worker {} to worker {}", fd, workerId, targetWorkerId);
+    connection.migrateTo = targetWorkerId;
+    if (m_Backend == IO_BACKEND_URING) {
+        io_uring_sqe *sqe = m_WorkerRings[workerId]->getSqe();
+        if (!sqe) {
+            THROW_RUNTIME_ERROR("io_uring submission queue is full");
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uringTag(URING_RECV, fd, m_Connections.generation(fd));
+        sqe->user_data = uringTag(URING_CANCEL);
+    } else if (epoll_ctl(m_WorkerEpollFds[workerId], EPOLL_CTL_DEL, fd, nullptr) < 0) {
+        THROW_RUNTIME_ERROR("Failed to remove from epoll");
+    }
+    handOff(fd, connection);
+}
+
+void Server::handOff(int fd, Connection &connection) {
+    if (connection.recvArmed || connection.sendsInFlight > 0) {
+        return;
+    }
+    const int targetWorkerId = connection.migrateTo;
+    const uint32_t generation = m_Connections.generation(fd);
+    connection.migrateTo = -1;
+    // The new owner's task queue gets the adopt task before anyone can see the new worker id, so
+    // frames sent to it from then on are only handled once it owns the connection
+    postToWorker(targetWorkerId, [this, targetWorkerId, fd, generation] {
+        adopt(targetWorkerId, fd, generation);
+    });
+    connection.workerId.store(targetWorkerId, std::memory_order_release);
+}
+
+void Server::adopt(int workerId, int fd, uint32_t generation) {
+    Connection *connection = m_Connections.get(fd, generation);
+    if (!connection) {
+        return;
+    }
+    // The old owner may not have published the move yet, this worker's flush must already see it
+    connection->workerId.store(workerId, std::memory_order_relaxed);
+    if (m_Backend == IO_BACKEND_URING) {
+        submitRecv(workerId, fd, generation);
+    } else {
+        connection->writeArmed = false;
+        addToEpoll(m_WorkerEpollFds[workerId], fd); // Adding reports data that is already waiting
+    }
+    // Frames that were read but left for this worker, and with io_uring those that arrived while the
+    // recv was being cancelled
+    if (!dispatchFrames(fd, *connection)) {
+        closeConnection(workerId, fd);
+        return;
+    }
+    connection->flushQueued = false;
+    scheduleFlush(workerId, fd, *connection);
+}
+
+void Server::colocate(int fd, int peerFd) {
+    const uint32_t generation = m_Connections.generation(fd);
+    Connection *connection = m_Connections.get(fd, generation);
+    Connection *peer = m_Connections.get(peerFd);
+    if (!connection || !peer) {
+        return;
+    }
+    const int workerId = connection->workerId.load(std::memory_order_acquire);
+    const int targetWorkerId = peer->workerId.load(std::memory_order_acquire);
+    if (workerId == targetWorkerId) {
+        return;
+    }
+    // Posted to the owner even when that is the calling worker. The caller may be a data handler in the
+    // middle of reading fd, which has to finish before anyone else may touch the connection
+    postToWorker(workerId, [this, workerId, fd, generation, targetWorkerId] {
+        Connection *connection = m_Connections.get(fd, generation);
+        if (connection && connection->migrateTo < 0 &&
+            connection->workerId.load(std::memory_order_relaxed) == workerId) {
+            migrate(workerId, fd, *connection, targetWorkerId);
+        }
+    });
+}
+
+void Server::postToWorker(int workerId, WorkerTask task) {
+    {
+        std::scoped_lock lock(m_WorkerTaskMutexes[workerId]);
+        m_WorkerTasks[workerId].push_back(std::move(task));
+    }
+    uint64_t wakeup = 1;
+    if (write(m_WorkerEventFds[workerId], &wakeup, sizeof(wakeup)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Failed to wake worker: {}", workerId);
+    }
+}
+
+void Server::runWorkerTasks(int workerId) {
+    uint64_t wakeups;
+    while (read(m_WorkerEventFds[workerId], &wakeups, sizeof(wakeups)) > 0) {
+    }
+    std::vector<WorkerTask> tasks;
+    {
+        std::scoped_lock lock(m_WorkerTaskMutexes[workerId]);
+        tasks.swap(m_WorkerTasks[workerId]);
+    }
+    for (WorkerTask &task : tasks) {
+        task();
+    }
+}
+
+uint64_t Server::currentTick() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_Start).count() /
+           TIMER_TICK_MS;
+}
+
+TimerHandle Server::armTimer(uint32_t delayMs, WorkerTask callback) {
+    const int workerId = t_WorkerId;
+    if (workerId < 0) {
+        THROW_RUNTIME_ERROR("Timers can only be armed from a worker thread");
+    }
+    TimerWheel &timers = m_WorkerTimers[workerId];
+    const uint64_t now = currentTick();
+    if (!m_WorkerTimersTicking[workerId]) {
+        timers.advance(now); // Empty while not ticking, so this only catches its clock up
+        setTimersTicking(workerId, true);
+    }
+    // The wheel may be a tick or two behind until the timerfd is read, the delay counts from now
+    const uint64_t delayTicks = (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS + (now - std::min(now, timers.now()));
+    return {workerId, timers.arm(delayTicks, std::move(callback))};
+}
+
+void Server::cancelTimer(const TimerHandle &handle) {
+    if (handle.workerId < 0) {
+        return;
+    }
+    if (handle.workerId == t_WorkerId) {
+        m_WorkerTimers[handle.workerId].cancel(handle.id);
+        return;
+    }
+    postToWorker(handle.workerId, [this, handle] {
+        m_WorkerTimers[handle.workerId].cancel(handle.id);
+    });
+}
+
+void Server::setTimersTicking(int workerId, bool ticking) {
+    // Only runs while something is armed, an idle worker is not woken up a hundred times a second
+    itimerspec spec{};
+    if (ticking) {
+        spec.it_interval.tv_nsec = TIMER_TICK_MS * 1000000L;
+        spec.it_value = spec.it_interval;
+    }
+    if (timerfd_settime(m_WorkerTimerFds[workerId], 0, &spec, nullptr) < 0) {
+        THROW_RUNTIME_ERROR("Failed to set timerfd for worker: " << workerId);
+    }
+    m_WorkerTimersTicking[workerId] = ticking;
+}
+
+// After the rest of the batch, so a frame that arrived before a timer fired is handled before it. A new
+// connection's first frames, already in its socket when the intent window closes, still decide what it is for
+void Server::runDueTimers(int workerId) {
+    if (m_WorkerTimersDue[workerId]) {
+        m_WorkerTimersDue[workerId] = false;
+        runTimers(workerId);
+    }
+}
+
+void Server::runTimers(int workerId) {
+    uint64_t expirations;
+    while (read(m_WorkerTimerFds[workerId], &expirations, sizeof(expirations)) > 0) {
+    }
+    TimerWheel &timers = m_WorkerTimers[workerId];
+    timers.advance(currentTick());
+    if (timers.size() == 0 && m_WorkerTimersTicking[workerId]) {
+        setTimersTicking(workerId, false);
+    }
+}
+
+void Server::armHeartbeat(int fd, uint32_t generation, uint32_t delayMs) {
+    armTimer(delayMs, [this, fd, generation] {
+        checkHeartbeat(fd, generation);
+    });
+}
+
+// A peer that vanished without a FIN or RST never makes the socket readable again, only the silence
+// tells. One timer per connection, checked when it would next be due instead of re-armed on every read
+void Server::checkHeartbeat(int fd, uint32_t generation) {
+    Connection *connection = m_Connections.get(fd, generation);
+    if (!connection) {
+        return; // Closed meanwhile
+    }
+    const int workerId = connection->workerId.load(std::memory_order_acquire);
+    if (workerId != t_WorkerId) {
+        // Moved since the check was armed, only the owner may send to or close it
+        postToWorker(workerId, [this, fd, generation] {
+            checkHeartbeat(fd, generation);
+        });
+        return;
+    }
+    const int64_t intervalMs = m_Heartbeat.intervalMs;
+    const int64_t silentMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - connection->lastActivity).count();
+    if (silentMs < intervalMs) {
+        armHeartbeat(fd, generation, static_cast<uint32_t>(std::max<int64_t>(intervalMs - silentMs, TIMER_TICK_MS)));
+        return;
+    }
+    if (connection->migrateTo >= 0) {
+        armHeartbeat(fd, generation, TIMER_TICK_MS); // Checked again by the worker it is moving to
+        return;
+    }
+    // Pinged once every interval of silence, the first ping went out an interval in
+    if (silentMs >= intervalMs * (m_Heartbeat.missedMax + 1)) {
+        LOG_INFO("Client missed {} heartbeats, closing: {}", m_Heartbeat.missedMax, fd);
+        closeConnection(workerId, fd);
+        return;
+    }
+    queueFrame(workerId, fd, *connection, m_PingFrame);
+    armHeartbeat(fd, generation, static_cast<uint32_t>(intervalMs - silentMs % intervalMs));
+}
+
+void Server::queueFrame(int workerId, int fd, Connection &connection, SharedFrame frame) {
+    Metrics::add(METRIC_FRAMES_OUT);
+    connection.outQueue.push(std::move(frame));
+    scheduleFlush(workerId, fd, connection);
+}
+
+void Server::scheduleFlush(int workerId, int fd, Connection &connection) {
+    if (!connection.flushQueued) {
+        connection.flushQueued = true;
+        m_WorkerFlushes[workerId].push_back(fd);
+    }
+}
+
+void Server::flushConnections(int workerId) {
+    std::vector<int> &flushes = m_WorkerFlushes[workerId];
+    // Closing a connection can queue frames for its opponent, which are appended and flushed here too
+    for (size_t i = 0; i < flushes.size(); i++) {
+        const int fd = flushes[i];
+        Connection *connection = m_Connections.get(fd);
+        if (!connection || connection->workerId.load(std::memory_order_relaxed) != workerId) {
+            continue; // Closed, or moved to another worker which flushes it from now on
+        }
+        connection->flushQueued = false;
+        if (connection->outQueue.overflowed()) {
+            LOG_WARN("Client is not reading, {} bytes are queued", connection->outQueue.bytes());
+            closeConnection(workerId, fd);
+        } else if (!flushConnection(workerId, fd)) {
+            closeConnection(workerId, fd);
         }
     }
+    flushes.clear();
 }
 
+bool Server::flushConnection(int workerId, int fd) {
+    Connection *connection = m_Connections.get(fd);
+    if (!connection) {
+        return false;
+    }
+    if (m_Backend == IO_BACKEND_URING) {
+        return submitSends(workerId, fd, *connection);
+    }
+    if (handleWrite(fd) < 0) {
+        return false;
+    }
+    const bool pendingOutput = !connection->outQueue.empty();
+    if (pendingOutput != connection->writeArmed) {
+        modifyEpoll(m_WorkerEpollFds[workerId], fd, pendingOutput ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        connection->writeArmed = pendingOutput;
+    }
+    return true;
+}
+
+// Edge triggered, so the socket is read until it would block or no further edge will come
 int Server::handleRead(int clientFd) {
-    int bytesReceived = recv(clientFd, m_ClientInData[clientFd]->buffer.data(), MAX_BUFFER_SIZE, 0);
-    m_ClientInData[clientFd]->len = bytesReceived;
-    m_ClientInData[clientFd]->pos = 0;
-    PRINT_MSG("Received number of bytes = " << bytesReceived << std::endl);
+    Connection *connection = m_Connections.get(clientFd);
+    if (!connection) {
+        return -1;
+    }
+    Data &inData = connection->inData;
+    connection->lastActivity = std::chrono::steady_clock::now();
+    while (1) {
+        // Whatever is left after dispatching is part of one frame, which always fits, so there is room
+        ssize_t bytesReceived = recv(clientFd, inData.buffer.data() + inData.len, MAX_BUFFER_SIZE - inData.len, 0);
+        if (bytesReceived < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+        if (bytesReceived == 0) {
+            return 0;
+        }
+        LOG_DEBUG("Received number of bytes = {}", bytesReceived);
+        inData.len += bytesReceived;
+        Metrics::add(METRIC_BYTES_IN, bytesReceived);
+        if (!dispatchFrames(clientFd, *connection)) {
+            return -1;
+        }
+        if (connection->migrateTo >= 0 || connection->workerId.load(std::memory_order_relaxed) != t_WorkerId) {
+            return 1; // The rest is read by the worker it moved to
+        }
+    }
+}
+
+// Data the io_uring backend received into a provided buffer, which may be larger than the room left
+bool Server::receiveData(int clientFd, Connection &connection, const char *data, size_t len) {
+    Data &inData = connection.inData;
+    connection.lastActivity = std::chrono::steady_clock::now();
+    Metrics::add(METRIC_BYTES_IN, len);
+    while (len > 0) {
+        const size_t chunk = std::min(len, MAX_BUFFER_SIZE - inData.len);
+        if (chunk == 0) {
+            return false; // Held back during a move, and more than a buffer's worth
+        }
+        std::memcpy(inData.buffer.data() + inData.len, data, chunk);
+        inData.len += chunk;
+        data += chunk;
+        len -= chunk;
+        // The game this connection belongs to is handled by the worker it is moving to
+        if (connection.migrateTo < 0 && !dispatchFrames(clientFd, connection)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Server::dispatchFrames(int clientFd, Connection &connection) {
+    Data &inData = connection.inData;
+    const int workerId = connection.workerId.load(std::memory_order_relaxed);
+    Data &frame = m_WorkerFrames[workerId];
+    Data &reply = m_WorkerReplies[workerId];
+    while (inData.len - inData.pos >= FRAME_HEADER_SIZE) {
+        // A handler moved the connection, what is left is dispatched by its new owner
+        if (connection.migrateTo >= 0 || connection.workerId.load(std::memory_order_relaxed) != workerId) {
+            break;
+        }
+        const unsigned char *header = reinterpret_cast<const unsigned char *>(&inData.buffer[inData.pos]);
+        const size_t frameLen = static_cast<size_t>(header[0]) << 8 | header[1];
+        if (frameLen > MAX_FRAME_SIZE) {
+            LOG_WARN("Frame of {} bytes is too large, dropping client: {}", frameLen, clientFd);
+            return false;
+        }
+        if (inData.len - inData.pos < FRAME_HEADER_SIZE + frameLen) {
+            break;
+        }
+        const size_t payloadStart = inData.pos + FRAME_HEADER_SIZE;
+        inData.pos = payloadStart + frameLen;
+        Metrics::add(METRIC_FRAMES_IN);
+        if (frameLen == 0 || !m_DataHandler) {
+            continue;
+        }
+        if (frameLen == 1 && handleControlFrame(workerId, clientFd, connection, inData.buffer[payloadStart])) {
+            continue;
+        }
 
-    if (m_DataHandler) {
-        m_DataHandler(clientFd, *m_ClientInData[clientFd], *m_ClientOutData[clientFd]);
+        std::copy(inData.buffer.begin() + payloadStart, inData.buffer.begin() + inData.pos, frame.buffer.begin());
+        frame.len = frameLen;
+        frame.pos = 0;
+        reply.len = reply.pos = 0;
+        m_DataHandler(clientFd, frame, reply);
+        if (reply.len > 0) {
+            queueFrame(workerId, clientFd, connection, makeFrame(reply.buffer.data(), reply.len));
+        }
+        // A client that keeps sending without reading the replies is dropped before it is read any further
+        if (connection.outQueue.overflowed()) {
+            LOG_WARN("Client is not reading, {} bytes are queued", connection.outQueue.bytes());
+            return false;
+        }
     }
 
-    return bytesReceived;
+    // Keep the start of the next partial frame at the front of the buffer
+    std::memmove(inData.buffer.data(), inData.buffer.data() + inData.pos, inData.len - inData.pos);
+    inData.len -= inData.pos;
+    inData.pos = 0;
+    return true;
+}
+
+bool Server::handleControlFrame(int workerId, int clientFd, Connection &connection, char type) {
+    switch (static_cast<unsigned char>(type)) {
+    case FRAME_PING:
+        queueFrame(workerId, clientFd, connection, m_PongFrame);
+        return true;
+    case FRAME_PONG:
+        return true; // Receiving it was all it was for
+    default:
+        return false;
+    }
 }
 
-// Sends outs everything that is in the out buffer
+SharedFrame Server::makeFrame(const char *payload, size_t len) {
+    if (len > MAX_FRAME_SIZE) {
+        THROW_RUNTIME_ERROR("Frame of " << len << " bytes is too large to send");
+    }
+    auto frame = std::make_shared<std::vector<char>>(FRAME_HEADER_SIZE + len);
+    (*frame)[0] = static_cast<char>(len >> 8);
+    (*frame)[1] = static_cast<char>(len & 0xFF);
+    std::memcpy(frame->data() + FRAME_HEADER_SIZE, payload, len);
+    return frame;
+}
+
+// Writes queued frames until the socket would block, the rest waits for the next EPOLLOUT.
+// sendmsg is writev with flags, MSG_NOSIGNAL keeps a vanished peer from raising SIGPIPE
 int Server::handleWrite(int clientFd) {
-    PRINT_MSG("handleWrite called");
-    Data outData = *m_ClientOutData[clientFd];
+    Connection *connection = m_Connections.get(clientFd);
+    if (!connection) {
+        return -1;
+    }
+    OutboundQueue &outQueue = connection->outQueue;
+    iovec iov[WRITE_MAX_FRAMES];
+    msghdr message{};
+    message.msg_iov = iov;
     int totalSent = 0;
-    while (outData.pos < outData.len) {
-        int bytesSent = send(clientFd, m_ClientOutData[clientFd]->buffer.data(), outData.len - outData.pos, 0);
-        PRINT_MSG(clientFd);
-        if (bytesSent <= 0) {
-            // Retry sending if it would block
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    while (!outQueue.empty()) {
+        message.msg_iovlen = outQueue.gather(iov, WRITE_MAX_FRAMES);
+        ssize_t bytesSent = sendmsg(clientFd, &message, MSG_NOSIGNAL);
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            return bytesSent;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
         }
-        outData.pos += bytesSent;
+        outQueue.consume(bytesSent);
         totalSent += bytesSent;
+        Metrics::add(METRIC_BYTES_OUT, bytesSent);
     }
     return totalSent;
 }
 
 int Server::sendMessage(int recipientFd, const std::vector<char> &data) {
-    PRINT_MSG("Send message called: " << std::endl);
-    std::copy(data.begin(), data.end(), m_ClientOutData[recipientFd]->buffer.begin());
-    m_ClientOutData[recipientFd]->len = data.size();
-    m_ClientOutData[recipientFd]->pos = 0;
-    modifyEpoll(m_FdToEpollFd[recipientFd], recipientFd, EPOLLOUT);
+    return sendFrame(recipientFd, makeFrame(data.data(), data.size()));
+}
+
+int Server::sendFrame(int recipientFd, SharedFrame frame) {
+    const uint32_t generation = m_Connections.generation(recipientFd);
+    if (!(generation & 1)) {
+        return -1; // Already disconnected
+    }
+    deliverFrame(recipientFd, generation, std::move(frame));
     return 0;
 }
 
-void Server::closeConnection(int epfd, int fd) {
-    PRINT_MSG("Closing connection on epfd,fd: " << epfd << "," << fd);
-    removeFromEpoll(epfd, fd);
+int Server::sendFrame(const Recipient &recipient, SharedFrame frame) {
+    if (m_Connections.generation(recipient.fd) != recipient.generation) {
+        return -1; // Closed, perhaps already reused by another connection
+    }
+    deliverFrame(recipient.fd, recipient.generation, std::move(frame));
+    return 0;
+}
+
+void Server::deliverFrame(int recipientFd, uint32_t generation, SharedFrame frame) {
+    // Checking the generation drops the message if the fd was closed and reused meanwhile
+    Connection *connection = m_Connections.get(recipientFd, generation);
+    if (!connection) {
+        return;
+    }
+    const int workerId = connection->workerId.load(std::memory_order_acquire);
+    if (workerId == t_WorkerId) {
+        queueFrame(workerId, recipientFd, *connection, std::move(frame));
+        return;
+    }
+
+    // The worker that owns the connection fills its out queue, so nothing else ever touches it.
+    // If the connection moves before the task runs, the task follows it to the new owner
+    postToWorker(workerId, [this, recipientFd, generation, frame = std::move(frame)]() mutable {
+        deliverFrame(recipientFd, generation, std::move(frame));
+    });
+}
+
+void Server::broadcastFrame(const std::vector<Recipient> &recipients, SharedFrame frame, bool resync) {
+    std::array<std::vector<Recipient>, NUM_WORKER_THREADS> byWorker;
+    for (const Recipient &recipient : recipients) {
+        if (Connection *connection = m_Connections.get(recipient.fd, recipient.generation)) {
+            byWorker[connection->workerId.load(std::memory_order_acquire)].push_back(recipient);
+        }
+    }
+    // Posted to the calling worker as well, so whatever it queued before is flushed first
+    for (int workerId = 0; workerId < NUM_WORKER_THREADS; workerId++) {
+        if (byWorker[workerId].empty()) {
+            continue;
+        }
+        postToWorker(workerId, [this, workerId, recipients = std::move(byWorker[workerId]), frame, resync] {
+            deliverBroadcast(workerId, recipients, frame, resync);
+        });
+    }
+}
+
+void Server::deliverBroadcast(int workerId, const std::vector<Recipient> &recipients, const SharedFrame &frame, bool resync) {
+    for (const Recipient &recipient : recipients) {
+        Connection *connection = m_Connections.get(recipient.fd, recipient.generation);
+        if (!connection) {
+            continue;
+        }
+        if (connection->workerId.load(std::memory_order_relaxed) != workerId) {
+            deliverFrame(recipient.fd, recipient.generation, frame); // Moved meanwhile, the frame follows it
+            continue;
+        }
+        if (resync) {
+            connection->lagging = false;
+        } else if (connection->lagging || connection->outQueue.frames() >= BROADCAST_LAG_FRAMES) {
+            // Dropped rather than queued, one slow reader must not grow until it is closed. The resync is
+            // only asked for once it has caught up, so it does not pile up behind the backlog either
+            if (!connection->lagging) {
+                connection->lagging = true;
+                connection->resyncRequested = false;
+            } else if (!connection->resyncRequested && connection->outQueue.empty() && m_ResyncHandler) {
+                connection->resyncRequested = true;
+                m_ResyncHandler(recipient.fd);
+            }
+            Metrics::add(METRIC_FRAMES_SKIPPED);
+            continue;
+        }
+        queueFrame(workerId, recipient.fd, *connection, frame);
+    }
+}
+
+void Server::closeConnection(int workerId, int fd) {
+    Connection *connection = m_Connections.get(fd);
+    if (m_Backend == IO_BACKEND_URING && connection && connection->sendsInFlight > 0) {
+        // The kernel still reads the queued frames the sends point at, so the queue and the fd number stay
+        // until the last completion, which closes it for good
+        if (!connection->closing) {
+            LOG_DEBUG("Closing connection once {} sends complete: {}", connection->sendsInFlight, fd);
+            connection->closing = true;
+            shutdown(fd, SHUT_RDWR);
+        }
+        return;
+    }
+    LOG_DEBUG("Closing connection on worker,fd: {},{}", workerId, fd);
+    Metrics::add(METRIC_CONNECTIONS_CLOSED);
+    // The fd number can be handed to a new connection as soon as it is closed, the handler tells them apart by this
+    const uint32_t generation = m_Connections.generation(fd);
+    if (m_Backend == IO_BACKEND_URING) {
+        m_Connections.close(fd);
+        shutdown(fd, SHUT_RDWR); // The multishot recv holds the socket open until it completes
+    } else {
+        removeFromEpoll(m_WorkerEpollFds[workerId], fd);
+    }
     close(fd);
     if (m_DisconnectHandler) {
-        m_DisconnectHandler(fd);
+        m_DisconnectHandler(fd, generation);
     }
 }
 
 void Server::run() {
-    PRINT_MSG("Run called..");
-    m_ListeningThread = std::thread(&Server::listenThread, this);
+    LOG_INFO("Run called..");
     for (int i = 0; i < NUM_WORKER_THREADS; ++i) {
-        m_WorkerThreads[i] = std::thread(&Server::handleThread, this, i);
+        m_WorkerThreads[i] = std::thread(m_Backend == IO_BACKEND_URING ? &Server::uringThread : &Server::handleThread, this, i);
     }
     while (1) {
         sleep(2147483647);
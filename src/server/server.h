@@ -1,7 +1,11 @@
 #ifdef CHESS_SERVER_BUILD
 #pragma once
 
+#include "connection-table.h"
+#include "io-uring.h"
+#include "timer-wheel.h"
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <functional>
@@ -14,28 +18,66 @@
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #define NUM_WORKER_THREADS 8
 #define NUM_EPOLL_EVENTS_MAX 1000
 #define BACKLOG_SIZE 1000
-#define MAX_BUFFER_SIZE 4096U
+#define EPOLL_WAIT_TIMEOUT_MS 1000 // Idle workers sleep in epoll_wait, wakeups come through their eventfd
+#define FRAME_HEADER_SIZE 2U       // Every message is preceded by its length as a big endian uint16
+#define MAX_FRAME_SIZE (MAX_BUFFER_SIZE - FRAME_HEADER_SIZE)
+#define WRITE_MAX_FRAMES 64        // Frames gathered into a single sendmsg, or linked sends with io_uring
+#define URING_ENTRIES 1024
+#define URING_COMPLETION_ENTRIES 8192
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_COUNT 256 // Provided recv buffers per worker, a power of two
+#define HEARTBEAT_INTERVAL_MS 2000 // A client that has sent nothing for this long is pinged
+#define HEARTBEAT_MISSED_MAX 3      // Pings left unanswered before the client is taken for dead and closed
+#define BROADCAST_LAG_FRAMES 16     // A broadcast recipient with this many frames still queued is lagging
 
 namespace chess_online {
 
-struct Data {
-    Data() : len(0), pos(0), buffer() {};
-    size_t len;
-    size_t pos;
-    std::array<char, MAX_BUFFER_SIZE> buffer;
-};
-
+// Called once for every complete frame with just its payload. Whatever is left in outData is sent back
+// to the client as one frame
 using DataHandler = std::function<void(int clientFd, Data &inData, Data &outData)>;
 using AcceptHandler = std::function<void(int clientFd)>;
-using DisconnectHandler = std::function<void(int clientFd)>;
+using DisconnectHandler = std::function<void(int clientFd, uint32_t generation)>; // The generation the connection had
+using ResyncHandler = std::function<void(int clientFd)>;
+using WorkerTask = std::function<void()>;
+
+// One byte frames handled by the server itself and never passed to the data handler. Either side may
+// ping, the other answers with a pong. Anything received counts as a sign of life, not only pongs
+enum ControlFrame : unsigned char {
+    FRAME_PING = 0x50,
+    FRAME_PONG = 0x51
+};
+
+struct HeartbeatConfig {
+    uint32_t intervalMs = HEARTBEAT_INTERVAL_MS;
+    uint32_t missedMax = HEARTBEAT_MISSED_MAX;
+};
+
+// A connection as it was when the frame was addressed, frames for it are dropped once the fd is closed
+// even if the number is reused by then
+struct Recipient {
+    int fd;
+    uint32_t generation;
+};
+
+struct TimerHandle {
+    int workerId = -1; // The worker whose wheel holds the timer
+    TimerId id = 0;
+};
+
+enum IoBackend {
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING // Multishot accept and recv into provided buffers, linked sends
+};
 
 class Server {
 public:
-    explicit Server(uint16_t port); // Create socket, bind, setup epoll
+    // Create sockets, bind, setup the backend. Falls back to epoll if the kernel lacks io_uring support
+    explicit Server(uint16_t port, IoBackend backend = IO_BACKEND_EPOLL, HeartbeatConfig heartbeat = {});
     Server(const Server &) = delete;
     Server &operator=(const Server &) = delete;
     Server(Server &&) noexcept = default;
@@ -43,36 +85,96 @@ public:
     void registerDataHandler(DataHandler handler);
     void registerAcceptHandler(AcceptHandler handler);
     void registerDisconnectHandler(DisconnectHandler handler);
-    void run(); // Start listening, setup listening and worker threads
-    int sendMessage(int recipientFd, const std::vector<char> &data);
+    void registerResyncHandler(ResyncHandler handler);
+    void run(); // Start the worker threads, each accepting on its own listening socket
+    int sendMessage(int recipientFd, const std::vector<char> &data); // Safe to call from any thread
+    int sendFrame(int recipientFd, SharedFrame frame);               // Same, without copying the payload
+    int sendFrame(const Recipient &recipient, SharedFrame frame);    // Same, dropped once that connection is closed
+    // Queues frame to every recipient with one task per worker rather than one per recipient, always
+    // after what the calling worker has queued so far. A recipient with BROADCAST_LAG_FRAMES still queued
+    // misses the frame and every broadcast after it until one marked as a resync reaches it. The resync
+    // handler is called once for it, at the first broadcast it misses with its queue drained. Safe to
+    // call from any thread
+    void broadcastFrame(const std::vector<Recipient> &recipients, SharedFrame frame, bool resync = false);
+    // Moves fd onto the worker that owns peerFd, so both are handled by one thread from then on. Done by a
+    // task on fd's worker, after whatever it is handling now. Safe to call from any thread
+    void colocate(int fd, int peerFd);
+    // Odd while fd is open, and different every time the fd number is reused
+    uint32_t connectionGeneration(int fd) const { return m_Connections.generation(fd); }
+    // Runs callback on the calling worker's thread once delayMs have passed. Only callable from a worker
+    // thread, which is where every handler and every game command runs
+    TimerHandle armTimer(uint32_t delayMs, WorkerTask callback);
+    void cancelTimer(const TimerHandle &handle); // Safe to call from any thread
+    static SharedFrame makeFrame(const char *payload, size_t len);
 
 private:
     uint16_t m_Port;
-    int m_SocketFd;
+    IoBackend m_Backend;
+    HeartbeatConfig m_Heartbeat;
+    SharedFrame m_PingFrame; // Sent to every connection, frames are immutable once made
+    SharedFrame m_PongFrame;
     struct sockaddr_in m_Address;
-    std::thread m_ListeningThread;
     std::thread m_WorkerThreads[NUM_WORKER_THREADS];
+    int m_ListenFds[NUM_WORKER_THREADS]; // Bound to the same port with SO_REUSEPORT, the kernel spreads connections
     int m_WorkerEpollFds[NUM_WORKER_THREADS];
+    int m_WorkerEventFds[NUM_WORKER_THREADS]; // Written to wake a worker up for its queued tasks
+    int m_WorkerTimerFds[NUM_WORKER_THREADS]; // Ticks every TIMER_TICK_MS while the worker has timers armed
+    TimerWheel m_WorkerTimers[NUM_WORKER_THREADS];
+    bool m_WorkerTimersTicking[NUM_WORKER_THREADS] = {};
+    bool m_WorkerTimersDue[NUM_WORKER_THREADS] = {}; // The timerfd fired during this batch, run once the rest of it is handled
+    std::chrono::steady_clock::time_point m_Start; // Tick 0 of every worker's wheel
     epoll_event m_WorkerEpollEvents[NUM_WORKER_THREADS][NUM_EPOLL_EVENTS_MAX];
-    std::unordered_map<int, std::shared_ptr<Data>> m_ClientInData;
-    std::unordered_map<int, std::shared_ptr<Data>> m_ClientOutData;
-    std::unordered_map<int, int> m_FdToEpollFd;
+    std::unique_ptr<IoUring> m_WorkerRings[NUM_WORKER_THREADS];
+    std::mutex m_WorkerTaskMutexes[NUM_WORKER_THREADS];
+    std::vector<WorkerTask> m_WorkerTasks[NUM_WORKER_THREADS];
+    ConnectionTable m_Connections;
+    Data m_WorkerFrames[NUM_WORKER_THREADS]; // The frame being handled, and the reply to it
+    Data m_WorkerReplies[NUM_WORKER_THREADS];
+    std::vector<int> m_WorkerFlushes[NUM_WORKER_THREADS]; // Connections with frames queued during this batch of events
     AcceptHandler m_AcceptHandler;
     DataHandler m_DataHandler;
     DisconnectHandler m_DisconnectHandler;
+    ResyncHandler m_ResyncHandler;
 
-    int m_CurrentWorker = 0;
-
-    void createSocket();
-    void bindAndListen();
+    int createSocket();
+    void bindAndListen(int socketFd);
     void setupEpoll();
-    void addToEpoll(int epfd, int fd);
+    bool setupUring();
+    void addToEpoll(int epfd, int fd, uint32_t events = EPOLLIN | EPOLLET);
+    void addClient(int workerId, int fd);
     void removeFromEpoll(int epfd, int fd);
     void modifyEpoll(int epfd, int fd, uint32_t events);
-    void listenThread();
+    void acceptConnections(int workerId);
+    void acceptClient(int workerId, int clientSocket);
     void handleThread(int workerId);
+    void uringThread(int workerId);
+    void handleCompletion(int workerId, const io_uring_cqe &cqe);
+    void submitPoll(int workerId, int fd, uint64_t tag);
+    void submitAccept(int workerId);
+    void submitRecv(int workerId, int fd, uint32_t generation);
+    bool submitSends(int workerId, int fd, Connection &connection);
+    void migrate(int workerId, int fd, Connection &connection, int targetWorkerId);
+    void handOff(int fd, Connection &connection);
+    void adopt(int workerId, int fd, uint32_t generation);
+    void deliverFrame(int recipientFd, uint32_t generation, SharedFrame frame);
+    void deliverBroadcast(int workerId, const std::vector<Recipient> &recipients, const SharedFrame &frame, bool resync);
+    void postToWorker(int workerId, WorkerTask task);
+    void runWorkerTasks(int workerId);
+    uint64_t currentTick() const;
+    void setTimersTicking(int workerId, bool ticking);
+    void runDueTimers(int workerId);
+    void runTimers(int workerId);
+    void armHeartbeat(int fd, uint32_t generation, uint32_t delayMs);
+    void checkHeartbeat(int fd, uint32_t generation);
     void closeConnection(int workerId, int fd);
+    void queueFrame(int workerId, int fd, Connection &connection, SharedFrame frame);
+    void scheduleFlush(int workerId, int fd, Connection &connection);
+    void flushConnections(int workerId);
+    bool flushConnection(int workerId, int fd);
     int handleRead(int clientFd);
+    bool receiveData(int clientFd, Connection &connection, const char *data, size_t len);
+    bool dispatchFrames(int clientFd, Connection &connection);
+    bool handleControlFrame(int workerId, int clientFd, Connection &connection, char type); // False if it is not one
     int handleWrite(int clientFd);
 };
 }; // namespace chess_online
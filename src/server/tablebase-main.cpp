@@ -0,0 +1,25 @@
+#ifdef CHESS_SERVER_BUILD
+#include "tablebase.h"
+#include <iostream>
+#include <thread>
+
+// Generates endgame tablebases into a directory the server loads at startup
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <directory> [signature...]" << std::endl;
+        std::cerr << "Generates KQK KRK KPK KBNK when no signatures are given" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> signatures(argv + 2, argv + argc);
+    if (signatures.empty()) {
+        signatures = {"KQK", "KRK", "KPK", "KBNK"};
+    }
+    int numThreads = std::max(1U, std::thread::hardware_concurrency());
+    for (const std::string &signature : signatures) {
+        if (!chess_online::Tablebases::generate(signature, argv[1], numThreads)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
\ No newline at end of file
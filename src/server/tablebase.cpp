@@ -0,0 +1,695 @@
+#ifdef CHESS_SERVER_BUILD
+#include "tablebase.h"
+#include "helpers.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace chess_online {
+
+namespace {
+const uint8_t TB_DRAW = 0;
+const uint8_t TB_UNRESOLVED = 254; // Only used while generating
+const uint8_t TB_ILLEGAL = 255;
+const uint8_t TB_DRAW_EXIT = 255; // Counter value for positions that can always escape into a draw
+const int TB_MAX_DTM = 252;
+const int TB_NO_WIN = 1000;
+const char TB_MAGIC[4] = {'C', 'T', 'B', '1'};
+
+// Pieces appear in a signature in this order
+const char SIGNATURE_ORDER[] = "KQRBNP";
+const PieceType SIGNATURE_TYPES[6] = {KING, QUEEN, ROOK, BISHOP, KNIGHT, PAWN};
+const int MATERIAL_VALUES[6] = {0, 9, 5, 3, 3, 1};
+
+const int KNIGHT_DELTAS[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+const int KING_DELTAS[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}};
+const int BISHOP_DIRECTIONS[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+const int ROOK_DIRECTIONS[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+struct FileHeader {
+    char magic[4];
+    uint8_t numPieces;
+    uint8_t reserved[3];
+    char signature[8];
+};
+static_assert(sizeof(FileHeader) == 16, "Tablebase header must stay 16 bytes");
+
+using Placement = std::array<int, TB_MAX_PIECES>;
+
+int signatureRank(char c) {
+    const char *found = std::strchr(SIGNATURE_ORDER, c);
+    return found && c ? static_cast<int>(found - SIGNATURE_ORDER) : -1;
+}
+
+std::string sortSide(std::string side) {
+    std::sort(side.begin(), side.end(), [](char a, char b) { return signatureRank(a) < signatureRank(b); });
+    return side;
+}
+
+int materialValue(const std::string &side) {
+    int value = 0;
+    for (char c : side) {
+        value += MATERIAL_VALUES[signatureRank(c)];
+    }
+    return value;
+}
+
+// Splits e.g. "KQKR" into "KQ" for white and "KR" for black
+bool splitSignature(const std::string &signature, std::string &white, std::string &black) {
+    size_t blackStart = signature.find('K', 1);
+    if (signature.empty() || signature[0] != 'K' || blackStart == std::string::npos ||
+        signature.find('K', blackStart + 1) != std::string::npos) {
+        return false;
+    }
+    for (char c : signature) {
+        if (signatureRank(c) < 0) {
+            return false;
+        }
+    }
+    white = sortSide(signature.substr(0, blackStart));
+    black = sortSide(signature.substr(blackStart));
+    return true;
+}
+
+// Tables are stored with the stronger side as white
+std::string canonicalSignature(std::string white, std::string black) {
+    white = sortSide(white);
+    black = sortSide(black);
+    int whiteValue = materialValue(white);
+    int blackValue = materialValue(black);
+    if (blackValue > whiteValue || (blackValue == whiteValue && black > white)) {
+        std::swap(white, black);
+    }
+    return white + black;
+}
+
+bool isTrivialDraw(const std::string &white, const std::string &black) {
+    std::string extra = white.substr(1) + black.substr(1);
+    return extra.empty() || extra == "B" || extra == "N";
+}
+
+uint64_t tableSize(int numPieces) {
+    return 2ULL << (6 * numPieces);
+}
+
+std::string tablePath(const std::string &directory, const std::string &signature) {
+    return directory + "/" + signature + TB_FILE_EXTENSION;
+}
+
+uint64_t encodeIndex(const Placement &squares, int numPieces, PieceColor sideToMove) {
+    uint64_t index = 0;
+    for (int i = numPieces - 1; i >= 0; i--) {
+        index = index * 64 + squares[i];
+    }
+    return index * 2 + sideToMove;
+}
+
+void decodeValue(uint8_t value, TablebaseResult &result) {
+    if (value == TB_DRAW) {
+        result = {0, 0};
+        return;
+    }
+    int dtm = value - 1;
+    result = {dtm % 2 == 1 ? 1 : -1, dtm};
+}
+
+// Side to move's view of a child position's result, as a dtm byte or TB_DRAW
+uint8_t valueThroughChild(const TablebaseResult &child) {
+    return child.wdl == 0 ? TB_DRAW : static_cast<uint8_t>(child.dtm + 2);
+}
+
+// An en passant square only matters if a pawn can actually take on it
+bool hasEnPassantCapture(const EngineBoard &board) {
+    int target = board.enPassantSquare();
+    if (target < 0) {
+        return false;
+    }
+    int pushed = target + (board.sideToMove() == WHITE ? 8 : -8);
+    EnginePiece capturer = makeEnginePiece(PAWN, board.sideToMove());
+    return (pushed % 8 > 0 && board.pieceAt(pushed - 1) == capturer) ||
+           (pushed % 8 < 7 && board.pieceAt(pushed + 1) == capturer);
+}
+
+template <typename Function>
+void parallelFor(uint64_t count, int numThreads, Function function) {
+    std::vector<std::thread> threads;
+    uint64_t chunk = (count + numThreads - 1) / numThreads;
+    for (int t = 0; t < numThreads; t++) {
+        uint64_t begin = t * chunk;
+        uint64_t end = std::min(count, begin + chunk);
+        threads.emplace_back([=, &function] {
+            for (uint64_t i = begin; i < end; i++) {
+                function(t, i);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Retrograde analysis for one material signature. Every position is first scored from its
+// captures and promotions into already generated subtables, then results are propagated
+// backwards one ply at a time with un-moves, counting down each position's remaining
+// in-table moves to detect losses
+class TablebaseGenerator {
+public:
+    TablebaseGenerator(const std::string &white, const std::string &black, const Tablebases &subtables, int numThreads)
+        : m_NumPieces(static_cast<int>(white.size() + black.size())), m_Size(tableSize(m_NumPieces)),
+          m_Subtables(subtables), m_NumThreads(std::max(1, numThreads)),
+          m_Values(new std::atomic<uint8_t>[m_Size]), m_Counters(new std::atomic<uint8_t>[m_Size]),
+          m_Pending(TB_MAX_DTM + 1) {
+        for (char c : white) {
+            m_Pieces.push_back(makeEnginePiece(SIGNATURE_TYPES[signatureRank(c)], WHITE));
+        }
+        for (char c : black) {
+            m_Pieces.push_back(makeEnginePiece(SIGNATURE_TYPES[signatureRank(c)], BLACK));
+        }
+    }
+
+    void run() {
+        std::vector<std::vector<uint32_t>> frontiers(m_NumThreads);
+        std::vector<std::vector<std::pair<int, uint32_t>>> pending(m_NumThreads);
+        parallelFor(m_Size, m_NumThreads, [&](int thread, uint64_t index) {
+            initialise(index, frontiers[thread], pending[thread]);
+        });
+        std::vector<uint32_t> frontier = merge(frontiers, pending);
+
+        for (int ply = 0; ply <= TB_MAX_DTM; ply++) {
+            for (uint32_t index : m_Pending[ply]) {
+                if (resolve(index, ply)) {
+                    frontier.push_back(index);
+                }
+            }
+            m_Pending[ply].clear();
+            if (frontier.empty()) {
+                continue;
+            }
+            std::vector<std::vector<uint32_t>> next(m_NumThreads);
+            parallelFor(frontier.size(), m_NumThreads, [&](int thread, uint64_t i) {
+                addPredecessors(frontier[i], ply, next[thread], pending[thread]);
+            });
+            frontier = merge(next, pending);
+        }
+    }
+
+    bool write(const std::string &path, const std::string &signature) {
+        FileHeader header{};
+        std::memcpy(header.magic, TB_MAGIC, sizeof(TB_MAGIC));
+        header.numPieces = static_cast<uint8_t>(m_NumPieces);
+        std::memcpy(header.signature, signature.data(), std::min(signature.size(), sizeof(header.signature)));
+
+        std::vector<uint8_t> values(m_Size);
+        for (uint64_t i = 0; i < m_Size; i++) {
+            uint8_t value = m_Values[i].load(std::memory_order_relaxed);
+            values[i] = value == TB_UNRESOLVED ? TB_DRAW : value;
+        }
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(values.data()), values.size());
+        return static_cast<bool>(file);
+    }
+
+private:
+    std::vector<EnginePiece> m_Pieces; // Index order: white pieces, then black, as in the signature
+    int m_NumPieces;
+    uint64_t m_Size;
+    const Tablebases &m_Subtables;
+    int m_NumThreads;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_Values;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_Counters; // In-table moves not yet known to lose
+    std::vector<std::vector<uint32_t>> m_Pending;       // Positions resolved by exits, by ply
+
+    std::vector<uint32_t> merge(std::vector<std::vector<uint32_t>> &lists,
+                                std::vector<std::vector<std::pair<int, uint32_t>>> &pending) {
+        std::vector<uint32_t> merged;
+        for (std::vector<uint32_t> &list : lists) {
+            merged.insert(merged.end(), list.begin(), list.end());
+            list.clear();
+        }
+        for (auto &list : pending) {
+            for (const auto &[ply, index] : list) {
+                if (ply <= TB_MAX_DTM) {
+                    m_Pending[ply].push_back(index);
+                }
+            }
+            list.clear();
+        }
+        return merged;
+    }
+
+    bool resolve(uint64_t index, int dtm) {
+        uint8_t expected = TB_UNRESOLVED;
+        return m_Values[index].compare_exchange_strong(expected, static_cast<uint8_t>(dtm + 1));
+    }
+
+    void decode(uint64_t index, Placement &squares, PieceColor &sideToMove) const {
+        sideToMove = static_cast<PieceColor>(index & 1);
+        index >>= 1;
+        for (int i = 0; i < m_NumPieces; i++) {
+            squares[i] = static_cast<int>(index & 63);
+            index >>= 6;
+        }
+    }
+
+    bool setupBoard(uint64_t index, EngineBoard &board, Placement &squares) const {
+        PieceColor sideToMove;
+        decode(index, squares, sideToMove);
+        board.clear();
+        for (int i = 0; i < m_NumPieces; i++) {
+            int row = squares[i] / 8;
+            if (board.pieceAt(squares[i]) || (enginePieceType(m_Pieces[i]) == PAWN && (row == 0 || row == 7))) {
+                return false;
+            }
+            board.setPiece(squares[i], m_Pieces[i]);
+        }
+        board.setSideToMove(sideToMove);
+        return !board.leftKingInCheck();
+    }
+
+    bool isExit(const EngineBoard &board, EncodedMove move) const {
+        return board.isCapture(move) || encodedMovePromoteType(move);
+    }
+
+    uint8_t exitValue(EngineBoard &board, EncodedMove move) const {
+        UndoInfo undo = board.makeMove(move);
+        TablebaseResult child;
+        if (!m_Subtables.probe(board, child)) {
+            THROW_RUNTIME_ERROR("Missing subtable for " << board.toFen());
+        }
+        board.unmakeMove(move, undo);
+        return valueThroughChild(child);
+    }
+
+    uint64_t childIndex(const Placement &squares, EncodedMove move, PieceColor sideToMove) const {
+        Placement child = squares;
+        for (int i = 0; i < m_NumPieces; i++) {
+            if (child[i] == encodedMoveSrc(move)) {
+                child[i] = encodedMoveDst(move);
+            }
+        }
+        return encodeIndex(child, m_NumPieces, sideToMove == WHITE ? BLACK : WHITE);
+    }
+
+    // Best value over every move, treating unresolved in-table children as draws
+    uint8_t forwardValue(uint64_t index) const {
+        EngineBoard board;
+        Placement squares;
+        setupBoard(index, board, squares);
+        MoveList legal;
+        board.generateLegalMoves(legal);
+
+        int bestWin = TB_NO_WIN;
+        int worstLoss = -1;
+        bool draw = false;
+        for (int i = 0; i < legal.count; i++) {
+            EncodedMove move = legal.moves[i];
+            uint8_t value;
+            if (isExit(board, move)) {
+                value = exitValue(board, move);
+            } else {
+                uint8_t child = m_Values[childIndex(squares, move, board.sideToMove())].load(std::memory_order_relaxed);
+                value = child == TB_UNRESOLVED || child == TB_DRAW ? TB_DRAW : static_cast<uint8_t>(child + 1);
+            }
+            if (value == TB_DRAW) {
+                draw = true;
+            } else if ((value - 1) % 2 == 1) {
+                bestWin = std::min(bestWin, value - 1);
+            } else {
+                worstLoss = std::max(worstLoss, value - 1);
+            }
+        }
+        if (bestWin != TB_NO_WIN) {
+            return static_cast<uint8_t>(bestWin + 1);
+        }
+        return draw ? TB_DRAW : static_cast<uint8_t>(worstLoss + 1);
+    }
+
+    void initialise(uint64_t index, std::vector<uint32_t> &frontier, std::vector<std::pair<int, uint32_t>> &pending) {
+        EngineBoard board;
+        Placement squares;
+        m_Counters[index].store(0, std::memory_order_relaxed);
+        if (!setupBoard(index, board, squares)) {
+            m_Values[index].store(TB_ILLEGAL, std::memory_order_relaxed);
+            return;
+        }
+
+        MoveList legal;
+        board.generateLegalMoves(legal);
+        if (legal.count == 0) {
+            bool mated = board.inCheck();
+            m_Values[index].store(mated ? 1 : TB_DRAW, std::memory_order_relaxed);
+            if (mated) {
+                frontier.push_back(static_cast<uint32_t>(index));
+            }
+            return;
+        }
+
+        int inTable = 0;
+        int bestWin = TB_NO_WIN;
+        int worstLoss = -1;
+        bool drawExit = false;
+        for (int i = 0; i < legal.count; i++) {
+            if (!isExit(board, legal.moves[i])) {
+                inTable++;
+                continue;
+            }
+            uint8_t value = exitValue(board, legal.moves[i]);
+            if (value == TB_DRAW) {
+                drawExit = true;
+            } else if ((value - 1) % 2 == 1) {
+                bestWin = std::min(bestWin, value - 1);
+            } else {
+                worstLoss = std::max(worstLoss, value - 1);
+            }
+        }
+
+        m_Values[index].store(TB_UNRESOLVED, std::memory_order_relaxed);
+        m_Counters[index].store(drawExit ? TB_DRAW_EXIT : static_cast<uint8_t>(inTable), std::memory_order_relaxed);
+        if (bestWin != TB_NO_WIN) {
+            pending.emplace_back(bestWin, static_cast<uint32_t>(index));
+        } else if (inTable == 0) {
+            if (drawExit) {
+                m_Values[index].store(TB_DRAW, std::memory_order_relaxed);
+            } else {
+                pending.emplace_back(worstLoss, static_cast<uint32_t>(index));
+            }
+        }
+    }
+
+    void addPredecessor(uint64_t predecessor, int ply, std::vector<uint32_t> &next,
+                        std::vector<std::pair<int, uint32_t>> &pending) {
+        uint8_t value = m_Values[predecessor].load(std::memory_order_relaxed);
+        if (value != TB_UNRESOLVED) {
+            return;
+        }
+        if (ply % 2 == 0) {
+            // The position we reached loses, so moving into it wins
+            if (resolve(predecessor, ply + 1)) {
+                next.push_back(static_cast<uint32_t>(predecessor));
+            }
+            return;
+        }
+        if (m_Counters[predecessor].load(std::memory_order_relaxed) == TB_DRAW_EXIT ||
+            m_Counters[predecessor].fetch_sub(1) != 1) {
+            return;
+        }
+        // Every in-table move now loses, but an exit may still lose more slowly
+        uint8_t resolved = forwardValue(predecessor);
+        if (resolved == TB_DRAW) {
+            return;
+        }
+        if (resolved - 1 == ply + 1) {
+            if (resolve(predecessor, ply + 1)) {
+                next.push_back(static_cast<uint32_t>(predecessor));
+            }
+        } else if (resolved - 1 > ply + 1) {
+            pending.emplace_back(resolved - 1, static_cast<uint32_t>(predecessor));
+        }
+    }
+
+    void addPredecessors(uint64_t index, int ply, std::vector<uint32_t> &next,
+                         std::vector<std::pair<int, uint32_t>> &pending) {
+        Placement squares;
+        PieceColor sideToMove;
+        decode(index, squares, sideToMove);
+        const PieceColor mover = sideToMove == WHITE ? BLACK : WHITE;
+        std::array<bool, NUM_SQUARES> occupied{};
+        for (int i = 0; i < m_NumPieces; i++) {
+            occupied[squares[i]] = true;
+        }
+
+        for (int i = 0; i < m_NumPieces; i++) {
+            if (enginePieceColor(m_Pieces[i]) != mover) {
+                continue;
+            }
+            const int x = squares[i] % 8;
+            const int y = squares[i] / 8;
+            auto unmoveTo = [&](int from) {
+                Placement previous = squares;
+                previous[i] = from;
+                addPredecessor(encodeIndex(previous, m_NumPieces, mover), ply, next, pending);
+            };
+            auto unmoveBy = [&](const int (&deltas)[8][2]) {
+                for (const auto &delta : deltas) {
+                    Position from = {x + delta[0], y + delta[1]};
+                    if (isValidPosition(from) && !occupied[from.y * 8 + from.x]) {
+                        unmoveTo(posToIndex(from));
+                    }
+                }
+            };
+            auto unmoveAlong = [&](const int (&directions)[4][2]) {
+                for (const auto &direction : directions) {
+                    Position from = {x + direction[0], y + direction[1]};
+                    while (isValidPosition(from) && !occupied[from.y * 8 + from.x]) {
+                        unmoveTo(posToIndex(from));
+                        from = {from.x + direction[0], from.y + direction[1]};
+                    }
+                }
+            };
+
+            switch (enginePieceType(m_Pieces[i])) {
+            case PAWN: {
+                // Pawns walk backwards and never from their own back rank
+                const int back = mover == WHITE ? 1 : -1;
+                const int startRow = mover == WHITE ? 6 : 1;
+                const int backRank = mover == WHITE ? 7 : 0;
+                Position from = {x, y + back};
+                if (isValidPosition(from) && from.y != backRank && !occupied[from.y * 8 + from.x]) {
+                    unmoveTo(posToIndex(from));
+                    Position doubleFrom = {x, y + 2 * back};
+                    if (doubleFrom.y == startRow && !occupied[doubleFrom.y * 8 + doubleFrom.x]) {
+                        unmoveTo(posToIndex(doubleFrom));
+                    }
+                }
+                break;
+            }
+            case KNIGHT:
+                unmoveBy(KNIGHT_DELTAS);
+                break;
+            case BISHOP:
+                unmoveAlong(BISHOP_DIRECTIONS);
+                break;
+            case ROOK:
+                unmoveAlong(ROOK_DIRECTIONS);
+                break;
+            case QUEEN:
+                unmoveAlong(BISHOP_DIRECTIONS);
+                unmoveAlong(ROOK_DIRECTIONS);
+                break;
+            case KING:
+                unmoveBy(KING_DELTAS);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+};
+} // namespace
+
+Tablebases::~Tablebases() {
+    for (auto &[signature, table] : m_Tables) {
+        munmap(table.mapped, table.mappedSize);
+    }
+}
+
+int Tablebases::loadDirectory(const std::string &directory) {
+    std::error_code error;
+    int loaded = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.path().extension() == TB_FILE_EXTENSION && load(entry.path().string())) {
+            loaded++;
+        }
+    }
+    if (error) {
+        LOG_WARN("No tablebases in: {}", directory);
+    }
+    return loaded;
+}
+
+bool Tablebases::load(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStat{};
+    if (fstat(fd, &fileStat) < 0 || fileStat.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Failed to map tablebase: {}", path);
+        return false;
+    }
+
+    const FileHeader *header = static_cast<const FileHeader *>(mapped);
+    std::string signature(header->signature, strnlen(header->signature, sizeof(header->signature)));
+    if (std::memcmp(header->magic, TB_MAGIC, sizeof(TB_MAGIC)) != 0 || header->numPieces > TB_MAX_PIECES ||
+        static_cast<uint64_t>(fileStat.st_size) != sizeof(FileHeader) + tableSize(header->numPieces) ||
+        m_Tables.count(signature)) {
+        LOG_WARN("Ignoring invalid tablebase: {}", path);
+        munmap(mapped, fileStat.st_size);
+        return false;
+    }
+
+    m_Tables.emplace(signature, Table{static_cast<const uint8_t *>(mapped) + sizeof(FileHeader), mapped,
+                                      static_cast<size_t>(fileStat.st_size)});
+    m_MaxPieces = std::max<int>(m_MaxPieces, header->numPieces);
+    LOG_INFO("Loaded tablebase {}", signature);
+    return true;
+}
+
+bool Tablebases::probe(const EngineBoard &board, TablebaseResult &result) const {
+    if (board.castlingRights() || hasEnPassantCapture(board) || board.pieceCount() > TB_MAX_PIECES) {
+        return false;
+    }
+
+    std::array<std::string, 2> sides;
+    std::array<Placement, 2> squares;
+    std::array<int, 2> counts = {0, 0};
+    for (int rank = 0; rank < 6; rank++) {
+        for (int square = 0; square < NUM_SQUARES; square++) {
+            EnginePiece piece = board.pieceAt(square);
+            if (piece && enginePieceType(piece) == SIGNATURE_TYPES[rank]) {
+                PieceColor color = enginePieceColor(piece);
+                sides[color] += SIGNATURE_ORDER[rank];
+                squares[color][counts[color]++] = square;
+            }
+        }
+    }
+    if (isTrivialDraw(sides[WHITE], sides[BLACK])) {
+        result = {0, 0};
+        return true;
+    }
+
+    // Tables only exist with the stronger side as white, so mirror the board if needed
+    bool mirrored = false;
+    auto table = m_Tables.find(sides[WHITE] + sides[BLACK]);
+    if (table == m_Tables.end()) {
+        table = m_Tables.find(sides[BLACK] + sides[WHITE]);
+        mirrored = true;
+        if (table == m_Tables.end()) {
+            return false;
+        }
+    }
+
+    Placement placement;
+    int numPieces = 0;
+    for (PieceColor color : {mirrored ? BLACK : WHITE, mirrored ? WHITE : BLACK}) {
+        for (int i = 0; i < counts[color]; i++) {
+            placement[numPieces++] = mirrored ? squares[color][i] ^ 56 : squares[color][i];
+        }
+    }
+    PieceColor sideToMove = board.sideToMove();
+    if (mirrored) {
+        sideToMove = sideToMove == WHITE ? BLACK : WHITE;
+    }
+
+    uint8_t value = table->second.values[encodeIndex(placement, numPieces, sideToMove)];
+    if (value == TB_ILLEGAL) {
+        return false;
+    }
+    decodeValue(value, result);
+    return true;
+}
+
+EncodedMove Tablebases::bestMove(const EngineBoard &board) const {
+    TablebaseResult result;
+    if (!probe(board, result)) {
+        return 0;
+    }
+
+    EngineBoard position = board;
+    MoveList legal;
+    position.generateLegalMoves(legal);
+    EncodedMove best = 0;
+    int bestRank = 0;
+    for (int i = 0; i < legal.count; i++) {
+        UndoInfo undo = position.makeMove(legal.moves[i]);
+        TablebaseResult child;
+        bool found = probe(position, child);
+        position.unmakeMove(legal.moves[i], undo);
+        if (!found) {
+            continue;
+        }
+        // Win as fast as possible, otherwise hold the draw, otherwise lose as slowly as possible
+        int rank = child.wdl < 0 ? 2000 - child.dtm : child.wdl == 0 ? 1000
+                                                                     : child.dtm;
+        if (!best || rank > bestRank) {
+            best = legal.moves[i];
+            bestRank = rank;
+        }
+    }
+    return best;
+}
+
+bool Tablebases::generate(const std::string &signature, const std::string &directory, int numThreads) {
+    std::string white, black;
+    if (!splitSignature(signature, white, black) || white.size() + black.size() > TB_MAX_PIECES) {
+        LOG_ERROR("Invalid tablebase signature: {}", signature);
+        return false;
+    }
+    std::string canonical = canonicalSignature(white, black);
+    splitSignature(canonical, white, black);
+    if (isTrivialDraw(white, black)) {
+        LOG_INFO("{} is always a draw, nothing to generate", canonical);
+        return true;
+    }
+
+    // Captures and promotions lead into other tables, which have to exist first
+    std::vector<std::string> dependencies;
+    for (std::string *side : {&white, &black}) {
+        for (size_t i = 1; i < side->size(); i++) {
+            std::string reduced = *side;
+            reduced.erase(i, 1);
+            dependencies.push_back(side == &white ? reduced + black : white + reduced);
+            if ((*side)[i] == 'P') {
+                for (char promotion : {'Q', 'R', 'B', 'N'}) {
+                    std::string promoted = *side;
+                    promoted[i] = promotion;
+                    dependencies.push_back(side == &white ? promoted + black : white + promoted);
+                }
+            }
+        }
+    }
+    for (const std::string &dependency : dependencies) {
+        std::string dependencyWhite, dependencyBlack;
+        splitSignature(dependency, dependencyWhite, dependencyBlack);
+        std::string name = canonicalSignature(dependencyWhite, dependencyBlack);
+        splitSignature(name, dependencyWhite, dependencyBlack);
+        if (!isTrivialDraw(dependencyWhite, dependencyBlack) && !std::filesystem::exists(tablePath(directory, name)) &&
+            !generate(name, directory, numThreads)) {
+            return false;
+        }
+    }
+
+    std::filesystem::create_directories(directory);
+    Tablebases subtables;
+    subtables.loadDirectory(directory);
+
+    LOG_INFO("Generating {} with {} threads..", canonical, numThreads);
+    TablebaseGenerator generator(white, black, subtables, numThreads);
+    generator.run();
+    if (!generator.write(tablePath(directory, canonical), canonical)) {
+        LOG_ERROR("Failed to write tablebase: {}", tablePath(directory, canonical));
+        return false;
+    }
+    LOG_INFO("Wrote {}", tablePath(directory, canonical));
+    return true;
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include "engine-board.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#define TB_MAX_PIECES 4
+#define TB_FILE_EXTENSION ".ctb"
+
+namespace chess_online {
+
+struct TablebaseResult {
+    int wdl; // 1 if the side to move wins, 0 for a draw, -1 if it loses
+    int dtm; // Plies to mate with best play, 0 for draws
+};
+
+// Endgame tablebases for up to TB_MAX_PIECES pieces, generated locally by retrograde analysis.
+// A table is named after its material, white first, e.g. KQK, KRK, KPK, KBNK or KQKR, and stores
+// one byte per (piece squares, side to move): 0 for a draw, 255 for an illegal position,
+// otherwise the distance to mate in plies plus one. Odd distances are wins for the side to move
+class Tablebases {
+public:
+    Tablebases() = default;
+    ~Tablebases();
+    Tablebases(const Tablebases &) = delete;
+    Tablebases &operator=(const Tablebases &) = delete;
+
+    int loadDirectory(const std::string &directory); // Maps every table found, returns how many
+    bool load(const std::string &path);
+    int maxPieces() const { return m_MaxPieces; }
+
+    // Positions with castling rights or an en passant square are never found in the tables
+    bool probe(const EngineBoard &board, TablebaseResult &result) const;
+    EncodedMove bestMove(const EngineBoard &board) const; // 0 when the position is not covered
+
+    // Generates the table and everything it depends on into the directory
+    static bool generate(const std::string &signature, const std::string &directory, int numThreads);
+
+private:
+    struct Table {
+        const uint8_t *values;
+        void *mapped;
+        size_t mappedSize;
+    };
+
+    std::unordered_map<std::string, Table> m_Tables;
+    int m_MaxPieces = 0;
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
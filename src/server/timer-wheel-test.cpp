@@ -0,0 +1,68 @@
+#ifdef CHESS_SERVER_BUILD
+#include "timer-wheel.h"
+#include <iostream>
+
+using namespace chess_online;
+
+static int failures = 0;
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+static void firesOnTime() {
+    TimerWheel wheel;
+    uint64_t firedAt[3] = {};
+    wheel.arm(1, [&] { firedAt[0] = wheel.now(); });
+    wheel.arm(100, [&] { firedAt[1] = wheel.now(); });
+    wheel.arm(300000, [&] { firedAt[2] = wheel.now(); }); // Cascaded down from the third level
+    wheel.advance(300000);
+    check(firedAt[0] == 1 && firedAt[1] == 100 && firedAt[2] == 300000, "timers fire on the tick they are due");
+    check(wheel.size() == 0, "fired timers are released");
+}
+
+static void cancelled() {
+    TimerWheel wheel;
+    bool fired = false;
+    const TimerId id = wheel.arm(5, [&] { fired = true; });
+    check(wheel.cancel(id), "an armed timer can be cancelled");
+    check(!wheel.cancel(id), "a cancelled timer cannot be cancelled again");
+    wheel.advance(10);
+    check(!fired, "a cancelled timer does not fire");
+}
+
+// A callback cancels a timer due on the same tick and arms another, which gets the cancelled one's slot
+static void cancelThenRearmOnTheSameTick() {
+    TimerWheel wheel;
+    bool cancelledFired = false;
+    bool rearmedFired = false;
+    const TimerId cancelled = wheel.arm(5, [&] { cancelledFired = true; });
+    TimerId rearmed = 0;
+    wheel.arm(5, [&] {
+        wheel.cancel(cancelled);
+        rearmed = wheel.arm(1000, [&] { rearmedFired = true; });
+    });
+    // The later one is first on the slot, so it runs first and the freed slot is reused straight away
+    wheel.advance(6);
+    check(static_cast<uint32_t>(rearmed) == static_cast<uint32_t>(cancelled), "the re-armed timer reuses the cancelled one's slot");
+    check(!cancelledFired, "a timer cancelled by one due on the same tick does not fire");
+    check(!rearmedFired, "a timer armed into a cancelled slot does not fire on that slot's tick");
+    check(wheel.size() == 1, "the re-armed timer is still pending");
+    wheel.advance(1005);
+    check(rearmedFired, "the re-armed timer fires when it is due");
+}
+
+// Checks the timing wheel, exits with the number of failed checks
+int main() {
+    firesOnTime();
+    cancelled();
+    cancelThenRearmOnTheSameTick();
+    if (failures == 0) {
+        std::cout << "timer wheel: all checks passed" << std::endl;
+    }
+    return failures;
+}
+#endif
\ No newline at end of file
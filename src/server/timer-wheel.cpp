@@ -0,0 +1,131 @@
+#ifdef CHESS_SERVER_BUILD
+#include "timer-wheel.h"
+#include <algorithm>
+
+namespace chess_online {
+namespace {
+uint32_t slotOf(uint64_t tick, int level) {
+    return static_cast<uint32_t>(tick >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+} // namespace
+
+TimerWheel::TimerWheel() {
+    std::fill(&m_Slots[0][0], &m_Slots[0][0] + TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS, NONE);
+}
+
+TimerId TimerWheel::arm(uint64_t delayTicks, Callback callback) {
+    uint32_t index;
+    if (m_FreeTimers.empty()) {
+        index = static_cast<uint32_t>(m_Timers.size());
+        m_Timers.emplace_back();
+    } else {
+        index = m_FreeTimers.back();
+        m_FreeTimers.pop_back();
+    }
+    Timer &timer = m_Timers[index];
+    timer.expires = m_Now + std::max<uint64_t>(delayTicks, 1);
+    timer.armed = true;
+    timer.callback = std::move(callback);
+    link(index);
+    m_Armed++;
+    return idOf(index);
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    const uint32_t index = static_cast<uint32_t>(id);
+    if (index >= m_Timers.size() || !m_Timers[index].armed || m_Timers[index].generation != id >> 32) {
+        return false;
+    }
+    if (m_Timers[index].level != DETACHED) {
+        unlink(index);
+    }
+    release(index);
+    return true;
+}
+
+void TimerWheel::advance(uint64_t nowTick) {
+    while (m_Now < nowTick) {
+        if (m_Armed == 0) {
+            m_Now = nowTick; // Nothing to cascade or fire, a long idle stretch costs nothing
+            return;
+        }
+        m_Now++;
+        // Each level is cascaded when the one below has wrapped around to its first slot
+        for (int level = 1; level < TIMER_WHEEL_LEVELS && slotOf(m_Now, level - 1) == 0; level++) {
+            cascade(level);
+        }
+        uint32_t &slot = m_Slots[0][slotOf(m_Now, 0)];
+        for (uint32_t index = slot; index != NONE; index = m_Timers[index].next) {
+            m_Timers[index].level = DETACHED;
+            m_Expired.push_back(idOf(index));
+        }
+        slot = NONE;
+        // Callbacks can arm timers, which may move the pool, and cancel ones that have not fired yet. A
+        // cancelled one's slot may already hold a newly armed timer, which the generation tells apart
+        for (size_t i = 0; i < m_Expired.size(); i++) {
+            const uint32_t index = static_cast<uint32_t>(m_Expired[i]);
+            if (!m_Timers[index].armed || idOf(index) != m_Expired[i]) {
+                continue;
+            }
+            Callback callback = std::move(m_Timers[index].callback);
+            release(index);
+            callback();
+        }
+        m_Expired.clear();
+    }
+}
+
+void TimerWheel::link(uint32_t index) {
+    Timer &timer = m_Timers[index];
+    const uint64_t delta = timer.expires - m_Now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_BITS))) {
+        level++;
+    }
+    // Too far ahead for the last level, it goes round once more and is placed again when cascaded
+    const uint64_t maxDelta = (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+    const uint64_t placeAt = delta > maxDelta ? m_Now + maxDelta : timer.expires;
+    uint32_t &slot = m_Slots[level][slotOf(placeAt, level)];
+    timer.level = static_cast<uint8_t>(level);
+    timer.slot = static_cast<uint8_t>(slotOf(placeAt, level));
+    timer.previous = NONE;
+    timer.next = slot;
+    if (slot != NONE) {
+        m_Timers[slot].previous = index;
+    }
+    slot = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Timer &timer = m_Timers[index];
+    if (timer.previous != NONE) {
+        m_Timers[timer.previous].next = timer.next;
+    } else {
+        m_Slots[timer.level][timer.slot] = timer.next;
+    }
+    if (timer.next != NONE) {
+        m_Timers[timer.next].previous = timer.previous;
+    }
+}
+
+void TimerWheel::release(uint32_t index) {
+    Timer &timer = m_Timers[index];
+    timer.armed = false;
+    timer.callback = nullptr;
+    timer.generation++;
+    m_FreeTimers.push_back(index);
+    m_Armed--;
+}
+
+void TimerWheel::cascade(int level) {
+    uint32_t &slot = m_Slots[level][slotOf(m_Now, level)];
+    uint32_t index = slot;
+    slot = NONE;
+    while (index != NONE) {
+        const uint32_t next = m_Timers[index].next;
+        link(index);
+        index = next;
+    }
+}
+} // namespace chess_online
+#endif
\ No newline at end of file
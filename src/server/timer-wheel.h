@@ -0,0 +1,64 @@
+#ifdef CHESS_SERVER_BUILD
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#define TIMER_TICK_MS 10
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 10 ms ticks up to 46 hours ahead, later deadlines wait in the last level
+
+namespace chess_online {
+
+using TimerId = uint64_t; // Generation and index, 0 is never a valid timer
+
+// Hierarchical timing wheel. Level 0 holds the next TIMER_WHEEL_SLOTS ticks one slot per tick, every
+// further level covers TIMER_WHEEL_SLOTS times the span of the one below and is cascaded down a level
+// whenever the one below wraps around. Arming and cancelling are O(1), timers are kept in one pool and
+// linked through indices, so a million of them is one allocation. Not thread safe, every worker owns one
+class TimerWheel {
+public:
+    using Callback = std::function<void()>;
+
+    TimerWheel();
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    TimerId arm(uint64_t delayTicks, Callback callback); // Fires after at least one tick
+    bool cancel(TimerId id);                             // False if it already fired or was cancelled
+    void advance(uint64_t nowTick);                      // Fires everything due, callbacks may arm and cancel
+    uint64_t now() const { return m_Now; }
+    size_t size() const { return m_Armed; }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint8_t DETACHED = UINT8_MAX; // Taken off its slot and about to fire
+
+    struct Timer {
+        uint64_t expires = 0;
+        uint32_t generation = 1;
+        uint32_t previous = NONE;
+        uint32_t next = NONE;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        bool armed = false;
+        Callback callback;
+    };
+
+    std::vector<Timer> m_Timers;
+    std::vector<uint32_t> m_FreeTimers;
+    uint32_t m_Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    std::vector<TimerId> m_Expired; // Ids rather than indices, a slot can be reused by a callback before its turn
+    uint64_t m_Now = 0;
+    size_t m_Armed = 0;
+
+    TimerId idOf(uint32_t index) const { return static_cast<uint64_t>(m_Timers[index].generation) << 32 | index; }
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(int level);
+};
+} // namespace chess_online
+#endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+namespace chess_online {
+
+// Fixed-seed Zobrist keys shared by the game, the engine and the on-disk book/tablebase files.
+// Changing the seed invalidates every generated file
+struct ZobristKeys {
+    uint64_t pieces[2][7][64]; // [PieceColor][PieceType][square index]
+    uint64_t side;
+    uint64_t castling[16];
+    uint64_t enPassantFile[8];
+};
+
+constexpr uint64_t splitMix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+constexpr ZobristKeys generateZobristKeys() {
+    ZobristKeys keys{};
+    uint64_t state = 0x43686573734B6579ULL;
+    for (int color = 0; color < 2; color++) {
+        for (int type = 0; type < 7; type++) {
+            for (int square = 0; square < 64; square++) {
+                keys.pieces[color][type][square] = type ? splitMix64(state) : 0;
+            }
+        }
+    }
+    keys.side = splitMix64(state);
+    for (int rights = 0; rights < 16; rights++) {
+        keys.castling[rights] = rights ? splitMix64(state) : 0;
+    }
+    for (int file = 0; file < 8; file++) {
+        keys.enPassantFile[file] = splitMix64(state);
+    }
+    return keys;
+}
+
+inline constexpr ZobristKeys ZOBRIST = generateZobristKeys();
+} // namespace chess_online
\ No newline at end of file